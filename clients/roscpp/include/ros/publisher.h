@@ -118,6 +118,15 @@ namespace ros
       publish(boost::bind(serializeMessage<M>, boost::ref(message)), m);
     }
 
+    /**
+     * \brief Publish a message that is already serialized, such as one received on another topic.
+     *
+     * m.buf must hold the 4 byte length of the message followed by the message, serialized with the md5sum
+     * this Publisher was advertised with. The buffer is queued as it is, without being
+     * copied or serialized again, so it must not be modified afterwards. In-process subscribers deserialize it.
+     */
+    void publishSerialized(const SerializedMessage& m) const;
+
     /**
      * \brief Shutdown the advertisement associated with this Publisher
      *
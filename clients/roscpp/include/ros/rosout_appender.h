@@ -40,6 +40,8 @@
 
 #include <boost/shared_ptr.hpp>
 #include <boost/weak_ptr.hpp>
+#include <boost/scoped_array.hpp>
+#include <boost/atomic.hpp>
 
 #include <boost/thread.hpp>
 
@@ -63,15 +65,29 @@ public:
 
   const std::string& getLastError() const;
 
+  /**
+   * \brief Returns the number of log messages dropped because the queue to /rosout was full
+   */
+  uint32_t getDroppedCount() const;
+
   virtual void log(::ros::console::Level level, const char* str, const char* file, const char* function, int line);
 
 protected:
+  struct LogEntry;
+
   void logThread();
+  bool pop(rosgraph_msgs::Log& msg);
+  bool isQueueEmpty() const;
 
   std::string last_error_;
 
-  typedef std::vector<rosgraph_msgs::LogPtr> V_Log;
-  V_Log log_queue_;
+  // Log messages waiting to be published, in a fixed ring that log() pushes to without locking.
+  // Its entries keep their strings from one use to the next, so logging normally does not allocate.
+  boost::scoped_array<LogEntry> log_queue_;
+  boost::atomic<uint32_t> enqueue_pos_;
+  uint32_t dequeue_pos_;  // Only used by the publish thread
+  boost::atomic<uint32_t> dropped_;
+  boost::atomic<bool> thread_waiting_;  // Set while the publish thread may wait for queue_condition_
   boost::mutex queue_mutex_;
   boost::condition_variable queue_condition_;
   bool shutting_down_;
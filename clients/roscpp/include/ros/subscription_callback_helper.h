@@ -45,6 +45,7 @@
 #include <boost/type_traits/is_base_of.hpp>
 #include <boost/utility/enable_if.hpp>
 #include <boost/make_shared.hpp>
+#include <boost/shared_array.hpp>
 
 namespace ros
 {
@@ -54,6 +55,22 @@ struct SubscriptionCallbackHelperDeserializeParams
   uint8_t* buffer;
   uint32_t length;
   boost::shared_ptr<M_string> connection_header;
+  boost::shared_array<uint8_t> buffer_owner;  //!< Holds buffer, if it may be referenced after deserialization
+};
+
+/**
+ * \brief Lets a message type keep a reference to the buffer it is received in, instead of deserializing it.
+ *
+ * Specialize adopt() to hold on to owner, which keeps the length bytes at data valid, and return true. The
+ * buffer may be shared with other subscriptions and publications, so it must not be modified.
+ */
+template<typename M>
+struct SerializedBufferAdopter
+{
+  static bool adopt(M&, const boost::shared_array<uint8_t>&, uint8_t*, uint32_t)
+  {
+    return false;
+  }
 };
 
 struct ROSCPP_DECL SubscriptionCallbackHelperCallParams
@@ -132,8 +149,12 @@ public:
     predes_params.connection_header = params.connection_header;
     ser::PreDeserialize<NonConstType>::notify(predes_params);
 
-    ser::IStream stream(params.buffer, params.length);
-    ser::deserialize(stream, *msg);
+    if (!params.buffer_owner ||
+        !SerializedBufferAdopter<NonConstType>::adopt(*msg, params.buffer_owner, params.buffer, params.length))
+    {
+      ser::IStream stream(params.buffer, params.length);
+      ser::deserialize(stream, *msg);
+    }
 
     return VoidConstPtr(msg);
   }
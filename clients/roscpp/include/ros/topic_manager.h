@@ -83,6 +83,14 @@ public:
    */
   void getAdvertisedTopics(V_string& topics);
 
+  /** @brief Get the list of topics advertised by this node if it changed since an earlier call
+   *
+   * @param[out] topics The advertised topics, left alone if they did not change
+   * @param[in,out] version The version of the list in topics, updated along with it
+   * @return true if topics was updated
+   */
+  bool getAdvertisedTopics(V_string& topics, uint32_t& version);
+
   /** @brief Get the list of topics subscribed to by this node
    *
    * @param[out] The subscribed topics
@@ -128,6 +136,8 @@ public:
   }
 
   void publish(const std::string &_topic, const boost::function<SerializedMessage(void)>& serfunc, SerializedMessage& m);
+  //! Publish a message that is already serialized, without checking how the subscribers want it
+  void publishSerialized(const std::string &_topic, const SerializedMessage& m);
 
   void incrementSequence(const std::string &_topic);
   bool isLatched(const std::string& topic);
@@ -224,6 +234,7 @@ private:
   boost::recursive_mutex advertised_topics_mutex_;
   V_Publication advertised_topics_;
   std::list<std::string> advertised_topic_names_;
+  uint32_t advertised_topic_names_version_;  // Incremented on every change to advertised_topic_names_, never 0
   boost::mutex advertised_topic_names_mutex_;
 
   volatile bool shutting_down_;
@@ -71,6 +71,7 @@ VoidConstPtr MessageDeserializer::deserialize()
     params.buffer = serialized_message_.message_start;
     params.length = serialized_message_.num_bytes - (serialized_message_.message_start - serialized_message_.buf.get());
     params.connection_header = connection_header_;
+    params.buffer_owner = serialized_message_.buf;
     msg_ = helper_->deserialize(params);
   }
   catch (std::exception& e)
@@ -92,6 +92,25 @@ void Publisher::publish(const boost::function<SerializedMessage(void)>& serfunc,
   TopicManager::instance()->publish(impl_->topic_, serfunc, m);
 }
 
+void Publisher::publishSerialized(const SerializedMessage& m) const
+{
+  if (!impl_)
+  {
+    ROS_ASSERT_MSG(false, "Call to publishSerialized() on an invalid Publisher");
+    return;
+  }
+
+  if (!impl_->isValid())
+  {
+    ROS_ASSERT_MSG(false, "Call to publishSerialized() on an invalid Publisher (topic [%s])", impl_->topic_.c_str());
+    return;
+  }
+
+  ROS_ASSERT_MSG(m.buf && m.num_bytes >= 4, "Call to publishSerialized() without a serialized message (topic [%s])", impl_->topic_.c_str());
+
+  TopicManager::instance()->publishSerialized(impl_->topic_, m);
+}
+
 void Publisher::incrementSequence() const
 {
   if (impl_ && impl_->isValid())
@@ -42,14 +42,42 @@
 
 #include <rosgraph_msgs/Log.h>
 
+#include <sstream>
+
 namespace ros
 {
 
+// Number of log messages that can wait to be published, a power of 2
+static const uint32_t LOG_QUEUE_SIZE = 4096;
+
+// An entry of the log queue. sequence tells whose turn it is: it equals the position in the ring
+// when log() may fill the entry, and that position + 1 once it is filled and may be published.
+struct ROSOutAppender::LogEntry
+{
+  boost::atomic<uint32_t> sequence;
+  ros::Time stamp;
+  uint8_t level;
+  std::string msg;
+  std::string file;
+  std::string function;
+  uint32_t line;
+};
+
 ROSOutAppender::ROSOutAppender()
-: shutting_down_(false)
+: log_queue_(new LogEntry[LOG_QUEUE_SIZE])
+, enqueue_pos_(0)
+, dequeue_pos_(0)
+, dropped_(0)
+, thread_waiting_(false)
+, shutting_down_(false)
 , disable_topics_(false)
-, publish_thread_(boost::bind(&ROSOutAppender::logThread, this))
 {
+  for (uint32_t i = 0; i < LOG_QUEUE_SIZE; ++i)
+  {
+    log_queue_[i].sequence.store(i, boost::memory_order_relaxed);
+  }
+  publish_thread_ = boost::thread(boost::bind(&ROSOutAppender::logThread, this));
+
   AdvertiseOptions ops;
   ops.init<rosgraph_msgs::Log>(names::resolve("/rosout"), 0);
   ops.latch = true;
@@ -74,84 +102,166 @@ const std::string&  ROSOutAppender::getLastError() const
   return last_error_;
 }
 
+uint32_t ROSOutAppender::getDroppedCount() const
+{
+  return dropped_.load();
+}
+
 void ROSOutAppender::log(::ros::console::Level level, const char* str, const char* file, const char* function, int line)
 {
-  rosgraph_msgs::LogPtr msg(boost::make_shared<rosgraph_msgs::Log>());
+  if (level == ::ros::console::levels::Fatal || level == ::ros::console::levels::Error)
+  {
+    last_error_ = str;
+  }
+
+  // Claim the entry at the end of the ring, unless it has not been published yet
+  uint32_t pos = enqueue_pos_.load(boost::memory_order_relaxed);
+  LogEntry* entry;
+  while (true)
+  {
+    entry = &log_queue_[pos & (LOG_QUEUE_SIZE - 1)];
+    int32_t diff = (int32_t)(entry->sequence.load(boost::memory_order_acquire) - pos);
+    if (diff == 0)
+    {
+      if (enqueue_pos_.compare_exchange_weak(pos, pos + 1, boost::memory_order_relaxed))
+      {
+        break;
+      }
+    }
+    else if (diff < 0)
+    {
+      // The queue is full; the publish thread reports the dropped messages
+      dropped_.fetch_add(1, boost::memory_order_relaxed);
+      return;
+    }
+    else
+    {
+      pos = enqueue_pos_.load(boost::memory_order_relaxed);
+    }
+  }
 
-  msg->header.stamp = ros::Time::now();
+  entry->stamp = ros::Time::now();
   if (level == ros::console::levels::Debug)
   {
-    msg->level = rosgraph_msgs::Log::DEBUG;
+    entry->level = rosgraph_msgs::Log::DEBUG;
   }
   else if (level == ros::console::levels::Info)
   {
-    msg->level = rosgraph_msgs::Log::INFO;
+    entry->level = rosgraph_msgs::Log::INFO;
   }
   else if (level == ros::console::levels::Warn)
   {
-    msg->level = rosgraph_msgs::Log::WARN;
+    entry->level = rosgraph_msgs::Log::WARN;
   }
   else if (level == ros::console::levels::Error)
   {
-    msg->level = rosgraph_msgs::Log::ERROR;
+    entry->level = rosgraph_msgs::Log::ERROR;
   }
   else if (level == ros::console::levels::Fatal)
   {
-    msg->level = rosgraph_msgs::Log::FATAL;
+    entry->level = rosgraph_msgs::Log::FATAL;
   }
-  msg->name = this_node::getName();
-  msg->msg = str;
-  msg->file = file;
-  msg->function = function;
-  msg->line = line;
-  
-  // check parameter server/cache for omit_topics flag
-  // the same parameter is checked in rosout.py for the same purpose
-  ros::param::getCached("/rosout_disable_topics_generation", disable_topics_);
-
-  if (!disable_topics_){
-    this_node::getAdvertisedTopics(msg->topics);
+  entry->msg = str;
+  entry->file = file;
+  entry->function = function;
+  entry->line = line;
+  entry->sequence.store(pos + 1);
+
+  // Only wake up the publish thread if it may be waiting; both sides use sequentially consistent
+  // operations, so either it sees the new entry or we see it waiting
+  if (thread_waiting_.load())
+  {
+    boost::mutex::scoped_lock lock(queue_mutex_);
+    queue_condition_.notify_all();
   }
+}
 
-  if (level == ::ros::console::levels::Fatal || level == ::ros::console::levels::Error)
+bool ROSOutAppender::isQueueEmpty() const
+{
+  return log_queue_[dequeue_pos_ & (LOG_QUEUE_SIZE - 1)].sequence.load() != dequeue_pos_ + 1;
+}
+
+bool ROSOutAppender::pop(rosgraph_msgs::Log& msg)
+{
+  LogEntry& entry = log_queue_[dequeue_pos_ & (LOG_QUEUE_SIZE - 1)];
+  if (entry.sequence.load(boost::memory_order_acquire) != dequeue_pos_ + 1)
   {
-    last_error_ = str;
+    return false;
   }
 
-  boost::mutex::scoped_lock lock(queue_mutex_);
-  log_queue_.push_back(msg);
-  queue_condition_.notify_all();
+  msg.header.stamp = entry.stamp;
+  msg.level = entry.level;
+  msg.msg.swap(entry.msg);
+  msg.file.swap(entry.file);
+  msg.function.swap(entry.function);
+  msg.line = entry.line;
+
+  // Hand the entry back to log() for its next turn around the ring
+  entry.sequence.store(dequeue_pos_ + LOG_QUEUE_SIZE, boost::memory_order_release);
+  ++dequeue_pos_;
+  return true;
 }
 
 void ROSOutAppender::logThread()
 {
+  // Fields that are the same for every message are only filled once
+  const std::string topic = names::resolve("/rosout");
+  rosgraph_msgs::Log msg;
+  msg.name = this_node::getName();
+  uint32_t topics_version = 0;
+  uint32_t reported_dropped = 0;
+
   while (!shutting_down_)
   {
-    V_Log local_queue;
-
     {
       boost::mutex::scoped_lock lock(queue_mutex_);
 
-      if (shutting_down_)
+      thread_waiting_.store(true);
+      if (!shutting_down_ && isQueueEmpty())
       {
-        return;
+        queue_condition_.wait(lock);
       }
-
-      queue_condition_.wait(lock);
+      thread_waiting_.store(false);
 
       if (shutting_down_)
       {
         return;
       }
+    }
+
+    // check parameter server/cache for omit_topics flag
+    // the same parameter is checked in rosout.py for the same purpose
+    ros::param::getCached("/rosout_disable_topics_generation", disable_topics_);
 
-      local_queue.swap(log_queue_);
+    // The topic list is only copied again after a topic is advertised or unadvertised
+    if (disable_topics_)
+    {
+      msg.topics.clear();
+      topics_version = 0;
+    }
+    else
+    {
+      TopicManager::instance()->getAdvertisedTopics(msg.topics, topics_version);
+    }
+
+    while (pop(msg))
+    {
+      TopicManager::instance()->publish(topic, msg);
     }
 
-    V_Log::iterator it = local_queue.begin();
-    V_Log::iterator end = local_queue.end();
-    for (; it != end; ++it)
+    uint32_t dropped = dropped_.load(boost::memory_order_relaxed);
+    if (dropped != reported_dropped)
     {
-      TopicManager::instance()->publish(names::resolve("/rosout"), *(*it));
+      std::stringstream ss;
+      ss << "Dropped " << dropped - reported_dropped << " log messages because too many were logged at once";
+      msg.header.stamp = ros::Time::now();
+      msg.level = rosgraph_msgs::Log::WARN;
+      msg.msg = ss.str();
+      msg.file.clear();
+      msg.function.clear();
+      msg.line = 0;
+      TopicManager::instance()->publish(topic, msg);
+      reported_dropped = dropped;
     }
   }
 }
@@ -60,7 +60,8 @@ const TopicManagerPtr& TopicManager::instance()
 }
 
 TopicManager::TopicManager()
-: shutting_down_(false)
+: advertised_topic_names_version_(1)
+, shutting_down_(false)
 {
 }
 
@@ -169,6 +170,20 @@ void TopicManager::getAdvertisedTopics(V_string& topics)
             topics.begin());
 }
 
+bool TopicManager::getAdvertisedTopics(V_string& topics, uint32_t& version)
+{
+  boost::mutex::scoped_lock lock(advertised_topic_names_mutex_);
+
+  if (version == advertised_topic_names_version_)
+  {
+    return false;
+  }
+
+  topics.assign(advertised_topic_names_.begin(), advertised_topic_names_.end());
+  version = advertised_topic_names_version_;
+  return true;
+}
+
 void TopicManager::getSubscribedTopics(V_string& topics)
 {
   boost::mutex::scoped_lock lock(subs_mutex_);
@@ -360,6 +375,10 @@ bool TopicManager::advertise(const AdvertiseOptions& ops, const SubscriberCallba
   {
     boost::mutex::scoped_lock lock(advertised_topic_names_mutex_);
     advertised_topic_names_.push_back(ops.topic);
+    if (++advertised_topic_names_version_ == 0)
+    {
+      advertised_topic_names_version_ = 1;
+    }
   }
 
   // Check whether we've already subscribed to this topic.  If so, we'll do
@@ -441,6 +460,10 @@ bool TopicManager::unadvertise(const std::string &topic, const SubscriberCallbac
       {
         boost::mutex::scoped_lock lock(advertised_topic_names_mutex_);
         advertised_topic_names_.remove(pub->getName());
+        if (++advertised_topic_names_version_ == 0)
+        {
+          advertised_topic_names_version_ = 1;
+        }
       }
     }
   }
@@ -759,6 +782,35 @@ void TopicManager::publish(const std::string& topic, const boost::function<Seria
   }
 }
 
+void TopicManager::publishSerialized(const std::string& topic, const SerializedMessage& m)
+{
+  boost::recursive_mutex::scoped_lock lock(advertised_topics_mutex_);
+
+  if (isShuttingDown())
+  {
+    return;
+  }
+
+  PublicationPtr p = lookupPublicationWithoutLock(topic);
+  if (!p)
+  {
+    return;
+  }
+
+  if (p->hasSubscribers() || p->isLatching())
+  {
+    // Every subscriber, in-process ones included, gets the serialized message
+    SerializedMessage m2(m.buf, m.num_bytes);
+    m2.message_start = m2.buf.get() + 4;
+    p->publish(m2);
+    poll_manager_->getPollSet().signal();
+  }
+  else
+  {
+    p->incrementSequence();
+  }
+}
+
 void TopicManager::incrementSequence(const std::string& topic)
 {
   PublicationPtr pub = lookupPublication(topic);
@@ -0,0 +1,148 @@
+/*********************************************************************
+* Software License Agreement (BSD License)
+*
+*  Copyright (c) 2026, Open Source Robotics Foundation, Inc.
+*  All rights reserved.
+*
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions
+*  are met:
+*
+*   * Redistributions of source code must retain the above copyright
+*     notice, this list of conditions and the following disclaimer.
+*   * Redistributions in binary form must reproduce the above
+*     copyright notice, this list of conditions and the following
+*     disclaimer in the documentation and/or other materials provided
+*     with the distribution.
+*   * Neither the name of Open Source Robotics Foundation, Inc. nor the
+*     names of its contributors may be used to endorse or promote products
+*     derived from this software without specific prior written permission.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+*  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+*  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+*  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+*  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+*  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+*  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+*  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+*  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+*  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+*  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+*  POSSIBILITY OF SUCH DAMAGE.
+********************************************************************/
+
+#include "rosbag/recorder.h"
+
+#include <gtest/gtest.h>
+
+#include "helpers.h"
+
+using rosbag::OutgoingMessage;
+using rosbag::RecordBuffer;
+using rosbag::TopicQueue;
+
+OutgoingMessage makeMessage(std::string const& topic, uint32_t size, uint32_t sec)
+{
+  return OutgoingMessage(topic, test_rosbag::makeShapeShifter(size), boost::shared_ptr<ros::M_string>(), ros::Time(sec, 0));
+}
+
+TEST(RecordBuffer, dropsOldestOfAnyTopic)
+{
+  RecordBuffer buffer(1000);
+  boost::shared_ptr<TopicQueue> image = buffer.addTopic("/image");
+  boost::shared_ptr<TopicQueue> imu = buffer.addTopic("/imu");
+
+  // The images fill the buffer
+  uint32_t sec = 1;
+  for (int i = 0; i < 5; ++i)
+    EXPECT_EQ(buffer.push(*image, makeMessage("/image", 200, sec++)), 0U);
+  EXPECT_EQ(buffer.getSize(), 1000U);
+
+  // The IMU messages make room by dropping the oldest image, not themselves
+  EXPECT_EQ(buffer.push(*imu, makeMessage("/imu", 10, sec++)), 1U);
+  EXPECT_EQ(buffer.push(*imu, makeMessage("/imu", 10, sec++)), 0U);
+  EXPECT_EQ(buffer.push(*imu, makeMessage("/imu", 10, sec++)), 0U);
+  EXPECT_EQ(imu->messages.size(), 3U);
+  EXPECT_EQ(image->dropped, 1U);
+  EXPECT_EQ(image->messages.front().time, ros::Time(2, 0));
+
+  // Later images keep dropping older images while there are some
+  for (int i = 0; i < 4; ++i)
+    EXPECT_EQ(buffer.push(*image, makeMessage("/image", 200, sec++)), 1U);
+  EXPECT_EQ(imu->messages.size(), 3U);
+  EXPECT_EQ(imu->dropped, 0U);
+  EXPECT_EQ(image->dropped, 5U);
+  EXPECT_EQ(buffer.getSize(), 830U);
+
+  // Until the IMU messages are the oldest
+  EXPECT_EQ(buffer.push(*image, makeMessage("/image", 200, sec++)), 3U);
+  EXPECT_EQ(imu->messages.size(), 0U);
+  EXPECT_EQ(imu->dropped, 3U);
+  EXPECT_EQ(image->messages.size(), 5U);
+  EXPECT_EQ(buffer.getSize(), 1000U);
+  EXPECT_EQ(buffer.getCount(), 5U);
+}
+
+TEST(RecordBuffer, drainInterleavesTopics)
+{
+  RecordBuffer buffer(0);
+  boost::shared_ptr<TopicQueue> a = buffer.addTopic("/a");
+  boost::shared_ptr<TopicQueue> b = buffer.addTopic("/b");
+
+  buffer.push(*a, makeMessage("/a", 10, 1));
+  buffer.push(*b, makeMessage("/b", 10, 2));
+  buffer.push(*a, makeMessage("/a", 10, 3));
+
+  std::vector<OutgoingMessage> batch;
+  buffer.drain(batch);
+  ASSERT_EQ(batch.size(), 3U);
+  EXPECT_EQ(batch[0].topic, "/a");
+  EXPECT_EQ(batch[1].topic, "/b");
+  EXPECT_EQ(batch[2].topic, "/a");
+  EXPECT_EQ(buffer.getSize(), 0U);
+  EXPECT_EQ(buffer.getCount(), 0U);
+}
+
+TEST(RecordBuffer, dropsAfterDrain)
+{
+  RecordBuffer buffer(100);
+  boost::shared_ptr<TopicQueue> a = buffer.addTopic("/a");
+  boost::shared_ptr<TopicQueue> b = buffer.addTopic("/b");
+
+  buffer.push(*a, makeMessage("/a", 60, 1));
+  buffer.push(*b, makeMessage("/b", 30, 2));
+  std::vector<OutgoingMessage> batch;
+  buffer.drain(batch);
+
+  // Only messages queued since the drain are candidates for dropping
+  EXPECT_EQ(buffer.push(*b, makeMessage("/b", 60, 3)), 0U);
+  EXPECT_EQ(buffer.push(*a, makeMessage("/a", 60, 4)), 1U);
+  EXPECT_EQ(b->dropped, 1U);
+  EXPECT_EQ(a->dropped, 0U);
+  EXPECT_EQ(buffer.getSize(), 60U);
+  EXPECT_EQ(buffer.getCount(), 1U);
+
+  // A message larger than the limit drops everything, itself included
+  EXPECT_EQ(buffer.push(*b, makeMessage("/b", 200, 5)), 2U);
+  EXPECT_EQ(buffer.getCount(), 0U);
+  EXPECT_EQ(buffer.push(*b, makeMessage("/b", 10, 6)), 0U);
+  EXPECT_EQ(buffer.getSize(), 10U);
+}
+
+TEST(Recorder, rejectsInvalidReceiveGroup)
+{
+  rosbag::RecorderOptions options;
+  options.topics.push_back("/chatter");
+  options.receive_groups.push_back("/camera/(image");
+
+  // Fails before contacting the master
+  rosbag::Recorder recorder(options);
+  EXPECT_EQ(recorder.run(), 1);
+}
+
+int main(int argc, char **argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
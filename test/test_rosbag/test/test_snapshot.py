@@ -123,6 +123,9 @@ class TestRosbagSnapshot(unittest.TestCase):
         res = self.trigger(req)
         self.assertTrue(res.success, msg="snapshot should have succeeded. message: {}".format(res.message))
         self.assertTrue(res.message == "")
+        self.assertGreater(res.messages, 0)
+        # The bag is written in the background and moved to its final name once complete
+        self._wait_for_write(os.path.dirname(filename))
         if prefix_mode:
             dircontents = os.listdir(d)
             self.assertEqual(len(dircontents), 1)
@@ -131,6 +134,32 @@ class TestRosbagSnapshot(unittest.TestCase):
         self.assertTrue(os.path.isfile(filename))
         return filename
 
+    def _wait_for_write(self, directory, timeout=10.0):
+        '''
+        Wait until a status message reports that no snapshot is being written
+        and no partially written bag is left in directory
+        '''
+        self.last_status = None
+        end = rospy.Time.now() + rospy.Duration(timeout)
+        while rospy.Time.now() < end:
+            active = [f for f in os.listdir(directory) if f.endswith('.active')]
+            if self.last_status is not None and not self.last_status.writing and not active:
+                return
+            rospy.sleep(0.1)
+        self.fail("snapshot was not written within {} seconds".format(timeout))
+
+    def _wait_for_result(self, filename, timeout=10.0):
+        '''
+        Wait until a status message reports the result of writing the snapshot to filename
+        '''
+        end = rospy.Time.now() + rospy.Duration(timeout)
+        while rospy.Time.now() < end:
+            status = self.last_status
+            if status is not None and not status.writing and status.last_filename == filename:
+                return status
+            rospy.sleep(0.1)
+        self.fail("snapshot was not written within {} seconds".format(timeout))
+
     def _assert_limits_enforced(self, test_topic, duration, memory):
         '''
         Asserts that the measured duration and memory for a topic comply with the launch parameters
@@ -235,6 +264,28 @@ class TestRosbagSnapshot(unittest.TestCase):
         # Resume recording for other tests
         self._resume()
 
+    def test_write_failure(self):
+        '''
+        Test that a snapshot failing while it is written in the background is reported in the status
+        '''
+        rospy.sleep(1.0)  # Give some time to fill buffers
+        # The bag can be written, but not moved to its final name, which is taken by a directory
+        d = tempfile.mkdtemp()
+        filename = os.path.join(d, 'snapshot.bag')
+        os.mkdir(filename)
+        open(os.path.join(filename, 'keep'), 'w').close()
+        res = self.trigger(filename=filename)
+        self.assertTrue(res.success, msg="snapshot should have started. message: {}".format(res.message))
+        status = self._wait_for_result(filename)
+        self.assertFalse(status.last_success)
+        self.assertIn('rename', status.last_error)
+
+        # A later snapshot that succeeds clears the error
+        filename = self._assert_write_success()
+        status = self._wait_for_result(filename)
+        self.assertTrue(status.last_success)
+        self.assertEqual(status.last_error, '')
+
     def test_invalid_topics(self):
         '''
         Test that an invalid topic or one not subscribed to fails
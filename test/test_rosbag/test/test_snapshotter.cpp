@@ -0,0 +1,333 @@
+/*********************************************************************
+* Software License Agreement (BSD License)
+*
+*  Copyright (c) 2018, Open Source Robotics Foundation, Inc.
+*  All rights reserved.
+*
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions
+*  are met:
+*
+*   * Redistributions of source code must retain the above copyright
+*     notice, this list of conditions and the following disclaimer.
+*   * Redistributions in binary form must reproduce the above
+*     copyright notice, this list of conditions and the following
+*     disclaimer in the documentation and/or other materials provided
+*     with the distribution.
+*   * Neither the name of Open Source Robotics Foundation, Inc. nor the
+*     names of its contributors may be used to endorse or promote products
+*     derived from this software without specific prior written permission.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+*  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+*  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+*  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+*  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+*  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+*  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+*  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+*  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+*  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+*  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+*  POSSIBILITY OF SUCH DAMAGE.
+********************************************************************/
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <set>
+#include "rosbag/snapshotter.h"
+
+#include <gtest/gtest.h>
+
+#include "helpers.h"
+
+using rosbag::MessageQueue;
+using rosbag::SnapshotMessage;
+using rosbag::Snapshotter;
+using rosbag::SnapshotterTopicOptions;
+
+typedef MessageQueue::range_t::first_type Iterator;
+
+// Message of size bytes, all equal to the low byte of seq, received at time seq
+SnapshotMessage makeMessage(uint32_t seq, uint32_t size)
+{
+  boost::shared_ptr<ros::M_string> header(boost::make_shared<ros::M_string>());
+  (*header)["type"] = "test_rosbag/Bytes";
+  (*header)["md5sum"] = "f43a8e1b362b75baa741461b46adc7e0";
+  (*header)["message_definition"] = "uint8[] data\n";
+  return SnapshotMessage(test_rosbag::makeShapeShifter(size, static_cast<uint8_t>(seq)), header, ros::Time(seq, 0));
+}
+
+// Check that the ring or spill file still holds the bytes of a message from makeMessage
+void expectContents(SnapshotMessage const& msg)
+{
+  std::vector<uint8_t> data(msg.size);
+  if (msg.file)
+    msg.file->read(msg.offset, &data[0], msg.size);
+  else
+  {
+    ASSERT_TRUE(bool(msg.buffer));
+    std::copy(msg.buffer.get() + msg.offset, msg.buffer.get() + msg.offset + msg.size, data.begin());
+  }
+  EXPECT_EQ(std::vector<uint8_t>(msg.size, static_cast<uint8_t>(msg.time.sec)), data) << "message " << msg.time.sec;
+}
+
+// Check the contents of all messages of a queue, and return their sequence numbers, oldest first
+std::vector<uint32_t> checkQueue(MessageQueue& queue, std::set<rosbag::SpillFile*>* files = NULL)
+{
+  std::vector<uint32_t> seqs;
+  MessageQueue::range_t spilled = queue.spilledRangeFromTimes(ros::Time(), ros::Time());
+  for (Iterator it = spilled.first; it != spilled.second; ++it)
+  {
+    EXPECT_TRUE(bool(it->file));
+    if (files)
+      files->insert(it->file.get());
+    expectContents(*it);
+    seqs.push_back(it->time.sec);
+  }
+  MessageQueue::range_t in_memory = queue.rangeFromTimes(ros::Time(), ros::Time());
+  for (Iterator it = in_memory.first; it != in_memory.second; ++it)
+  {
+    EXPECT_FALSE(bool(it->file));
+    expectContents(*it);
+    seqs.push_back(it->time.sec);
+  }
+  return seqs;
+}
+
+std::vector<uint32_t> sequence(uint32_t first, uint32_t last)
+{
+  std::vector<uint32_t> seqs;
+  for (uint32_t seq = first; seq <= last; ++seq)
+    seqs.push_back(seq);
+  return seqs;
+}
+
+class SpillTest : public testing::Test
+{
+protected:
+  virtual void SetUp()
+  {
+    char dir[] = "/tmp/test_snapshotter_XXXXXX";
+    ASSERT_TRUE(mkdtemp(dir) != NULL);
+    directory_ = dir;
+  }
+
+  virtual void TearDown()
+  {
+    // Spill files are unlinked as soon as they are created, so the directory is empty
+    EXPECT_EQ(rmdir(directory_.c_str()), 0);
+  }
+
+  std::string directory_;
+};
+
+TEST(MessageQueue, ringWrapsAround)
+{
+  MessageQueue queue(SnapshotterTopicOptions(SnapshotterTopicOptions::NO_DURATION_LIMIT, 100,
+                                             SnapshotterTopicOptions::NO_SPILL));
+  for (uint32_t seq = 1; seq <= 4; ++seq)
+    queue.push(makeMessage(seq, 30));
+  EXPECT_EQ(checkQueue(queue), sequence(2, 4));
+  // The fourth message did not fit at the end of the ring, so it took the space of the first one
+  MessageQueue::range_t range = queue.rangeFromTimes(ros::Time(), ros::Time());
+  EXPECT_EQ((range.second - 1)->offset, 0U);
+
+  // Free space between the newest and the oldest message is used
+  queue.push(makeMessage(5, 30));
+  EXPECT_EQ(checkQueue(queue), sequence(3, 5));
+
+  // A message which doesn't fit contiguously removes as many messages as needed, even below the memory limit
+  queue.push(makeMessage(6, 50));
+  EXPECT_EQ(checkQueue(queue), sequence(6, 6));
+
+  // Messages larger than the ring are dropped
+  queue.push(makeMessage(7, 101));
+  EXPECT_EQ(checkQueue(queue), sequence(6, 6));
+}
+
+// Ring in which the oldest message of a queue is stored
+boost::shared_array<uint8_t> oldestRing(MessageQueue& queue)
+{
+  return queue.rangeFromTimes(ros::Time(), ros::Time()).first->buffer;
+}
+
+TEST(MessageQueue, snapshotUsesSpareRing)
+{
+  MessageQueue queue(SnapshotterTopicOptions(SnapshotterTopicOptions::NO_DURATION_LIMIT, 100,
+                                             SnapshotterTopicOptions::NO_SPILL));
+  for (uint32_t seq = 1; seq <= 3; ++seq)
+    queue.push(makeMessage(seq, 30));
+  boost::shared_array<uint8_t> first = oldestRing(queue);
+
+  // Messages pushed while a snapshot is written go to another ring
+  boost::shared_ptr<MessageQueue> snapshot = queue.copy();
+  for (uint32_t seq = 4; seq <= 6; ++seq)
+    queue.push(makeMessage(seq, 30));
+  EXPECT_EQ(checkQueue(*snapshot), sequence(1, 3));
+  EXPECT_EQ(checkQueue(queue), sequence(4, 6));
+  EXPECT_NE(oldestRing(queue), first);
+
+  // Once the snapshot is written, the queue lets go of the ring it read
+  snapshot.reset();
+  queue.push(makeMessage(7, 30));
+  EXPECT_EQ(checkQueue(queue), sequence(5, 7));
+  EXPECT_EQ(first.use_count(), 1);
+}
+
+TEST(MessageQueue, dropsWhileBothRingsAreRead)
+{
+  MessageQueue queue(SnapshotterTopicOptions(SnapshotterTopicOptions::NO_DURATION_LIMIT, 100,
+                                             SnapshotterTopicOptions::NO_SPILL));
+  for (uint32_t seq = 1; seq <= 3; ++seq)
+    queue.push(makeMessage(seq, 30));
+  boost::shared_ptr<MessageQueue> first = queue.copy();
+  queue.push(makeMessage(4, 30));
+
+  // The second snapshot reads messages from both rings, so no third one is allocated for new messages
+  boost::shared_ptr<MessageQueue> second = queue.copy();
+  queue.push(makeMessage(5, 30));
+  EXPECT_EQ(checkQueue(queue), sequence(2, 4));
+  EXPECT_EQ(checkQueue(*first), sequence(1, 3));
+  EXPECT_EQ(checkQueue(*second), sequence(2, 4));
+
+  first.reset();
+  second.reset();
+  queue.push(makeMessage(6, 30));
+  std::vector<uint32_t> expected = sequence(3, 4);
+  expected.push_back(6);
+  EXPECT_EQ(checkQueue(queue), expected);
+}
+
+TEST_F(SpillTest, evictsToDisk)
+{
+  MessageQueue queue(SnapshotterTopicOptions(SnapshotterTopicOptions::NO_DURATION_LIMIT, 100, 200), directory_);
+  for (uint32_t seq = 1; seq <= 20; ++seq)
+    queue.push(makeMessage(seq, 25));
+
+  // Four messages are in memory and eight more on disk, the oldest ones are dropped
+  EXPECT_EQ(checkQueue(queue), sequence(9, 20));
+  EXPECT_EQ(queue.spilledRangeFromTimes(ros::Time(), ros::Time()).second -
+                queue.spilledRangeFromTimes(ros::Time(), ros::Time()).first,
+            8);
+  rosgraph_msgs::TopicStatistics status;
+  queue.fillStatus(status);
+  EXPECT_EQ(status.traffic, 300);
+  EXPECT_EQ(status.delivered_msgs, 12);
+  EXPECT_EQ(status.window_start, ros::Time(9, 0));
+  EXPECT_EQ(status.window_stop, ros::Time(20, 0));
+
+  // The duration limit applies to the messages on disk too
+  MessageQueue limited(SnapshotterTopicOptions(ros::Duration(5), 100, 200), directory_);
+  for (uint32_t seq = 1; seq <= 20; ++seq)
+    limited.push(makeMessage(seq, 25));
+  EXPECT_EQ(checkQueue(limited), sequence(15, 20));
+}
+
+TEST_F(SpillTest, snapshotWhileSpilling)
+{
+  MessageQueue queue(SnapshotterTopicOptions(SnapshotterTopicOptions::NO_DURATION_LIMIT, 100, 200), directory_);
+  std::set<rosbag::SpillFile*> files;
+  for (uint32_t seq = 1; seq <= 20; ++seq)
+    queue.push(makeMessage(seq, 25));
+
+  // Messages pushed while a snapshot is written don't overwrite the ones it reads, in memory or on disk
+  boost::shared_ptr<MessageQueue> snapshot = queue.copy();
+  for (uint32_t seq = 21; seq <= 60; ++seq)
+    queue.push(makeMessage(seq, 25));
+  EXPECT_EQ(checkQueue(*snapshot, &files), sequence(9, 20));
+  EXPECT_EQ(checkQueue(queue, &files), sequence(49, 60));
+
+  // While a second snapshot is written as well, both rings and both spill files are in use and new messages are
+  // dropped
+  boost::shared_ptr<MessageQueue> second = queue.copy();
+  for (uint32_t seq = 61; seq <= 100; ++seq)
+    queue.push(makeMessage(seq, 25));
+  EXPECT_EQ(checkQueue(*snapshot, &files), sequence(9, 20));
+  EXPECT_EQ(checkQueue(*second, &files), sequence(49, 60));
+  EXPECT_EQ(checkQueue(queue, &files), sequence(49, 60));
+
+  // Once the snapshots are written, spilling continues in the same two files
+  snapshot.reset();
+  second.reset();
+  for (uint32_t seq = 101; seq <= 140; ++seq)
+    queue.push(makeMessage(seq, 25));
+  EXPECT_EQ(checkQueue(queue, &files), sequence(129, 140));
+  EXPECT_EQ(files.size(), 2U);
+}
+
+TEST_F(SpillTest, spillsContinuously)
+{
+  MessageQueue queue(SnapshotterTopicOptions(SnapshotterTopicOptions::NO_DURATION_LIMIT, 100, 200), directory_);
+  for (uint32_t seq = 1; seq <= 20; ++seq)
+    queue.push(makeMessage(seq, 25));
+
+  // A snapshot makes spilling switch files, and is written before the messages left in the first file are removed
+  boost::shared_ptr<MessageQueue> snapshot = queue.copy();
+  for (uint32_t seq = 21; seq <= 24; ++seq)
+    queue.push(makeMessage(seq, 25));
+  snapshot.reset();
+
+  // Without a snapshot being written, no message is dropped before the spill file is full
+  for (uint32_t seq = 25; seq <= 100; ++seq)
+  {
+    queue.push(makeMessage(seq, 25));
+    std::vector<uint32_t> seqs = checkQueue(queue);
+    ASSERT_FALSE(seqs.empty());
+    EXPECT_EQ(seqs.back(), seq);
+    EXPECT_GE(seqs.size(), 12U) << "message " << seq;
+  }
+  EXPECT_EQ(checkQueue(queue), sequence(89, 100));
+}
+
+TEST_F(SpillTest, triggersTwiceInARow)
+{
+  boost::shared_ptr<MessageQueue> queue(boost::make_shared<MessageQueue>(
+      SnapshotterTopicOptions(SnapshotterTopicOptions::NO_DURATION_LIMIT, 100, 200), directory_));
+  std::string filename = directory_ + "/snapshot.bag";
+  rosbag_msgs::TriggerSnapshot::Request req;
+  boost::atomic<uint32_t> written_msgs(0);
+  std::set<rosbag::SpillFile*> files;
+  for (uint32_t seq = 1; seq <= 20; ++seq)
+    queue->push(makeMessage(seq, 25));
+  boost::shared_array<uint8_t> ring = oldestRing(*queue);
+
+  // First trigger, the messages received until it is written leave none in the first spill file
+  Snapshotter::buffers_t first;
+  first["/topic"] = queue->copy();
+  for (uint32_t seq = 21; seq <= 32; ++seq)
+    queue->push(makeMessage(seq, 25));
+  {
+    rosbag::Bag bag(filename, rosbag::bagmode::Write);
+    Snapshotter::writeBuffers(bag, first, req, written_msgs);
+  }
+  EXPECT_EQ(written_msgs, 12U);
+  EXPECT_FALSE(first["/topic"]);
+
+  // Second trigger before the first snapshot goes out of scope, the queue goes back to the ring and spill file the
+  // first one read instead of allocating a third ring or dropping messages
+  Snapshotter::buffers_t second;
+  second["/topic"] = queue->copy();
+  for (uint32_t seq = 33; seq <= 60; ++seq)
+    queue->push(makeMessage(seq, 25));
+  EXPECT_EQ(checkQueue(*second["/topic"], &files), sequence(21, 32));
+  EXPECT_EQ(checkQueue(*queue, &files), sequence(49, 60));
+  EXPECT_EQ(oldestRing(*queue), ring);
+  {
+    rosbag::Bag bag(filename, rosbag::bagmode::Write);
+    Snapshotter::writeBuffers(bag, second, req, written_msgs);
+  }
+  EXPECT_EQ(written_msgs, 24U);
+
+  for (uint32_t seq = 61; seq <= 100; ++seq)
+    queue->push(makeMessage(seq, 25));
+  EXPECT_EQ(checkQueue(*queue, &files), sequence(89, 100));
+  EXPECT_EQ(files.size(), 2U);
+  EXPECT_EQ(unlink(filename.c_str()), 0);
+}
+
+int main(int argc, char** argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -7,10 +7,12 @@
 #include "std_msgs/UInt64.h"
 #include "std_msgs/String.h"
 
+#include <map>
 #include <string>
 #include <vector>
 
 #include "boost/foreach.hpp"
+#include "boost/thread/thread.hpp"
 #include <gtest/gtest.h>
 
 template<typename T>
@@ -151,6 +153,158 @@ TEST(rosbag_storage, reuse_bag)
   serialize_bag(bag, bag_filename2);
 }
 
+TEST(rosbag_storage, write_raw)
+{
+  const char* filename = "/tmp/rosbag_storage_write_raw.bag";
+
+  std_msgs::Int32 msg = make_std_msg<std_msgs::Int32>(7);
+  std::vector<uint8_t> buffer(ros::serialization::serializationLength(msg));
+  ros::serialization::OStream stream(buffer.data(), buffer.size());
+  ros::serialization::serialize(stream, msg);
+
+  {
+    rosbag::Bag bag;
+    bag.open(filename, rosbag::bagmode::Write);
+    bag.writeRaw("raw", ros::Time(1), ros::message_traits::datatype(msg), ros::message_traits::md5sum(msg),
+                 ros::message_traits::definition(msg), buffer.data(), buffer.size());
+    bag.write("typed", ros::Time(2), msg);
+    bag.close();
+  }
+
+  rosbag::Bag bag;
+  bag.open(filename, rosbag::bagmode::Read);
+  rosbag::View view(bag);
+  ASSERT_EQ(2u, view.size());
+
+  rosbag::View::const_iterator it = view.begin();
+  EXPECT_EQ("raw", it->getTopic());
+  EXPECT_EQ(ros::message_traits::md5sum(msg), it->getMD5Sum());
+  EXPECT_EQ(7, it->instantiate<std_msgs::Int32>()->data);
+  ++it;
+  EXPECT_EQ("typed", it->getTopic());
+  EXPECT_EQ(7, it->instantiate<std_msgs::Int32>()->data);
+  bag.close();
+}
+
+void sum_messages(rosbag::Bag const* bag, std::string topic, int64_t* sum)
+{
+  rosbag::View view(*bag, rosbag::TopicQuery(topic));
+  BOOST_FOREACH(rosbag::MessageInstance const& m, view)
+    *sum += m.instantiate<std_msgs::Int32>()->data;
+}
+
+void create_numbers_bag(const std::string &filename, int count)
+{
+  rosbag::Bag bag;
+  bag.open(filename, rosbag::bagmode::Write);
+  bag.setChunkThreshold(1024);
+  for (int i = 0; i < count; ++i)
+  {
+    bag.write("even", ros::Time(1 + i), make_std_msg<std_msgs::Int32>(2 * i));
+    bag.write("odd", ros::Time(1 + i), make_std_msg<std_msgs::Int32>(2 * i + 1));
+  }
+  bag.close();
+}
+
+TEST(rosbag_storage, concurrent_read)
+{
+  const char* filename = "/tmp/rosbag_storage_concurrent_read.bag";
+  const int count = 1000;
+  create_numbers_bag(filename, count);
+
+  // Several threads read the same chunks at the same time, each from its own View
+  rosbag::Bag bag;
+  bag.open(filename, rosbag::bagmode::Read);
+  const int threads = 4;
+  int64_t sums[threads] = {};
+  boost::thread_group group;
+  for (int i = 0; i < threads; ++i)
+    group.create_thread(boost::bind(&sum_messages, &bag, i % 2 ? "odd" : "even", &sums[i]));
+  group.join_all();
+
+  for (int i = 0; i < threads; ++i)
+    EXPECT_EQ(i % 2 ? int64_t(count) * count : int64_t(count) * (count - 1), sums[i]);
+  bag.close();
+}
+
+void add_number(int64_t& sum, rosbag::MessageInstance const& m)
+{
+  sum += m.instantiate<std_msgs::Int32>()->data;
+}
+
+void add_sum(int64_t& sum, int64_t const& partial)
+{
+  sum += partial;
+}
+
+void check_order(boost::mutex* mutex, std::map<std::string, int32_t>* last, bool* ordered,
+                 uint32_t, rosbag::MessageInstance const& m)
+{
+  int32_t data = m.instantiate<std_msgs::Int32>()->data;
+  boost::mutex::scoped_lock lock(*mutex);
+  std::map<std::string, int32_t>::iterator i = last->find(m.getTopic());
+  if (i != last->end() && i->second >= data)
+    *ordered = false;
+  (*last)[m.getTopic()] = data;
+}
+
+TEST(rosbag_storage, parallel_map_reduce)
+{
+  const char* filename = "/tmp/rosbag_storage_parallel_map_reduce.bag";
+  const int count = 1000;
+  create_numbers_bag(filename, count);
+
+  rosbag::Bag bag;
+  bag.open(filename, rosbag::bagmode::Read);
+
+  // Overlapping queries must not count a message twice
+  rosbag::View view(true);
+  view.addQuery(bag);
+  view.addQuery(bag, rosbag::TopicQuery("odd"));
+  int64_t sum = view.parallelMapReduce<int64_t>(&add_number, &add_sum, 0, 4);
+  EXPECT_EQ(int64_t(2 * count) * (2 * count - 1) / 2, sum);
+
+  boost::mutex mutex;
+  std::map<std::string, int32_t> last;
+  bool ordered = true;
+  view.parallelForEach(boost::bind(&check_order, &mutex, &last, &ordered, _1, _2), 4, true);
+  EXPECT_TRUE(ordered);
+  EXPECT_EQ(2 * count - 1, last["odd"]);
+  bag.close();
+}
+
+TEST(rosbag_storage, summary)
+{
+  const char* filename = "/tmp/rosbag_storage_summary.bag";
+  const int count = 1000;
+  create_numbers_bag(filename, count);
+
+  for (int exact = 0; exact < 2; ++exact)
+  {
+    rosbag::BagSummary summary = rosbag::Bag::summarize(filename, exact);
+    EXPECT_EQ(exact != 0, summary.exact);
+    EXPECT_EQ(200u, summary.version);
+    EXPECT_EQ(uint64_t(2 * count), summary.message_count);
+    EXPECT_GT(summary.chunk_count, 1u);
+    EXPECT_EQ(ros::Time(1), summary.start_time);
+    EXPECT_EQ(ros::Time(count), summary.end_time);
+    ASSERT_EQ(2u, summary.connections.size());
+
+    uint64_t size = 0;
+    for (std::map<uint32_t, rosbag::ConnectionSummary>::const_iterator i = summary.connections.begin();
+         i != summary.connections.end(); ++i)
+    {
+      EXPECT_EQ(uint32_t(count), i->second.message_count);
+      EXPECT_EQ("std_msgs/Int32", i->second.datatype);
+      size += i->second.size;
+      if (exact)
+        EXPECT_NEAR(1.0, i->second.getFrequency(), 1e-9);
+    }
+    EXPECT_GT(size, uint64_t(2 * count * 4));
+    EXPECT_LT(size, summary.size);
+  }
+}
+
 int main(int argc, char **argv) {
     ros::Time::init();
     create_test_bag(bag_filename);
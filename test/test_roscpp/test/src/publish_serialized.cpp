@@ -0,0 +1,65 @@
+/*
+ * Copyright (c) 2018, Open Source Robotics Foundation, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of Open Source Robotics Foundation, Inc. nor the names of its
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+
+/*
+ * Publishes already serialized messages with Publisher::publishSerialized, for subscribe_serialized
+ */
+
+#include <ros/ros.h>
+#include <test_roscpp/TestArray.h>
+
+ros::Publisher g_pub;
+int32_t g_counter = 0;
+
+test_roscpp::TestArray makeArray(int32_t counter)
+{
+  test_roscpp::TestArray arr;
+  arr.counter = counter;
+  arr.float_arr.push_back(1.5);
+  arr.float_arr.push_back(2.5);
+  arr.float_arr.push_back(3.5);
+  return arr;
+}
+
+void pubTimer(const ros::TimerEvent&)
+{
+  g_pub.publishSerialized(ros::serialization::serializeMessage(makeArray(++g_counter)));
+}
+
+int main(int argc, char** argv)
+{
+  ros::init(argc, argv, "publish_serialized");
+  ros::NodeHandle nh;
+
+  ros::Publisher latched_pub = nh.advertise<test_roscpp::TestArray>("test_serialized_latched_inter", 0, true);
+  latched_pub.publishSerialized(ros::serialization::serializeMessage(makeArray(42)));
+
+  g_pub = nh.advertise<test_roscpp::TestArray>("test_serialized_inter", 0);
+  ros::Timer t = nh.createTimer(ros::Duration(0.01), pubTimer);
+  ros::spin();
+}
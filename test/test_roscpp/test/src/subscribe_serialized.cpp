@@ -0,0 +1,142 @@
+/*
+ * Copyright (c) 2018, Open Source Robotics Foundation, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of Open Source Robotics Foundation, Inc. nor the names of its
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+
+/*
+ * Subscribes to messages published with Publisher::publishSerialized, in this process and by publish_serialized
+ */
+
+#include <gtest/gtest.h>
+
+#include <ros/ros.h>
+#include <test_roscpp/TestArray.h>
+
+struct Helper
+{
+  Helper()
+  : count(0)
+  {
+  }
+
+  void cb(const ros::MessageEvent<test_roscpp::TestArray const>& event)
+  {
+    ++count;
+    last = event.getMessage();
+    latching = event.getConnectionHeader()["latching"];
+  }
+
+  uint32_t count;
+  test_roscpp::TestArrayConstPtr last;
+  std::string latching;
+};
+
+test_roscpp::TestArray makeArray(int32_t counter)
+{
+  test_roscpp::TestArray arr;
+  arr.counter = counter;
+  arr.float_arr.push_back(1.5);
+  arr.float_arr.push_back(2.5);
+  arr.float_arr.push_back(3.5);
+  return arr;
+}
+
+void expectArray(const test_roscpp::TestArray& arr)
+{
+  ASSERT_EQ(arr.float_arr.size(), 3U);
+  EXPECT_EQ(arr.float_arr[0], 1.5);
+  EXPECT_EQ(arr.float_arr[1], 2.5);
+  EXPECT_EQ(arr.float_arr[2], 3.5);
+}
+
+bool waitFor(const Helper& h, uint32_t count)
+{
+  ros::WallTime timeout = ros::WallTime::now() + ros::WallDuration(10.0);
+  while (h.count < count && ros::WallTime::now() < timeout)
+  {
+    ros::spinOnce();
+    ros::WallDuration(0.01).sleep();
+  }
+  return h.count >= count;
+}
+
+TEST(PublishSerialized, intraprocess)
+{
+  ros::NodeHandle nh;
+  Helper h;
+  ros::Subscriber sub = nh.subscribe("test_serialized_intra", 0, &Helper::cb, &h);
+  ros::Publisher pub = nh.advertise<test_roscpp::TestArray>("test_serialized_intra", 0);
+  EXPECT_EQ(pub.getNumSubscribers(), 1U);
+
+  pub.publishSerialized(ros::serialization::serializeMessage(makeArray(1)));
+  pub.publishSerialized(ros::serialization::serializeMessage(makeArray(2)));
+  ASSERT_TRUE(waitFor(h, 2));
+  EXPECT_EQ(h.last->counter, 2);
+  expectArray(*h.last);
+}
+
+TEST(PublishSerialized, latchedIntraprocess)
+{
+  ros::NodeHandle nh;
+  ros::Publisher pub = nh.advertise<test_roscpp::TestArray>("test_serialized_latched_intra", 0, true);
+  pub.publishSerialized(ros::serialization::serializeMessage(makeArray(3)));
+
+  Helper h;
+  ros::Subscriber sub = nh.subscribe("test_serialized_latched_intra", 0, &Helper::cb, &h);
+  ASSERT_TRUE(waitFor(h, 1));
+  EXPECT_EQ(h.last->counter, 3);
+  expectArray(*h.last);
+  EXPECT_EQ(h.latching, "1");
+}
+
+TEST(PublishSerialized, interprocess)
+{
+  ros::NodeHandle nh;
+  Helper h;
+  ros::Subscriber sub = nh.subscribe("test_serialized_inter", 0, &Helper::cb, &h);
+  ASSERT_TRUE(waitFor(h, 3));
+  EXPECT_GT(h.last->counter, 0);
+  expectArray(*h.last);
+}
+
+TEST(PublishSerialized, latchedInterprocess)
+{
+  ros::NodeHandle nh;
+  Helper h;
+  ros::Subscriber sub = nh.subscribe("test_serialized_latched_inter", 0, &Helper::cb, &h);
+  ASSERT_TRUE(waitFor(h, 1));
+  EXPECT_EQ(h.last->counter, 42);
+  expectArray(*h.last);
+  EXPECT_EQ(h.latching, "1");
+}
+
+int main(int argc, char** argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  ros::init(argc, argv, "subscribe_serialized");
+  ros::NodeHandle nh;
+  return RUN_ALL_TESTS();
+}
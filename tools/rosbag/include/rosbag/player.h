@@ -44,8 +44,15 @@
 #endif
 #include <time.h>
 
+#include <deque>
 #include <queue>
 #include <string>
+#include <utility>
+
+#include <boost/exception_ptr.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
 
 #include <ros/ros.h>
 #include <ros/time.h>
@@ -57,6 +64,7 @@
 
 #include "rosbag/time_translator.h"
 #include "rosbag/macros.h"
+#include "rosbag/view.h"
 
 namespace rosbag {
 
@@ -97,6 +105,10 @@ struct ROSBAG_DECL PlayerOptions
     std::string rate_control_topic;
     float    rate_control_max_delay;
     ros::Duration skip_empty;
+    bool     lanes;
+    int      read_ahead;
+    ros::WallDuration spin_wait;
+    bool     jitter_stats;
 
     std::vector<std::string> bags;
     std::vector<std::string> topics;
@@ -116,6 +128,9 @@ public:
     
     void setTimeScale(double time_scale);
 
+    /*! Busy-wait for the last part of every sleep instead of relying on the scheduler to wake up in time */
+    void setSpinWait(const ros::WallDuration& spin_wait);
+
     /*! Set the horizon that the clock will run to */
     void setHorizon(const ros::Time& horizon);
 
@@ -143,10 +158,14 @@ public:
     bool horizonReached();
 
 private:
+    //! Sleep until an absolute wall clock time, spinning for the last spin_wait_
+    void sleepUntil(const ros::WallTime& target);
+
     bool do_publish_;
     
     double publish_frequency_;
     double time_scale_;
+    ros::WallDuration spin_wait_;
     
     ros::NodeHandle node_handle_;
     ros::Publisher time_pub_;
@@ -161,6 +180,97 @@ private:
 };
 
 
+//! PRIVATE. A message to play back, possibly read ahead of time
+struct ROSBAG_DECL PlaybackMessage
+{
+    PlaybackMessage(MessageInstance const& _instance, topic_tools::ShapeShifter::ConstPtr _msg);
+
+    MessageInstance instance;
+    //! Contents of the message, or NULL if they are still to be read from the bag
+    topic_tools::ShapeShifter::ConstPtr msg;
+};
+
+
+//! PRIVATE. Reads the messages of a view on a separate thread, keeping up to capacity messages ready for playback
+class ROSBAG_DECL MessageReader
+{
+public:
+    MessageReader(View& view, size_t capacity);
+    ~MessageReader();
+
+    //! Get the next message, waiting for it to be read. Returns NULL after the last message.
+    //! Rethrows an exception the reader thread stopped on, once the messages read before it are taken.
+    boost::shared_ptr<PlaybackMessage> next();
+
+private:
+    void run();
+
+    View& view_;
+    size_t capacity_;
+
+    boost::mutex mutex_;
+    boost::condition_variable condition_;  //!< Notified when a message is read or taken from messages_
+    std::deque<boost::shared_ptr<PlaybackMessage> > messages_;
+    bool done_;                            //!< The reader has reached the end of the view
+    bool stop_;                            //!< The reader is asked to stop early
+    boost::exception_ptr error_;           //!< Exception the reader stopped on
+
+    boost::thread thread_;
+};
+
+
+//! PRIVATE. Statistics of how late messages are published compared to when they are due
+class ROSBAG_DECL JitterStats
+{
+public:
+    JitterStats();
+
+    //! Thread-safe, messages may be published by several lanes at once
+    void add(const ros::WallDuration& lateness);
+    void print() const;
+    void reset();
+
+private:
+    mutable boost::mutex mutex_;
+    uint64_t count_;
+    uint64_t within_100us_;
+    double   sum_;     //!< In seconds
+    double   sum_sq_;
+    double   max_;
+};
+
+
+//! PRIVATE. Publishes the messages of one publisher on its own thread, so that large messages don't hold up others
+class ROSBAG_DECL PublisherLane
+{
+public:
+    //! \param jitter_stats Where to record how late messages are published, or NULL
+    PublisherLane(ros::Publisher const& publisher, JitterStats* jitter_stats);
+    //! Publishes the messages still queued, then stops the thread
+    ~PublisherLane();
+
+    //! Queue msg for publishing. due is when it should be published, or zero if it's not to be recorded in jitter_stats
+    void publish(topic_tools::ShapeShifter::ConstPtr const& msg, ros::WallTime const& due);
+
+    //! Wait until all messages queued so far are published
+    void flush();
+
+private:
+    void run();
+
+    ros::Publisher publisher_;
+    JitterStats* jitter_stats_;
+
+    boost::mutex mutex_;
+    boost::condition_variable condition_;  //!< Notified when a message is queued or published
+    std::deque<std::pair<topic_tools::ShapeShifter::ConstPtr, ros::WallTime> > messages_;
+    bool publishing_;                      //!< A message taken from messages_ is being published
+    bool stop_;
+
+    boost::thread thread_;
+};
+
+
 //! PRIVATE.  Player class to abstract the interface to the player
 /*!
  *  This API is currently considered private, but will be released in the 
@@ -183,7 +293,11 @@ private:
 
     void advertise(const ConnectionInfo* c);
 
-    void doPublish(rosbag::MessageInstance const& m);
+    void doPublish(PlaybackMessage const& pm);
+
+    //! due is when the message should be published, to record how late it is, or zero
+    void publishMessage(std::string const& callerid_topic, ros::Publisher& pub, PlaybackMessage const& pm,
+                        ros::WallTime const& due = ros::WallTime());
 
     void doKeepAlive();
 
@@ -220,6 +334,8 @@ private:
 
     std::vector<boost::shared_ptr<Bag> >  bags_;
     PublisherMap publishers_;
+    JitterStats jitter_stats_;  //!< Declared before lanes_, which record into it until they are destroyed
+    std::map<std::string, boost::shared_ptr<PublisherLane> > lanes_;  //!< Used instead of publishers_ with options_.lanes
 
     // Terminal
     bool    terminal_modified_;
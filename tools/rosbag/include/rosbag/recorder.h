@@ -42,16 +42,22 @@
 #endif
 #include <time.h>
 
+#include <deque>
 #include <queue>
+#include <set>
 #include <string>
+#include <utility>
 #include <vector>
 #include <list>
 
+#include <boost/atomic.hpp>
 #include <boost/thread/condition.hpp>
 #include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
 #include <boost/regex.hpp>
 
 #include <ros/ros.h>
+#include <ros/callback_queue.h>
 #include <ros/time.h>
 
 #include <std_msgs/Empty.h>
@@ -85,6 +91,73 @@ public:
     ros::Time                    time;
 };
 
+/* Queue of messages received on a single topic and waiting to be written.
+ * Each subscription callback only adds to its own queue, so callbacks on
+ * different topics do not contend with each other; the writer thread drains
+ * all queues in batches.
+ */
+class ROSBAG_DECL TopicQueue
+{
+public:
+    TopicQueue(std::string const& _topic);
+
+    std::string                 topic;
+    boost::mutex                mutex;       //!< protects messages and size
+    std::deque<OutgoingMessage> messages;
+    uint64_t                    size;        //!< bytes currently queued
+    uint64_t                    max_size;    //!< high-water mark of size, in bytes
+    uint64_t                    received;    //!< total number of messages received
+    uint64_t                    dropped;     //!< number of messages dropped due to buffer overflow
+};
+
+/* The topic queues of a recorder, sharing one limit on the bytes queued.
+ * When the limit is exceeded, the oldest message queued on any topic is
+ * dropped, so that a topic filling the buffer with large messages cannot
+ * make a low-rate topic drop the messages it just received. The heads of
+ * the non-empty queues are kept ordered by time, so finding the oldest
+ * message does not visit every queue.
+ */
+class ROSBAG_DECL RecordBuffer
+{
+public:
+    //! \param max_size limit on the bytes queued, 0 for none
+    RecordBuffer(uint64_t max_size);
+
+    boost::shared_ptr<TopicQueue> addTopic(std::string const& topic);
+
+    //! Queue out on topic_queue, and return the number of messages dropped to stay within the limit
+    uint32_t push(TopicQueue& topic_queue, OutgoingMessage const& out);
+
+    //! Move all queued messages into batch, ordered by time of receipt
+    void drain(std::vector<OutgoingMessage>& batch);
+
+    std::vector<boost::shared_ptr<TopicQueue> > getTopicQueues() const;
+    uint64_t getSize() const;                     //!< bytes queued on all topics
+    uint64_t getCount() const;                    //!< messages queued on all topics
+
+private:
+    enum DropResult
+    {
+        Dropped,        //!< the oldest message was dropped
+        Drained,        //!< the writer took the oldest message first, nothing was dropped
+        Empty           //!< no messages are queued
+    };
+
+    typedef std::set<std::pair<ros::Time, TopicQueue*> > HeadSet;
+
+    DropResult dropOldest();
+    void addHead(TopicQueue& topic_queue);
+    void removeHead(TopicQueue& topic_queue);
+
+    uint64_t                                    max_size_;
+    mutable boost::mutex                        topic_queues_mutex_;   //!< mutex for topic_queues_
+    std::vector<boost::shared_ptr<TopicQueue> > topic_queues_;
+    boost::mutex                                heads_mutex_;          //!< mutex for heads_, locked after a topic queue's mutex
+    HeadSet                                     heads_;                //!< time and queue of the first message of each non-empty queue
+    boost::atomic<uint64_t>                     size_;
+    boost::atomic<uint64_t>                     count_;
+};
+
 struct ROSBAG_DECL RecorderOptions
 {
     RecorderOptions();
@@ -109,10 +182,14 @@ struct ROSBAG_DECL RecorderOptions
     uint64_t        max_size;
     uint32_t        max_splits;
     ros::Duration   max_duration;
+    bool            preallocate;        //!< reserve disk space for each bag file up front, e.g. the maximum size of a split
     std::string     node;
     unsigned long long min_space;
     std::string min_space_str;
     ros::TransportHints transport_hints;
+    uint32_t        receive_threads;    //!< number of threads serving the global callback queue, which receives the topics in no receive group
+    std::vector<std::string> receive_groups; //!< topic patterns; the topics matching each one get their own callback queue and thread
+    ros::Duration   master_check_period; //!< period between polls of the master for new topics
 
     std::vector<std::string> topics;
 };
@@ -136,6 +213,8 @@ private:
     void updateFilenames();
     void startWriting();
     void stopWriting();
+    void rollover();
+    static void closeBag(boost::shared_ptr<Bag> bag, std::string const& write_filename, std::string const& target_filename);
 
     bool checkLogging();
     bool scheduledCheckDisk();
@@ -143,7 +222,8 @@ private:
 
     void snapshotTrigger(std_msgs::Empty::ConstPtr trigger);
     //    void doQueue(topic_tools::ShapeShifter::ConstPtr msg, std::string const& topic, boost::shared_ptr<ros::Subscriber> subscriber, boost::shared_ptr<int> count);
-    void doQueue(const ros::MessageEvent<topic_tools::ShapeShifter const>& msg_event, std::string const& topic, boost::shared_ptr<ros::Subscriber> subscriber, boost::shared_ptr<int> count);
+    void doQueue(const ros::MessageEvent<topic_tools::ShapeShifter const>& msg_event, std::string const& topic, boost::shared_ptr<ros::Subscriber> subscriber, boost::shared_ptr<int> count, boost::shared_ptr<TopicQueue> topic_queue);
+    void printQueueStats(bool final);
     void doRecord();
     void checkNumSplits();
     bool checkSize();
@@ -166,17 +246,19 @@ private:
     std::list<std::string>        current_files_;
 
     std::set<std::string>         currently_recording_;  //!< set of currenly recording topics
+    std::set<std::string>         checked_topics_;       //!< set of topics advertised on the master that have already been checked for subscription
+    std::vector<boost::regex>     topic_regexes_;        //!< compiled topic patterns, when recording by regex
     int                           num_subscribers_;      //!< used for book-keeping of our number of subscribers
 
     int                           exit_code_;            //!< eventual exit code
 
     boost::condition_variable_any queue_condition_;      //!< conditional variable for queue
-    boost::mutex                  queue_mutex_;          //!< mutex for queue
-    std::queue<OutgoingMessage>*  queue_;                //!< queue for storing
-    uint64_t                      queue_size_;           //!< queue size
-    uint64_t                      max_queue_size_;       //!< max queue size
+    boost::mutex                  queue_mutex_;          //!< mutex for queue_condition_ and queue_queue_
+    RecordBuffer                  buffer_;               //!< per-topic queues of messages waiting to be written
 
     uint64_t                      split_count_;          //!< split count
+    uint64_t                      last_split_size_;      //!< size of the previous split file, to preallocate the next one
+    boost::thread                 closing_thread_;       //!< closes the previous split file while recording continues
 
     std::queue<OutgoingQueue>     queue_queue_;          //!< queue of queues to be used by the snapshot recorders
 
@@ -188,8 +270,13 @@ private:
     boost::mutex                  check_disk_mutex_;
     ros::WallTime                 check_disk_next_;
     ros::WallTime                 warn_next_;
+    ros::WallTime                 stats_next_;
 
     ros::Publisher                pub_begin_write;
+
+    std::vector<boost::regex>     receive_group_regexes_; //!< compiled receive group patterns
+    std::vector<boost::shared_ptr<ros::CallbackQueue> > callback_queues_;  //!< one receive queue per receive group
+    std::vector<boost::shared_ptr<ros::AsyncSpinner> >  receive_spinners_; //!< one single-threaded spinner per receive queue
 };
 
 } // namespace rosbag
@@ -37,7 +37,10 @@
 #include <deque>
 #include <map>
 #include <string>
+#include <vector>
 #include <boost/atomic.hpp>
+#include <boost/shared_array.hpp>
+#include <boost/thread/thread.hpp>
 #include <boost/thread/mutex.hpp>
 #include <ros/ros.h>
 #include <ros/time.h>
@@ -67,14 +70,22 @@ struct ROSBAG_DECL SnapshotterTopicOptions
   static const ros::Duration INHERIT_DURATION_LIMIT;
   // When the value of memory_limit_, inherit the limit from the node's configured default
   static const int32_t INHERIT_MEMORY_LIMIT;
+  // When the value of spill_limit_, never move messages to disk
+  static const int64_t NO_SPILL;
+  // When the value of spill_limit_, inherit the limit from the node's configured default
+  static const int64_t INHERIT_SPILL_LIMIT;
 
   // Maximum difference in time from newest and oldest message in buffer before older messages are removed
   ros::Duration duration_limit_;
   // Maximum memory usage of the buffer before older messages ar eremoved
+  // While a snapshot is written, a second ring of this size is allocated to store new messages in.
   int32_t memory_limit_;
+  // Disk space, in bytes, to which messages removed to respect memory_limit_ are moved instead of being dropped.
+  // Twice this space is allocated, so that spilling continues in a second file while a snapshot reads the first.
+  int64_t spill_limit_;
 
   SnapshotterTopicOptions(ros::Duration duration_limit = INHERIT_DURATION_LIMIT,
-                         int32_t memory_limit = INHERIT_MEMORY_LIMIT);
+                         int32_t memory_limit = INHERIT_MEMORY_LIMIT, int64_t spill_limit = INHERIT_SPILL_LIMIT);
 };
 
 /* Configuration for the Snapshotter node. Contains default limits for memory and duration
@@ -88,6 +99,10 @@ struct ROSBAG_DECL SnapshotterOptions
   int32_t default_memory_limit_;
   // Period between publishing topic status messages. If <= ros::Duration(0), don't publish status
   ros::Duration status_period_;
+  // Spill limit to use for a topic's buffer if one is not specified
+  int64_t default_spill_limit_;
+  // Directory in which spill files are created. If empty, messages are never moved to disk
+  std::string spill_directory_;
   typedef std::map<std::string, SnapshotterTopicOptions> topics_t;
   // Provides list of topics to snapshot and their limit configurations
   topics_t topics_;
@@ -97,7 +112,25 @@ struct ROSBAG_DECL SnapshotterOptions
 
   // Add a new topic to the configuration
   void addTopic(std::string const& topic, ros::Duration duration_limit = SnapshotterTopicOptions::INHERIT_DURATION_LIMIT,
-                int32_t memory_limit = SnapshotterTopicOptions::INHERIT_MEMORY_LIMIT);
+                int32_t memory_limit = SnapshotterTopicOptions::INHERIT_MEMORY_LIMIT,
+                int64_t spill_limit = SnapshotterTopicOptions::INHERIT_SPILL_LIMIT);
+};
+
+/* File of fixed size used by MessageQueue as a ring of serialized messages moved out of memory. The space is
+ * allocated when the file is created, and the file is unlinked right away so nothing is left behind on exit.
+ */
+class ROSBAG_DECL SpillFile
+{
+public:
+  SpillFile(std::string const& directory, uint64_t capacity);
+  ~SpillFile();
+  uint64_t capacity() const;
+  void write(uint64_t offset, uint8_t const* data, uint32_t size);
+  void read(uint64_t offset, uint8_t* data, uint32_t size) const;
+
+private:
+  int fd_;
+  uint64_t capacity_;
 };
 
 /* Stores a buffered message of an ambiguous type and it's associated metadata (time of arrival, connection data),
@@ -107,10 +140,18 @@ struct ROSBAG_DECL SnapshotMessage
 {
   SnapshotMessage(topic_tools::ShapeShifter::ConstPtr _msg, boost::shared_ptr<ros::M_string> _connection_header,
                   ros::Time _time);
+  // The message, or NULL if its serialized bytes are stored in buffer
   topic_tools::ShapeShifter::ConstPtr msg;
   boost::shared_ptr<ros::M_string> connection_header;
   // ROS time when messaged arrived (does not use header stamp)
   ros::Time time;
+  // Serialized size of the message, in bytes
+  uint32_t size;
+  // Ring buffer of the owning queue holding the serialized message at offset, if msg is NULL
+  boost::shared_array<uint8_t> buffer;
+  // Spill file holding the serialized message at offset, if it has been moved out of buffer
+  boost::shared_ptr<SpillFile> file;
+  uint64_t offset;
 };
 
 /* Stores a queue of buffered messages for a single topic ensuring
@@ -130,11 +171,47 @@ private:
   int64_t size_;
   typedef std::deque<SnapshotMessage> queue_t;
   queue_t queue_;
+  // Preallocated storage of memory_limit_ bytes into which messages are serialized when a memory limit is set.
+  // Messages are stored contiguously in arrival order, wrapping around to the start when the end is reached.
+  boost::shared_array<uint8_t> ring_;
+  // Offset in ring_ at which the next message will be stored
+  uint32_t ring_tail_;
+  // Total size of the messages stored in ring_, in bytes
+  uint32_t ring_size_;
+  // Number of messages at the front of queue_ which are stored in a previous ring
+  size_t old_ring_msgs_;
+  // Ring allocated by copy() which replaces ring_ while a snapshot being written still reads from it. Released again
+  // once no snapshot reads it.
+  boost::shared_array<uint8_t> spare_ring_;
+  // Each copy of this queue holds a reference to the reader count of the storage its messages are in, until it is
+  // destroyed. Storage whose reader count is referenced more than once must not be overwritten.
+  typedef boost::shared_ptr<int> readers_t;
+  readers_t ring_readers_;
+  readers_t spare_ring_readers_;
+  // Reader counts held by this queue, if it is a copy
+  std::vector<readers_t> reading_;
+  // Messages older than those in queue_ which have been moved to disk, oldest first
+  queue_t spilled_;
+  // Total size of spilled_, in bytes
+  int64_t spilled_size_;
+  // Directory in which spill_ is created
+  std::string spill_directory_;
+  // Current spill file, used like ring_ with the same bookkeeping. NULL if messages are not spilled
+  boost::shared_ptr<SpillFile> spill_;
+  // Spill file allocated up front which replaces spill_ while a snapshot being written still reads from it
+  boost::shared_ptr<SpillFile> spare_spill_;
+  uint64_t spill_tail_;
+  uint64_t spill_size_;
+  size_t old_spill_msgs_;
+  readers_t spill_readers_;
+  readers_t spare_spill_readers_;
+  // Scratch space for reading spilled messages back when writing
+  mutable std::vector<uint8_t> read_buffer_;
   // Subscriber to the callback which uses this queue
   boost::shared_ptr<ros::Subscriber> sub_;
 
 public:
-  MessageQueue(SnapshotterTopicOptions const& options);
+  MessageQueue(SnapshotterTopicOptions const& options, std::string const& spill_directory = std::string());
   // Add a new message to the internal queue if possible, truncating the front of the queue as needed to enforce limits
   void push(SnapshotMessage const& msg);
   // Removes the message at the front of the queue (oldest) and returns it
@@ -150,17 +227,34 @@ public:
   typedef std::pair<queue_t::const_iterator, queue_t::const_iterator> range_t;
   // Get a begin and end iterator into the buffer respecting the start and end timestamp constraints
   range_t rangeFromTimes(ros::Time const& start, ros::Time const& end);
+  // Like rangeFromTimes, for the messages moved to disk. These are all older than the ones in memory
+  range_t spilledRangeFromTimes(ros::Time const& start, ros::Time const& end);
+  // Write a message from this queue to a bag file, CALLER MUST OBTAIN LOCK
+  void write(rosbag::Bag& bag, std::string const& topic, SnapshotMessage const& msg) const;
+  // Return a new queue sharing the currently buffered messages. Later pushes to this queue don't affect the copy.
+  boost::shared_ptr<MessageQueue> copy();
 
 private:
   // Internal push whitch does not obtain lock
   void _push(SnapshotMessage const& msg);
   // Internal pop which does not obtain lock
   SnapshotMessage _pop();
+  // Remove the oldest message, whether it is on disk or in memory
+  void _popOldest();
+  // Remove the oldest messages from memory, moving them to the spill file if there is one
+  void _evict();
+  // Move a segment of messages from the front of queue_ to the spill file
+  void _spill();
   // Internal clear which does not obtain lock
   void _clear();
   // Truncate front of queue as needed to fit a new message of specified size and time. Returns False if this is
   // impossible.
   bool preparePush(int32_t size, ros::Time const& time);
+  // Continue in spare_ring_ if a snapshot still reads ring_. Returns false if both rings are read by snapshots.
+  bool switchRing();
+  // Reserve size contiguous bytes in ring_, removing messages from the front of the queue as needed. Returns the
+  // offset of the reserved space.
+  uint32_t allocate(uint32_t size);
 };
 
 /* Snapshotter node. Maintains a circular buffer of the most recent messages from configured topics
@@ -175,18 +269,32 @@ public:
   // Sets up callbacks and spins until node is killed
   int run();
 
+  typedef std::map<std::string, boost::shared_ptr<MessageQueue> > buffers_t;
+  // Write the parts of the copied buffers in snapshot within the time constraints of req to the bag. Each copy is
+  // released as soon as it is written, so that its queue can reuse the storage for new messages.
+  static void writeBuffers(rosbag::Bag& bag, buffers_t& snapshot, rosbag_msgs::TriggerSnapshot::Request const& req,
+                           boost::atomic<uint32_t>& written_msgs);
+
 private:
   // Subscribe queue size for each topic
   static const int QUEUE_SIZE;
   SnapshotterOptions options_;
-  typedef std::map<std::string, boost::shared_ptr<MessageQueue> > buffers_t;
   buffers_t buffers_;
-  // Locks recording_ and writing_ states.
+  // Locks recording_, writing_ and last result states.
   boost::upgrade_mutex state_lock_;
   // True if new messages are being written to the internal buffer
   bool recording_;
   // True if currently writing buffers to a bag file
   bool writing_;
+  // Result of the last snapshot written in the background
+  std::string last_filename_;
+  bool last_success_;
+  std::string last_error_;
+  // Thread writing the last triggered snapshot
+  boost::thread write_thread_;
+  // Progress of the snapshot being written
+  boost::atomic<uint32_t> written_msgs_;
+  boost::atomic<uint32_t> total_msgs_;
   ros::NodeHandle nh_;
   ros::ServiceServer trigger_snapshot_server_;
   ros::ServiceServer enable_server_;
@@ -216,10 +324,13 @@ private:
   void resume();
   // Publish status containing statistics of currently buffered topics and other state
   void publishStatus(ros::TimerEvent const& e);
-  // Write the parts of message_queue within the time constraints of req to the queue
-  // If returns false, there was an error opening/writing the bag and an error message was written to res.message
-  bool writeTopic(rosbag::Bag& bag, MessageQueue& message_queue, std::string const& topic,
-                  rosbag_msgs::TriggerSnapshot::Request& req, rosbag_msgs::TriggerSnapshot::Response& res);
+  // Write the parts of message_queue within the time constraints of req to the bag
+  static void writeTopic(rosbag::Bag& bag, MessageQueue& message_queue, std::string const& topic,
+                         rosbag_msgs::TriggerSnapshot::Request const& req, boost::atomic<uint32_t>& written_msgs);
+  // Body of write_thread_, writes copies of the buffers to the already open bag and moves it to its final name. The
+  // thread holds the only reference to snapshot, which is cleared once written so that the copies don't outlive it.
+  void writeSnapshot(boost::shared_ptr<rosbag::Bag> bag, boost::shared_ptr<buffers_t> snapshot,
+                     rosbag_msgs::TriggerSnapshot::Request req, std::string write_filename);
 };
 
 // Configuration for SnapshotterClient
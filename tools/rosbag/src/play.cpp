@@ -65,6 +65,10 @@ rosbag::PlayerOptions parseOptions(int argc, char** argv) {
       ("wait-for-subscribers", "wait for at least one subscriber on each topic before publishing")
       ("rate-control-topic", po::value<std::string>(), "watch the given topic, and if the last publish was more than <rate-control-max-delay> ago, wait until the topic publishes again to continue playback")
       ("rate-control-max-delay", po::value<float>()->default_value(1.0f), "maximum time difference from <rate-control-topic> before pausing")
+      ("lanes", "read messages ahead on a separate thread and publish each topic from its own thread")
+      ("read-ahead", po::value<int>()->default_value(100), "number of messages to read ahead with --lanes")
+      ("spin-wait", po::value<float>()->default_value(0.0f), "busy-wait the last USEC microseconds before each message is due, for more precise timing at the cost of CPU")
+      ("jitter-stats", "print statistics of how late messages were published after playback")
       ;
 
     po::positional_options_description p;
@@ -124,6 +128,14 @@ rosbag::PlayerOptions parseOptions(int argc, char** argv) {
       opts.keep_alive = true;
     if (vm.count("wait-for-subscribers"))
       opts.wait_for_subscribers = true;
+    if (vm.count("lanes"))
+      opts.lanes = true;
+    if (vm.count("read-ahead"))
+      opts.read_ahead = vm["read-ahead"].as<int>();
+    if (vm.count("spin-wait"))
+      opts.spin_wait = ros::WallDuration(vm["spin-wait"].as<float>() * 1e-6);
+    if (vm.count("jitter-stats"))
+      opts.jitter_stats = true;
 
     if (vm.count("topics"))
     {
@@ -184,7 +196,7 @@ int main(int argc, char** argv) {
     try {
       player.publish();
     }
-    catch (std::runtime_error& e) {
+    catch (std::exception& e) {
       ROS_FATAL("%s", e.what());
       return 1;
     }
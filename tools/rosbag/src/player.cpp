@@ -40,6 +40,9 @@
   #include <sys/select.h>
 #endif
 
+#include <errno.h>
+#include <math.h>
+
 #include <boost/format.hpp>
 
 #include "rosgraph_msgs/Clock.h"
@@ -94,7 +97,11 @@ PlayerOptions::PlayerOptions() :
     wait_for_subscribers(false),
     rate_control_topic(""),
     rate_control_max_delay(1.0f),
-    skip_empty(ros::DURATION_MAX)
+    skip_empty(ros::DURATION_MAX),
+    lanes(false),
+    read_ahead(100),
+    spin_wait(0),
+    jitter_stats(false)
 {
 }
 
@@ -103,6 +110,180 @@ void PlayerOptions::check() {
         throw Exception("You must specify at least one bag file to play from");
     if (has_duration && duration <= 0.0)
         throw Exception("Invalid duration, must be > 0.0");
+    if (lanes && read_ahead <= 0)
+        throw Exception("Invalid read ahead, must be > 0");
+    if (spin_wait < ros::WallDuration(0))
+        throw Exception("Invalid spin wait, must be >= 0");
+}
+
+// JitterStats
+
+JitterStats::JitterStats() {
+    reset();
+}
+
+void JitterStats::reset() {
+    boost::mutex::scoped_lock lock(mutex_);
+    count_ = 0;
+    within_100us_ = 0;
+    sum_ = 0.0;
+    sum_sq_ = 0.0;
+    max_ = 0.0;
+}
+
+void JitterStats::add(const ros::WallDuration& lateness) {
+    double d = lateness.toSec();
+    boost::mutex::scoped_lock lock(mutex_);
+    count_++;
+    if (d <= 100e-6)
+        within_100us_++;
+    sum_ += d;
+    sum_sq_ += d * d;
+    if (count_ == 1 || d > max_)
+        max_ = d;
+}
+
+void JitterStats::print() const {
+    boost::mutex::scoped_lock lock(mutex_);
+    if (count_ == 0)
+        return;
+
+    double mean = sum_ / count_;
+    double stddev = sqrt(std::max(sum_sq_ / count_ - mean * mean, 0.0));
+    printf("Publish lateness over %llu messages: mean %.1f us, stddev %.1f us, max %.1f us, %.2f%% within 100 us\n",
+           (unsigned long long) count_, mean * 1e6, stddev * 1e6, max_ * 1e6, 100.0 * within_100us_ / count_);
+}
+
+// PlaybackMessage
+
+PlaybackMessage::PlaybackMessage(MessageInstance const& _instance, topic_tools::ShapeShifter::ConstPtr _msg) :
+    instance(_instance),
+    msg(_msg)
+{
+}
+
+// MessageReader
+
+MessageReader::MessageReader(View& view, size_t capacity) :
+    view_(view),
+    capacity_(capacity),
+    done_(false),
+    stop_(false)
+{
+    thread_ = boost::thread(boost::bind(&MessageReader::run, this));
+}
+
+MessageReader::~MessageReader() {
+    {
+        boost::mutex::scoped_lock lock(mutex_);
+        stop_ = true;
+    }
+    condition_.notify_all();
+    thread_.join();
+}
+
+shared_ptr<PlaybackMessage> MessageReader::next() {
+    boost::mutex::scoped_lock lock(mutex_);
+    while (messages_.empty() && !done_)
+        condition_.wait(lock);
+
+    if (messages_.empty()) {
+        if (error_)
+            boost::rethrow_exception(error_);
+        return shared_ptr<PlaybackMessage>();
+    }
+
+    shared_ptr<PlaybackMessage> pm = messages_.front();
+    messages_.pop_front();
+    condition_.notify_all();
+    return pm;
+}
+
+void MessageReader::run() {
+    try
+    {
+        for (const MessageInstance& m : view_) {
+            // Read the message outside of the lock, so playback can take the ones already read meanwhile
+            topic_tools::ShapeShifter::ConstPtr msg = m.instantiate<topic_tools::ShapeShifter>();
+            shared_ptr<PlaybackMessage> pm(boost::make_shared<PlaybackMessage>(m, msg));
+
+            boost::mutex::scoped_lock lock(mutex_);
+            while (messages_.size() >= capacity_ && !stop_)
+                condition_.wait(lock);
+            if (stop_)
+                break;
+            messages_.push_back(pm);
+            condition_.notify_all();
+        }
+    }
+    catch (...)
+    {
+        // Let playback fail on the main thread rather than terminate the process here
+        boost::mutex::scoped_lock lock(mutex_);
+        error_ = boost::current_exception();
+    }
+
+    boost::mutex::scoped_lock lock(mutex_);
+    done_ = true;
+    condition_.notify_all();
+}
+
+// PublisherLane
+
+PublisherLane::PublisherLane(ros::Publisher const& publisher, JitterStats* jitter_stats) :
+    publisher_(publisher),
+    jitter_stats_(jitter_stats),
+    publishing_(false),
+    stop_(false)
+{
+    thread_ = boost::thread(boost::bind(&PublisherLane::run, this));
+}
+
+PublisherLane::~PublisherLane() {
+    {
+        boost::mutex::scoped_lock lock(mutex_);
+        stop_ = true;
+    }
+    condition_.notify_all();
+    thread_.join();
+}
+
+void PublisherLane::publish(topic_tools::ShapeShifter::ConstPtr const& msg, ros::WallTime const& due) {
+    {
+        boost::mutex::scoped_lock lock(mutex_);
+        messages_.push_back(std::make_pair(msg, due));
+    }
+    condition_.notify_all();
+}
+
+void PublisherLane::flush() {
+    boost::mutex::scoped_lock lock(mutex_);
+    while (!messages_.empty() || publishing_)
+        condition_.wait(lock);
+}
+
+void PublisherLane::run() {
+    boost::mutex::scoped_lock lock(mutex_);
+    while (true) {
+        while (messages_.empty() && !stop_)
+            condition_.wait(lock);
+        if (messages_.empty())
+            break;
+
+        std::pair<topic_tools::ShapeShifter::ConstPtr, ros::WallTime> next = messages_.front();
+        messages_.pop_front();
+        publishing_ = true;
+
+        lock.unlock();
+        publisher_.publish(*next.first);
+        // Measured here rather than when queued, so the time spent waiting in the lane counts
+        if (jitter_stats_ && !next.second.isZero())
+            jitter_stats_->add(ros::WallTime::now() - next.second);
+        lock.lock();
+
+        publishing_ = false;
+        condition_.notify_all();
+    }
 }
 
 // Player
@@ -122,6 +303,8 @@ Player::Player(PlayerOptions const& options) :
 }
 
 Player::~Player() {
+    lanes_.clear();
+
     for (shared_ptr<Bag>& bag : bags_)
         bag->close();
 
@@ -306,6 +489,7 @@ void Player::publish() {
 
 
         time_publisher_.setTimeScale(options_.time_scale);
+        time_publisher_.setSpinWait(options_.spin_wait);
         if (options_.bag_time)
             time_publisher_.setPublishFrequency(options_.bag_time_frequency);
         else
@@ -314,17 +498,37 @@ void Player::publish() {
         paused_time_ = now_wt;
 
         // Call do-publish for each message
-        for (const MessageInstance& m : view) {
-            if (!node_handle_.ok())
-                break;
+        if (options_.lanes) {
+            MessageReader reader(view, options_.read_ahead);
+            while (node_handle_.ok()) {
+                shared_ptr<PlaybackMessage> pm = reader.next();
+                if (!pm)
+                    break;
+
+                doPublish(*pm);
+            }
+        } else {
+            for (const MessageInstance& m : view) {
+                if (!node_handle_.ok())
+                    break;
 
-            doPublish(m);
+                doPublish(PlaybackMessage(m, topic_tools::ShapeShifter::ConstPtr()));
+            }
         }
 
         if (options_.keep_alive)
             while (node_handle_.ok())
                 doKeepAlive();
 
+        if (options_.jitter_stats) {
+            // The lanes record a message once they have published it
+            for (map<string, shared_ptr<PublisherLane> >::iterator i = lanes_.begin(); i != lanes_.end(); ++i)
+                i->second->flush();
+            std::cout << std::endl;
+            jitter_stats_.print();
+            jitter_stats_.reset();
+        }
+
         if (!node_handle_.ok()) {
             std::cout << std::endl;
             break;
@@ -335,6 +539,9 @@ void Player::publish() {
         }
     }
 
+    // Let the lanes publish what they still have queued
+    lanes_.clear();
+
     ros::shutdown();
 }
 
@@ -468,12 +675,27 @@ void Player::advertise(const ConnectionInfo* c)
 
         ros::Publisher pub = node_handle_.advertise(opts);
         publishers_.insert(publishers_.begin(), pair<string, ros::Publisher>(callerid_topic, pub));
+        if (options_.lanes)
+            lanes_[callerid_topic] = boost::make_shared<PublisherLane>(pub, options_.jitter_stats ? &jitter_stats_ : NULL);
 
         pub_iter = publishers_.find(callerid_topic);
     }
 }
 
-void Player::doPublish(MessageInstance const& m) {
+void Player::publishMessage(string const& callerid_topic, ros::Publisher& pub, PlaybackMessage const& pm,
+                            ros::WallTime const& due) {
+    if (pm.msg) {
+        lanes_[callerid_topic]->publish(pm.msg, due);
+        return;
+    }
+
+    if (options_.jitter_stats && !due.isZero())
+        jitter_stats_.add(ros::WallTime::now() - due);
+    pub.publish(pm.instance);
+}
+
+void Player::doPublish(PlaybackMessage const& pm) {
+    MessageInstance const& m = pm.instance;
     string const& topic   = m.getTopic();
     ros::Time const& time = m.getTime();
     string callerid       = m.getCallerId();
@@ -495,7 +717,7 @@ void Player::doPublish(MessageInstance const& m) {
     // If immediate specified, play immediately
     if (options_.at_once) {
         time_publisher_.stepClock();
-        pub_iter->second.publish(m);
+        publishMessage(callerid_topic, pub_iter->second, pm);
         printTime();
         return;
     }
@@ -509,7 +731,7 @@ void Player::doPublish(MessageInstance const& m) {
       time_translator_.shift(ros::Duration(shift.sec, shift.nsec));
       horizon += shift;
       time_publisher_.setWCHorizon(horizon);
-      (pub_iter->second).publish(m);
+      publishMessage(callerid_topic, pub_iter->second, pm);
       printTime();
       return;
     }
@@ -566,7 +788,7 @@ void Player::doPublish(MessageInstance const& m) {
                     horizon += shift;
                     time_publisher_.setWCHorizon(horizon);
             
-                    (pub_iter->second).publish(m);
+                    publishMessage(callerid_topic, pub_iter->second, pm);
 
                     printTime();
                     return;
@@ -610,7 +832,7 @@ void Player::doPublish(MessageInstance const& m) {
         ros::spinOnce();
     }
 
-    pub_iter->second.publish(m);
+    publishMessage(callerid_topic, pub_iter->second, pm, horizon);
 }
 
 
@@ -767,7 +989,7 @@ int Player::readCharFromStdin() {
 #endif
 }
 
-TimePublisher::TimePublisher() : time_scale_(1.0)
+TimePublisher::TimePublisher() : time_scale_(1.0), spin_wait_(0)
 {
   setPublishFrequency(-1.0);
   time_pub_ = node_handle_.advertise<rosgraph_msgs::Clock>("clock",1);
@@ -787,6 +1009,31 @@ void TimePublisher::setTimeScale(double time_scale)
     time_scale_ = time_scale;
 }
 
+void TimePublisher::setSpinWait(const ros::WallDuration& spin_wait)
+{
+    spin_wait_ = spin_wait;
+}
+
+void TimePublisher::sleepUntil(const ros::WallTime& target)
+{
+    ros::WallTime wake = target - spin_wait_;
+#if defined(_POSIX_TIMERS) && _POSIX_TIMERS > 0 && !defined(__APPLE__)
+    // Sleep to an absolute deadline, so time lost to interruptions or late wake ups doesn't add up.
+    // ros::WallTime is based on CLOCK_REALTIME.
+    timespec deadline;
+    deadline.tv_sec  = wake.sec;
+    deadline.tv_nsec = wake.nsec;
+    while (clock_nanosleep(CLOCK_REALTIME, TIMER_ABSTIME, &deadline, NULL) == EINTR)
+        ;
+#else
+    ros::WallTime::sleepUntil(wake);
+#endif
+
+    if (spin_wait_ > ros::WallDuration(0))
+        while (ros::WallTime::now() < target)
+            ;
+}
+
 void TimePublisher::setHorizon(const ros::Time& horizon)
 {
     horizon_ = horizon;
@@ -841,7 +1088,7 @@ void TimePublisher::runClock(const ros::WallDuration& duration)
             if (target > next_pub_)
               target = next_pub_;
 
-            ros::WallTime::sleepUntil(target);
+            sleepUntil(target);
 
             t = ros::WallTime::now();
         }
@@ -864,7 +1111,7 @@ void TimePublisher::runClock(const ros::WallDuration& duration)
         if (target > wc_horizon_)
             target = wc_horizon_;
 
-        ros::WallTime::sleepUntil(target);
+        sleepUntil(target);
     }
 }
 
@@ -909,7 +1156,7 @@ void TimePublisher::runStalledClock(const ros::WallDuration& duration)
             if (target > next_pub_)
               target = next_pub_;
 
-            ros::WallTime::sleepUntil(target);
+            sleepUntil(target);
 
             t = ros::WallTime::now();
         }
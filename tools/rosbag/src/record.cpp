@@ -64,12 +64,16 @@ rosbag::RecorderOptions parseOptions(int argc, char** argv) {
       ("lz4", "use LZ4 compression")
       ("split", po::value<int>()->implicit_value(0), "Split the bag file and continue recording when maximum size or maximum duration reached.")
       ("max-splits", po::value<int>(), "Keep a maximum of N bag files, when reaching the maximum erase the oldest one to keep a constant number of files.")
+      ("preallocate", "Reserve disk space for each bag file up front: the maximum size, or the size of the previous split.")
       ("topic", po::value< std::vector<std::string> >(), "topic to record")
       ("size", po::value<uint64_t>(), "The maximum size of the bag to record in MB.")
       ("duration", po::value<std::string>(), "Record a bag of maximum duration in seconds, unless 'm', or 'h' is appended.")
       ("node", po::value<std::string>(), "Record all topics subscribed to by a specific node.")
       ("tcpnodelay", "Use the TCP_NODELAY transport hint when subscribing to topics.")
-      ("udp", "Use the UDP transport hint when subscribing to topics.");
+      ("udp", "Use the UDP transport hint when subscribing to topics.")
+      ("receive-threads", po::value<int>()->default_value(10), "Receive the topics in no receive group with NUM threads (Default: 10)")
+      ("receive-group", po::value< std::vector<std::string> >(), "Receive the topics matching REGEX with a thread of their own, e.g. to keep images from delaying other topics. May be given several times.")
+      ("master-check-period", po::value<double>()->default_value(1.0), "Poll the master for new topics every SEC seconds when recording by regex, --all or --node (Default: 1.0)");
 
   
     po::positional_options_description p;
@@ -140,6 +144,8 @@ rosbag::RecorderOptions parseOptions(int argc, char** argv) {
             opts.max_splits = vm["max-splits"].as<int>();
         }
     }
+    if (vm.count("preallocate"))
+      opts.preallocate = true;
     if (vm.count("buffsize"))
     {
       int m = vm["buffsize"].as<int>();
@@ -251,6 +257,24 @@ rosbag::RecorderOptions parseOptions(int argc, char** argv) {
     {
       opts.transport_hints.udp();
     }
+    if (vm.count("receive-threads"))
+    {
+      int threads = vm["receive-threads"].as<int>();
+      if (threads <= 0)
+        throw ros::Exception("Number of receive threads must be positive");
+      opts.receive_threads = threads;
+    }
+    if (vm.count("receive-group"))
+    {
+      opts.receive_groups = vm["receive-group"].as< std::vector<std::string> >();
+    }
+    if (vm.count("master-check-period"))
+    {
+      double period = vm["master-check-period"].as<double>();
+      if (period <= 0.0)
+        throw ros::Exception("Master check period must be positive");
+      opts.master_check_period = ros::Duration(period);
+    }
 
     // Every non-option argument is assumed to be a topic
     if (vm.count("topic"))
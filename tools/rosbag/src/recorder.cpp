@@ -43,6 +43,7 @@
 #endif
 #include <time.h>
 
+#include <algorithm>
 #include <queue>
 #include <set>
 #include <sstream>
@@ -85,6 +86,126 @@ OutgoingQueue::OutgoingQueue(string const& _filename, std::queue<OutgoingMessage
 {
 }
 
+// TopicQueue
+
+TopicQueue::TopicQueue(string const& _topic) :
+    topic(_topic), size(0), max_size(0), received(0), dropped(0)
+{
+}
+
+// RecordBuffer
+
+RecordBuffer::RecordBuffer(uint64_t max_size) :
+    max_size_(max_size), size_(0), count_(0)
+{
+}
+
+shared_ptr<TopicQueue> RecordBuffer::addTopic(string const& topic) {
+    shared_ptr<TopicQueue> topic_queue(boost::make_shared<TopicQueue>(topic));
+    boost::mutex::scoped_lock lock(topic_queues_mutex_);
+    topic_queues_.push_back(topic_queue);
+    return topic_queue;
+}
+
+uint32_t RecordBuffer::push(TopicQueue& topic_queue, OutgoingMessage const& out) {
+    {
+        boost::mutex::scoped_lock lock(topic_queue.mutex);
+
+        uint32_t size = out.msg->size();
+        topic_queue.messages.push_back(out);
+        if (topic_queue.messages.size() == 1)
+            addHead(topic_queue);
+        topic_queue.size += size;
+        topic_queue.max_size = std::max(topic_queue.max_size, topic_queue.size);
+        topic_queue.received++;
+        size_ += size;
+        count_++;
+    }
+
+    // The topic queue is unlocked first, so that callbacks never wait on each other while holding it
+    uint32_t dropped = 0;
+    while (max_size_ > 0 && size_ > max_size_) {
+        DropResult result = dropOldest();
+        if (result == Empty)
+            break;
+        if (result == Dropped)
+            dropped++;
+    }
+    return dropped;
+}
+
+//! Drop the oldest message queued on any topic
+RecordBuffer::DropResult RecordBuffer::dropOldest() {
+    HeadSet::value_type oldest;
+    {
+        boost::mutex::scoped_lock lock(heads_mutex_);
+        if (heads_.empty())
+            return Empty;
+        oldest = *heads_.begin();
+    }
+
+    // The writer may have drained the queue meanwhile, in which case the buffer may have room again
+    TopicQueue& topic_queue = *oldest.second;
+    boost::mutex::scoped_lock lock(topic_queue.mutex);
+    if (topic_queue.messages.empty() || topic_queue.messages.front().time != oldest.first)
+        return Drained;
+
+    uint32_t drop_size = topic_queue.messages.front().msg->size();
+    removeHead(topic_queue);
+    topic_queue.messages.pop_front();
+    if (!topic_queue.messages.empty())
+        addHead(topic_queue);
+    topic_queue.size -= drop_size;
+    topic_queue.dropped++;
+    size_ -= drop_size;
+    count_--;
+    return Dropped;
+}
+
+//! Index the first message of topic_queue, whose mutex must be held
+void RecordBuffer::addHead(TopicQueue& topic_queue) {
+    boost::mutex::scoped_lock lock(heads_mutex_);
+    heads_.insert(std::make_pair(topic_queue.messages.front().time, &topic_queue));
+}
+
+//! Remove the first message of topic_queue, whose mutex must be held, from the index
+void RecordBuffer::removeHead(TopicQueue& topic_queue) {
+    boost::mutex::scoped_lock lock(heads_mutex_);
+    heads_.erase(std::make_pair(topic_queue.messages.front().time, &topic_queue));
+}
+
+void RecordBuffer::drain(std::vector<OutgoingMessage>& batch) {
+    std::vector<shared_ptr<TopicQueue> > topic_queues = getTopicQueues();
+
+    for (shared_ptr<TopicQueue> const& topic_queue : topic_queues) {
+        std::deque<OutgoingMessage> messages;
+        {
+            boost::mutex::scoped_lock lock(topic_queue->mutex);
+            if (topic_queue->messages.empty())
+                continue;
+
+            removeHead(*topic_queue);
+            messages.swap(topic_queue->messages);
+            size_ -= topic_queue->size;
+            count_ -= messages.size();
+            topic_queue->size = 0;
+        }
+        batch.insert(batch.end(), messages.begin(), messages.end());
+    }
+
+    // Each topic's messages are already in order; interleave the topics
+    std::stable_sort(batch.begin(), batch.end(),
+        [] (OutgoingMessage const& a, OutgoingMessage const& b) { return a.time < b.time; });
+}
+
+std::vector<shared_ptr<TopicQueue> > RecordBuffer::getTopicQueues() const {
+    boost::mutex::scoped_lock lock(topic_queues_mutex_);
+    return topic_queues_;
+}
+
+uint64_t RecordBuffer::getSize() const  { return size_;  }
+uint64_t RecordBuffer::getCount() const { return count_; }
+
 // RecorderOptions
 
 RecorderOptions::RecorderOptions() :
@@ -108,9 +229,12 @@ RecorderOptions::RecorderOptions() :
     max_size(0),
     max_splits(0),
     max_duration(-1.0),
+    preallocate(false),
     node(""),
     min_space(1024 * 1024 * 1024),
-    min_space_str("1G")
+    min_space_str("1G"),
+    receive_threads(10),
+    master_check_period(1.0)
 {
 }
 
@@ -120,8 +244,9 @@ Recorder::Recorder(RecorderOptions const& options) :
     options_(options),
     num_subscribers_(0),
     exit_code_(0),
-    queue_size_(0),
+    buffer_(options.buffer_size),
     split_count_(0),
+    last_split_size_(0),
     writing_enabled_(true)
 {
 }
@@ -146,6 +271,27 @@ int Recorder::run() {
         }
     }
 
+    // Compile the topic patterns once, rather than every time a topic is checked
+    if (options_.regex) {
+        try {
+            for (string const& regex_str : options_.topics)
+                topic_regexes_.push_back(boost::regex(regex_str, boost::regex::optimize));
+        }
+        catch (boost::regex_error const& ex) {
+            ROS_ERROR("Invalid topic regular expression: %s", ex.what());
+            return 1;
+        }
+    }
+
+    try {
+        for (string const& pattern : options_.receive_groups)
+            receive_group_regexes_.push_back(boost::regex(pattern, boost::regex::optimize));
+    }
+    catch (boost::regex_error const& ex) {
+        ROS_ERROR("Invalid receive group regular expression: %s", ex.what());
+        return 1;
+    }
+
     ros::NodeHandle nh;
     if (!nh.ok())
         return 0;
@@ -156,7 +302,14 @@ int Recorder::run() {
     }
 
     last_buffer_warn_ = Time();
-    queue_ = new std::queue<OutgoingMessage>;
+
+    // Give each group of topics its own callback queue and receive thread so
+    // that large messages on other topics don't hold them up.
+    for (size_t i = 0; i < receive_group_regexes_.size(); i++)
+    {
+        callback_queues_.push_back(boost::make_shared<ros::CallbackQueue>());
+        receive_spinners_.push_back(boost::make_shared<ros::AsyncSpinner>(1, callback_queues_.back().get()));
+    }
 
     // Subscribe to each topic
     if (!options_.regex) {
@@ -196,15 +349,20 @@ int Recorder::run() {
     {
         // check for master first
         doCheckMaster(ros::TimerEvent(), nh);
-        check_master_timer = nh.createTimer(ros::Duration(1.0), boost::bind(&Recorder::doCheckMaster, this, _1, boost::ref(nh)));
+        check_master_timer = nh.createTimer(options_.master_check_period, boost::bind(&Recorder::doCheckMaster, this, _1, boost::ref(nh)));
     }
 
-    ros::AsyncSpinner s(10);
+    for (shared_ptr<ros::AsyncSpinner> const& spinner : receive_spinners_)
+        spinner->start();
+
+    ros::AsyncSpinner s(options_.receive_threads);
     s.start();
 
     record_thread.join();
     queue_condition_.notify_all();
-    delete queue_;
+
+    for (shared_ptr<ros::AsyncSpinner> const& spinner : receive_spinners_)
+        spinner->stop();
 
     return exit_code_;
 }
@@ -215,6 +373,7 @@ shared_ptr<ros::Subscriber> Recorder::subscribe(string const& topic) {
     ros::NodeHandle nh;
     shared_ptr<int> count(boost::make_shared<int>(options_.limit));
     shared_ptr<ros::Subscriber> sub(boost::make_shared<ros::Subscriber>());
+    shared_ptr<TopicQueue> topic_queue(buffer_.addTopic(topic));
 
     ros::SubscribeOptions ops;
     ops.topic = topic;
@@ -223,8 +382,17 @@ shared_ptr<ros::Subscriber> Recorder::subscribe(string const& topic) {
     ops.datatype = ros::message_traits::datatype<topic_tools::ShapeShifter>();
     ops.helper = boost::make_shared<ros::SubscriptionCallbackHelperT<
         const ros::MessageEvent<topic_tools::ShapeShifter const> &> >(
-            boost::bind(&Recorder::doQueue, this, _1, topic, sub, count));
+            boost::bind(&Recorder::doQueue, this, _1, topic, sub, count, topic_queue));
     ops.transport_hints = options_.transport_hints;
+    // The first receive group the topic matches receives it, otherwise the global queue does
+    for (size_t i = 0; i < receive_group_regexes_.size(); i++)
+    {
+        if (boost::regex_match(topic, receive_group_regexes_[i]))
+        {
+            ops.callback_queue = callback_queues_[i].get();
+            break;
+        }
+    }
     *sub = nh.subscribe(ops);
 
     currently_recording_.insert(topic);
@@ -255,11 +423,9 @@ bool Recorder::shouldSubscribeToTopic(std::string const& topic, bool from_node)
     if (options_.regex) {
         // Treat the topics as regular expressions
 	return std::any_of(
-            std::begin(options_.topics), std::end(options_.topics),
-            [&topic] (string const& regex_str){
-                boost::regex e(regex_str);
-                boost::smatch what;
-                return boost::regex_match(topic, what, e, boost::match_extra);
+            std::begin(topic_regexes_), std::end(topic_regexes_),
+            [&topic] (boost::regex const& e){
+                return boost::regex_match(topic, e);
             });
     }
 
@@ -282,7 +448,7 @@ std::string Recorder::timeToStr(T ros_t)
 }
 
 //! Callback to be invoked to save messages into a queue
-void Recorder::doQueue(const ros::MessageEvent<topic_tools::ShapeShifter const>& msg_event, string const& topic, shared_ptr<ros::Subscriber> subscriber, shared_ptr<int> count) {
+void Recorder::doQueue(const ros::MessageEvent<topic_tools::ShapeShifter const>& msg_event, string const& topic, shared_ptr<ros::Subscriber> subscriber, shared_ptr<int> count, shared_ptr<TopicQueue> topic_queue) {
     //void Recorder::doQueue(topic_tools::ShapeShifter::ConstPtr msg, string const& topic, shared_ptr<ros::Subscriber> subscriber, shared_ptr<int> count) {
     Time rectime = Time::now();
     
@@ -291,25 +457,14 @@ void Recorder::doQueue(const ros::MessageEvent<topic_tools::ShapeShifter const>&
 
     OutgoingMessage out(topic, msg_event.getMessage(), msg_event.getConnectionHeaderPtr(), rectime);
     
-    {
-        boost::mutex::scoped_lock lock(queue_mutex_);
+    bool dropped = buffer_.push(*topic_queue, out) > 0;
 
-        queue_->push(out);
-        queue_size_ += out.msg->size();
-        
-        // Check to see if buffer has been exceeded
-        while (options_.buffer_size > 0 && queue_size_ > options_.buffer_size) {
-            OutgoingMessage drop = queue_->front();
-            queue_->pop();
-            queue_size_ -= drop.msg->size();
-
-            if (!options_.snapshot) {
-                Time now = Time::now();
-                if (now > last_buffer_warn_ + ros::Duration(5.0)) {
-                    ROS_WARN("rosbag record buffer exceeded.  Dropping oldest queued message.");
-                    last_buffer_warn_ = now;
-                }
-            }
+    if (dropped && !options_.snapshot) {
+        boost::mutex::scoped_lock lock(queue_mutex_);
+        Time now = Time::now();
+        if (now > last_buffer_warn_ + ros::Duration(5.0)) {
+            ROS_WARN("rosbag record buffer exceeded.  Dropping oldest queued message.");
+            last_buffer_warn_ = now;
         }
     }
   
@@ -368,16 +523,38 @@ void Recorder::snapshotTrigger(std_msgs::Empty::ConstPtr trigger) {
     
     ROS_INFO("Triggered snapshot recording with name %s.", target_filename_.c_str());
     
+    std::vector<OutgoingMessage> batch;
+    buffer_.drain(batch);
+
+    std::queue<OutgoingMessage>* queue = new std::queue<OutgoingMessage>;
+    for (OutgoingMessage const& out : batch)
+        queue->push(out);
+
     {
         boost::mutex::scoped_lock lock(queue_mutex_);
-        queue_queue_.push(OutgoingQueue(target_filename_, queue_, Time::now()));
-        queue_      = new std::queue<OutgoingMessage>;
-        queue_size_ = 0;
+        queue_queue_.push(OutgoingQueue(target_filename_, queue, Time::now()));
     }
 
     queue_condition_.notify_all();
 }
 
+void Recorder::printQueueStats(bool final) {
+    std::vector<shared_ptr<TopicQueue> > topic_queues = buffer_.getTopicQueues();
+
+    for (shared_ptr<TopicQueue> const& topic_queue : topic_queues) {
+        boost::mutex::scoped_lock lock(topic_queue->mutex);
+        if (final && topic_queue->dropped > 0)
+            ROS_WARN("Dropped %llu of %llu messages on %s due to buffer overflow.",
+                     (unsigned long long) topic_queue->dropped, (unsigned long long) topic_queue->received,
+                     topic_queue->topic.c_str());
+        else
+            ROS_DEBUG("Queue %s: %lu queued (%llu bytes, peak %llu bytes), %llu received, %llu dropped",
+                      topic_queue->topic.c_str(), (unsigned long) topic_queue->messages.size(),
+                      (unsigned long long) topic_queue->size, (unsigned long long) topic_queue->max_size,
+                      (unsigned long long) topic_queue->received, (unsigned long long) topic_queue->dropped);
+    }
+}
+
 void Recorder::startWriting() {
     bag_.setCompression(options_.compression);
     bag_.setChunkThreshold(options_.chunk_size);
@@ -393,6 +570,14 @@ void Recorder::startWriting() {
     }
     ROS_INFO("Recording to %s.", target_filename_.c_str());
 
+    if (options_.preallocate && bag_.isOpen())
+    {
+        // A split grows until its last chunk is written after passing max_size
+        uint64_t size = options_.max_size > 0 ? options_.max_size + options_.chunk_size : last_split_size_;
+        if (size > 0 && !bag_.preallocate(size))
+            ROS_WARN_ONCE("Unable to preallocate space for %s", target_filename_.c_str());
+    }
+
     if (options_.publish)
     {
         std_msgs::String msg;
@@ -402,11 +587,43 @@ void Recorder::startWriting() {
 }
 
 void Recorder::stopWriting() {
+    if (closing_thread_.joinable())
+        closing_thread_.join();
+
     ROS_INFO("Closing %s.", target_filename_.c_str());
     bag_.close();
     rename(write_filename_.c_str(), target_filename_.c_str());
 }
 
+//! Continue recording to the next split file, closing the current one in the background
+void Recorder::rollover() {
+    // Wait for the previous file to be closed, so checkNumSplits never removes a file that is still being written
+    if (closing_thread_.joinable())
+        closing_thread_.join();
+
+    ROS_INFO("Closing %s.", target_filename_.c_str());
+    boost::shared_ptr<Bag> bag = boost::make_shared<Bag>();
+    bag->swap(bag_);
+    last_split_size_ = bag->getSize();
+    closing_thread_ = boost::thread(&Recorder::closeBag, bag, write_filename_, target_filename_);
+
+    split_count_++;
+    checkNumSplits();
+    startWriting();
+}
+
+void Recorder::closeBag(boost::shared_ptr<Bag> bag, std::string const& write_filename, std::string const& target_filename) {
+    try
+    {
+        bag->close();
+    }
+    catch (rosbag::BagException const& ex)
+    {
+        ROS_ERROR("Error closing %s: %s", target_filename.c_str(), ex.what());
+    }
+    rename(write_filename.c_str(), target_filename.c_str());
+}
+
 void Recorder::checkNumSplits()
 {
     if(options_.max_splits>0)
@@ -432,10 +649,7 @@ bool Recorder::checkSize()
         {
             if (options_.split)
             {
-                stopWriting();
-                split_count_++;
-                checkNumSplits();
-                startWriting();
+                rollover();
             } else {
                 ros::shutdown();
                 return true;
@@ -455,11 +669,8 @@ bool Recorder::checkDuration(const ros::Time& t)
             {
                 while (start_time_ + options_.max_duration < t)
                 {
-                    stopWriting();
-                    split_count_++;
-                    checkNumSplits();
                     start_time_ += options_.max_duration;
-                    startWriting();
+                    rollover();
                 }
             } else {
                 ros::shutdown();
@@ -493,53 +704,42 @@ void Recorder::doRecord() {
 
     check_disk_next_ = ros::WallTime::now() + ros::WallDuration().fromSec(20.0);
 
-    // Technically the queue_mutex_ should be locked while checking empty.
-    // Except it should only get checked if the node is not ok, and thus
-    // it shouldn't be in contention.
+    stats_next_ = ros::WallTime::now() + ros::WallDuration().fromSec(10.0);
+
     ros::NodeHandle nh;
-    while (nh.ok() || !queue_->empty()) {
-        boost::unique_lock<boost::mutex> lock(queue_mutex_);
+    std::vector<OutgoingMessage> batch;
+    bool finished = false;
+    while (!finished) {
+        batch.clear();
+        buffer_.drain(batch);
 
-        bool finished = false;
-        while (queue_->empty()) {
-            if (!nh.ok()) {
-                lock.release()->unlock();
-                finished = true;
+        if (batch.empty()) {
+            if (!nh.ok())
                 break;
-            }
-            boost::xtime xt;
+
+            boost::unique_lock<boost::mutex> lock(queue_mutex_);
+            if (buffer_.getCount() == 0) {
+                boost::xtime xt;
 #if BOOST_VERSION >= 105000
-            boost::xtime_get(&xt, boost::TIME_UTC_);
+                boost::xtime_get(&xt, boost::TIME_UTC_);
 #else
-            boost::xtime_get(&xt, boost::TIME_UTC);
+                boost::xtime_get(&xt, boost::TIME_UTC);
 #endif
-            xt.nsec += 250000000;
-            queue_condition_.timed_wait(lock, xt);
+                xt.nsec += 250000000;
+                queue_condition_.timed_wait(lock, xt);
+            }
+            lock.unlock();
+
             if (checkDuration(ros::Time::now()))
-            {
-                finished = true;
                 break;
-            }
+            continue;
         }
-        if (finished)
-            break;
-
-        OutgoingMessage out = queue_->front();
-        queue_->pop();
-        queue_size_ -= out.msg->size();
-        
-        lock.release()->unlock();
-        
-        if (checkSize())
-            break;
-
-        if (checkDuration(out.time))
-            break;
 
+        // Disk space and logging state only need to be checked once per batch
+        bool write;
         try
         {
-            if (scheduledCheckDisk() && checkLogging())
-                bag_.write(out.topic, out.time, *out.msg, out.connection_header);
+            write = scheduledCheckDisk() && checkLogging();
         }
         catch (rosbag::BagException &ex)
         {
@@ -547,8 +747,36 @@ void Recorder::doRecord() {
             exit_code_ = 1;
             break;
         }
+
+        for (OutgoingMessage const& out : batch) {
+            if (checkSize() || checkDuration(out.time)) {
+                finished = true;
+                break;
+            }
+
+            if (!write)
+                continue;
+
+            try
+            {
+                bag_.write(out.topic, out.time, *out.msg, out.connection_header);
+            }
+            catch (rosbag::BagException &ex)
+            {
+                ROS_ERROR_STREAM(ex.what());
+                exit_code_ = 1;
+                finished = true;
+                break;
+            }
+        }
+
+        if (ros::WallTime::now() >= stats_next_) {
+            stats_next_ += ros::WallDuration().fromSec(10.0);
+            printQueueStats(false);
+        }
     }
 
+    printQueueStats(true);
     stopWriting();
 }
 
@@ -596,6 +824,9 @@ void Recorder::doCheckMaster(ros::TimerEvent const& e, ros::NodeHandle& node_han
     ros::master::V_TopicInfo topics;
     if (ros::master::getTopics(topics)) {
 	for (ros::master::TopicInfo const& t : topics) {
+	    // Only topics that are new since the last check need to be matched
+	    if (!checked_topics_.insert(t.name).second)
+	        continue;
 	    if (shouldSubscribeToTopic(t.name))
 	        subscribe(t.name);
 	}
@@ -294,19 +294,10 @@ class _ROSBagAesCbcEncryptor(_ROSBagEncryptor):
         @return: encrypted string representing header
         @rtype:  str
         """
-        header_str = b''
-        equal = b'='
-        for k, v in header.items():
-            if not isinstance(k, bytes):
-                k = k.encode()
-            if not isinstance(v, bytes):
-                v = v.encode()
-            header_str += _pack_uint32(len(k) + 1 + len(v)) + k + equal + v
-
         iv = Random.new().read(AES.block_size)
         enc_str = iv
         cipher = AES.new(self._symmetric_key, AES.MODE_CBC, iv)
-        enc_str += cipher.encrypt(_add_padding(header_str))
+        enc_str += cipher.encrypt(_add_padding(_encode_header(header)))
         _write_sized(f, enc_str)
         return enc_str
 
@@ -370,6 +361,98 @@ class _ROSBagAesCbcEncryptor(_ROSBagEncryptor):
         header = cipher.decrypt(encrypted_header)
         return _remove_padding(header)
 
+class _ROSBagAesGcmEncryptor(_ROSBagAesCbcEncryptor):
+    """
+    Class for AES-GCM-encrypted bags.
+    Encrypted chunks and headers are followed by the nonce and the authentication tag.
+    """
+    NAME = 'rosbag/AesGcmEncryptor'
+    _NONCE_SIZE = 12
+    _TAG_SIZE = 16
+
+    def encrypt_chunk(self, chunk_size, chunk_data_pos, f):
+        """
+        Read chunk from file, encrypt it, and write back to file.
+        @param chunk_size: size of chunk
+        @type  chunk_size: int
+        @param chunk_data_pos: position of chunk data portion
+        @type  chunk_data_pos: int
+        @param f: file stream
+        @type  f: file
+        @return: size of encrypted chunk, nonce and tag
+        @rtype:  int
+        """
+        f.seek(chunk_data_pos)
+        chunk = _read(f, chunk_size)
+        encrypted_chunk = self._encrypt(chunk)
+        f.seek(chunk_data_pos)
+        f.write(encrypted_chunk)
+        f.truncate(f.tell())
+        return len(encrypted_chunk)
+
+    def decrypt_chunk(self, encrypted_chunk):
+        """
+        Decrypt chunk.
+        @param encrypted_chunk: chunk to decrypt
+        @type  encrypted_chunk: str
+        @return: decrypted chunk
+        @rtype:  str
+        @raise ROSBagFormatException: if the chunk is too short or fails authentication
+        """
+        return self._decrypt(encrypted_chunk)
+
+    def write_encrypted_header(self, _, f, header):
+        """
+        Write encrypted header to bag file.
+        @param f: file stream
+        @type  f: file
+        @param header: unencrypted header
+        @type  header: dict
+        @return: encrypted string representing header
+        @rtype:  str
+        """
+        enc_str = self._encrypt(_encode_header(header))
+        _write_sized(f, enc_str)
+        return enc_str
+
+    def _decrypt_encrypted_header(self, f):
+        try:
+            size = _read_uint32(f)
+        except struct.error as ex:
+            raise ROSBagFormatException('error unpacking uint32: %s' % str(ex))
+
+        return self._decrypt(_read(f, size))
+
+    def _encrypt(self, data):
+        nonce = Random.new().read(self._NONCE_SIZE)
+        cipher = AES.new(self._symmetric_key, AES.MODE_GCM, nonce=nonce)
+        encrypted_data, tag = cipher.encrypt_and_digest(data)
+        return encrypted_data + nonce + tag
+
+    def _decrypt(self, encrypted_data):
+        if len(encrypted_data) < self._NONCE_SIZE + self._TAG_SIZE:
+            raise ROSBagFormatException('No nonce and tag in encrypted data: {}'.format(len(encrypted_data)))
+
+        size = len(encrypted_data) - self._NONCE_SIZE - self._TAG_SIZE
+        nonce = encrypted_data[size:size + self._NONCE_SIZE]
+        tag = encrypted_data[size + self._NONCE_SIZE:]
+        cipher = AES.new(self._symmetric_key, AES.MODE_GCM, nonce=nonce)
+        try:
+            return cipher.decrypt_and_verify(encrypted_data[:size], tag)
+        except ValueError:
+            raise ROSBagFormatException('Encrypted data failed authentication')
+
+def _encode_header(header):
+    header_str = b''
+    equal = b'='
+    for k, v in header.items():
+        if not isinstance(k, bytes):
+            k = k.encode()
+        if not isinstance(v, bytes):
+            v = v.encode()
+        header_str += _pack_uint32(len(k) + 1 + len(v)) + k + equal + v
+    return header_str
+
 def _add_padding(input_str):
     # Add PKCS#7 padding to input string
     return input_str + (AES.block_size - len(input_str) % AES.block_size) * chr(AES.block_size - len(input_str) % AES.block_size)
@@ -917,6 +1000,11 @@ class Bag(object):
                 raise ROSBagEncryptNotSupportedException('AES CBC encryptor is not supported for Windows')
             else:
                 self._encryptor = _ROSBagAesCbcEncryptor()
+        elif encryptor == _ROSBagAesGcmEncryptor.NAME:
+            if sys.platform == 'win32':
+                raise ROSBagEncryptNotSupportedException('AES GCM encryptor is not supported for Windows')
+            else:
+                self._encryptor = _ROSBagAesGcmEncryptor()
         else:
             self._encryptor = _ROSBagNoEncryptor()
         self._encryptor.initialize(self, param)
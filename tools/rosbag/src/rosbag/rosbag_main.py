@@ -86,6 +86,7 @@ def record_cmd(argv):
     parser.add_option("-O", "--output-name",   dest="name",          default=None,  action="store",               help="record to bag with name NAME.bag")
     parser.add_option(      "--split",         dest="split",         default=False, callback=handle_split, action="callback",    help="split the bag when maximum size or duration is reached")
     parser.add_option(      "--max-splits",    dest="max_splits",                   type='int',   action="store", help="Keep a maximum of N bag files, when reaching the maximum erase the oldest one to keep a constant number of files.", metavar="MAX_SPLITS")
+    parser.add_option(      "--preallocate",   dest="preallocate",   default=False, action="store_true",          help="reserve disk space for each bag file up front: the maximum size, or the size of the previous split")
     parser.add_option(      "--size",          dest="size",                         type='int',   action="store", help="record a bag of maximum size SIZE MB. (Default: infinite)", metavar="SIZE")
     parser.add_option(      "--duration",      dest="duration",                     type='string',action="store", help="record a bag of maximum duration DURATION in seconds, unless 'm', or 'h' is appended.", metavar="DURATION")
     parser.add_option("-b", "--buffsize",      dest="buffsize",      default=256,   type='int',   action="store", help="use an internal buffer of SIZE MB (Default: %default, 0 = infinite)", metavar="SIZE")
@@ -96,6 +97,9 @@ def record_cmd(argv):
     parser.add_option("--lz4",                 dest="compression",                  action="store_const", const='lz4', help="use LZ4 compression")
     parser.add_option("--tcpnodelay",          dest="tcpnodelay",                   action="store_true",          help="Use the TCP_NODELAY transport hint when subscribing to topics.")
     parser.add_option("--udp",                 dest="udp",                          action="store_true",          help="Use the UDP transport hint when subscribing to topics.")
+    parser.add_option("--master-check-period", dest="master_check_period", default=1.0, type='float', action="store", help="poll the master for new topics every SEC seconds when recording by regex, -a or --node (Default: %default)", metavar="SEC")
+    parser.add_option("--receive-threads",     dest="receive_threads", default=10,  type='int',   action="store", help="receive the topics in no receive group with NUM threads (Default: %default)", metavar="NUM")
+    parser.add_option("--receive-group",       dest="receive_groups", default=[],   action="append",              help="receive the topics matching REGEX with a thread of their own, e.g. to keep images from delaying other topics (may be given several times)", metavar="REGEX")
 
     (options, args) = parser.parse_args(argv)
 
@@ -112,6 +116,10 @@ def record_cmd(argv):
 
     cmd.extend(['--buffsize',  str(options.buffsize)])
     cmd.extend(['--chunksize', str(options.chunksize)])
+    cmd.extend(['--receive-threads', str(options.receive_threads)])
+    for group in options.receive_groups:
+        cmd.extend(['--receive-group', group])
+    cmd.extend(['--master-check-period', str(options.master_check_period)])
 
     if options.num != 0:      cmd.extend(['--limit', str(options.num)])
     if options.quiet:         cmd.extend(["--quiet"])
@@ -128,6 +136,7 @@ def record_cmd(argv):
         cmd.extend(["--split"])
         if options.max_splits:
             cmd.extend(["--max-splits", str(options.max_splits)])
+    if options.preallocate: cmd.extend(["--preallocate"])
     if options.duration:    cmd.extend(["--duration", options.duration])
     if options.size:        cmd.extend(["--size", str(options.size)])
     if options.node:
@@ -250,6 +259,10 @@ def play_cmd(argv):
     parser.add_option("--wait-for-subscribers",  dest="wait_for_subscribers", default=False, action="store_true", help="wait for at least one subscriber on each topic before publishing")
     parser.add_option("--rate-control-topic", dest="rate_control_topic", default='', type='str', help="watch the given topic, and if the last publish was more than <rate-control-max-delay> ago, wait until the topic publishes again to continue playback")
     parser.add_option("--rate-control-max-delay", dest="rate_control_max_delay", default=1.0, type='float', help="maximum time difference from <rate-control-topic> before pausing")
+    parser.add_option("--lanes",              dest="lanes",      default=False, action="store_true", help="read messages ahead on a separate thread and publish each topic from its own thread")
+    parser.add_option("--spin-wait",          dest="spin_wait",  default=0.0,   type='float', action="store", help="busy-wait the last USEC microseconds before each message is due, for more precise timing at the cost of CPU", metavar="USEC")
+    parser.add_option("--jitter-stats",       dest="jitter_stats", default=False, action="store_true", help="print statistics of how late messages were published after playback")
+    parser.add_option("--read-ahead",         dest="read_ahead", default=100,   type='int', action="store", help="number of messages to read ahead with --lanes (default: %default)", metavar="NUM")
 
     (options, args) = parser.parse_args(argv)
 
@@ -274,6 +287,9 @@ def play_cmd(argv):
     if options.keep_alive: cmd.extend(["--keep-alive"])
     if options.try_future: cmd.extend(["--try-future-version"])
     if options.wait_for_subscribers: cmd.extend(["--wait-for-subscribers"])
+    if options.lanes:      cmd.extend(["--lanes", "--read-ahead", str(options.read_ahead)])
+    if options.jitter_stats: cmd.extend(["--jitter-stats"])
+    if options.spin_wait:  cmd.extend(["--spin-wait", str(options.spin_wait)])
 
     if options.clock:
         cmd.extend(["--clock", "--hz", str(options.freq)])
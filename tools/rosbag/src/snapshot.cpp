@@ -66,8 +66,10 @@ bool parseOptions(po::variables_map& vm, int argc, char** argv)
     ("trigger-write,t", "Write buffer of selected topcis to a bag file")
     ("pause,p", "Stop buffering new messages until resumed or write is triggered")
     ("resume,r", "Resume buffering new messages, writing over older messages as needed")
-    ("size,s", po::value<double>()->default_value(-1), "Maximum memory per topic to use in buffering in MB. Default: no limit")
+    ("size,s", po::value<double>()->default_value(-1), "Maximum memory per topic to use in buffering in MB. Twice this is used while a snapshot is written. Default: no limit")
     ("duration,d", po::value<double>()->default_value(30.0), "Maximum difference between newest and oldest buffered message per topic in seconds. Default: 30")
+    ("spill-size", po::value<double>()->default_value(-1), "Disk space per topic in MB to which messages exceeding --size are moved instead of being dropped. Requires --spill-dir. Default: no spilling")
+    ("spill-dir", po::value<std::string>()->default_value(""), "Directory for the files of --spill-size. Twice --spill-size is allocated per topic on startup")
     ("output-prefix,o", po::value<std::string>()->default_value(""), "When in trigger write mode, prepend PREFIX to name of writting bag file")
     ("output-filename,O", po::value<std::string>(), "When in trigger write mode, exact name of written bag file")
     ("topic", po::value<std::vector<std::string> >(), "Topic to buffer. If triggering write, write only these topics instead of all buffered topics.");
@@ -108,6 +110,8 @@ bool parseVariablesMap(SnapshotterOptions& opts, po::variables_map const& vm)
   }
   opts.default_memory_limit_ = int(MB_TO_BYTES * vm["size"].as<double>());
   opts.default_duration_limit_ = ros::Duration(vm["duration"].as<double>());
+  opts.default_spill_limit_ = int64_t(MB_TO_BYTES * vm["spill-size"].as<double>());
+  opts.spill_directory_ = vm["spill-dir"].as<std::string>();
   return true;
 }
 
@@ -145,6 +149,9 @@ void appendParamOptions(ros::NodeHandle& nh, SnapshotterOptions& opts)
     opts.default_memory_limit_ = int(MB_TO_BYTES * tmp);
   if (nh.getParam("default_duration_limit", tmp))
     opts.default_duration_limit_ = ros::Duration(tmp);
+  if (nh.getParam("default_spill_limit", tmp))
+    opts.default_spill_limit_ = int64_t(MB_TO_BYTES * tmp);
+  nh.getParam("spill_directory", opts.spill_directory_);
 
   if (!nh.getParam("topics", topics))
   {
@@ -171,6 +178,7 @@ void appendParamOptions(ros::NodeHandle& nh, SnapshotterOptions& opts)
 
       ros::Duration dur = SnapshotterTopicOptions::INHERIT_DURATION_LIMIT;
       int64_t mem = SnapshotterTopicOptions::INHERIT_MEMORY_LIMIT;
+      int64_t spill = SnapshotterTopicOptions::INHERIT_SPILL_LIMIT;
       std::string duration = "duration";
       std::string memory = "memory";
       if (topic_config.hasMember(duration))
@@ -205,7 +213,23 @@ void appendParamOptions(ros::NodeHandle& nh, SnapshotterOptions& opts)
         else
           ROS_FATAL("err");
       }
-      opts.addTopic(topic, dur, mem);
+      if (topic_config.hasMember("spill"))
+      {
+        XmlRpcValue& spill_limit = topic_config["spill"];
+        if (spill_limit.getType() == XmlRpcValue::TypeDouble)
+        {
+          double mb = spill_limit;
+          spill = int64_t(MB_TO_BYTES * mb);
+        }
+        else if (spill_limit.getType() == XmlRpcValue::TypeInt)
+        {
+          int mb = spill_limit;
+          spill = int64_t(MB_TO_BYTES) * mb;
+        }
+        else
+          ROS_FATAL("err");
+      }
+      opts.addTopic(topic, dur, mem, spill);
     }
     else
       ROS_ASSERT_MSG(false, "Parameter invalid for topic %lu", i);
@@ -31,12 +31,18 @@
 *  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
 *  POSSIBILITY OF SUCH DAMAGE.
 ********************************************************************/
+#include <fcntl.h>
 #include <time.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <algorithm>
 #include <queue>
 #include <string>
 #include <vector>
 #include <boost/filesystem.hpp>
 #include <boost/foreach.hpp>
+#include <boost/lexical_cast.hpp>
 #include <boost/scope_exit.hpp>
 #include <boost/thread/xtime.hpp>
 #include <boost/date_time/local_time/local_time.hpp>
@@ -56,9 +62,12 @@ const ros::Duration SnapshotterTopicOptions::NO_DURATION_LIMIT = ros::Duration(-
 const int32_t SnapshotterTopicOptions::NO_MEMORY_LIMIT = -1;
 const ros::Duration SnapshotterTopicOptions::INHERIT_DURATION_LIMIT = ros::Duration(0);
 const int32_t SnapshotterTopicOptions::INHERIT_MEMORY_LIMIT = 0;
+const int64_t SnapshotterTopicOptions::NO_SPILL = -1;
+const int64_t SnapshotterTopicOptions::INHERIT_SPILL_LIMIT = 0;
 
-SnapshotterTopicOptions::SnapshotterTopicOptions(ros::Duration duration_limit, int32_t memory_limit)
-  : duration_limit_(duration_limit), memory_limit_(memory_limit)
+SnapshotterTopicOptions::SnapshotterTopicOptions(ros::Duration duration_limit, int32_t memory_limit,
+                                                 int64_t spill_limit)
+  : duration_limit_(duration_limit), memory_limit_(memory_limit), spill_limit_(spill_limit)
 {
 }
 
@@ -67,28 +76,153 @@ SnapshotterOptions::SnapshotterOptions(ros::Duration default_duration_limit, int
   : default_duration_limit_(default_duration_limit)
   , default_memory_limit_(default_memory_limit)
   , status_period_(status_period)
+  , default_spill_limit_(SnapshotterTopicOptions::NO_SPILL)
   , topics_()
 {
 }
 
-void SnapshotterOptions::addTopic(std::string const& topic, ros::Duration duration, int32_t memory)
+void SnapshotterOptions::addTopic(std::string const& topic, ros::Duration duration, int32_t memory, int64_t spill)
 {
-  SnapshotterTopicOptions ops(duration, memory);
+  SnapshotterTopicOptions ops(duration, memory, spill);
   topics_.insert(topics_t::value_type(topic, ops));
 }
 
+SpillFile::SpillFile(string const& directory, uint64_t capacity) : fd_(-1), capacity_(capacity)
+{
+  boost::filesystem::path path =
+      boost::filesystem::path(directory) / boost::filesystem::unique_path("snapshot-%%%%-%%%%-%%%%.spill");
+  fd_ = open(path.string().c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+  if (fd_ < 0)
+    throw BagIOException("Error opening spill file " + path.string() + ": " + strerror(errno));
+  unlink(path.string().c_str());
+
+  // Reserve all the space now so that spilling never fails half way for lack of disk space
+  int err = posix_fallocate(fd_, 0, capacity_);
+  if (err != 0)
+  {
+    close(fd_);
+    throw BagIOException("Error allocating " + boost::lexical_cast<string>(capacity_) + " bytes for spill file in " +
+                         directory + ": " + strerror(err));
+  }
+}
+
+SpillFile::~SpillFile()
+{
+  close(fd_);
+}
+
+uint64_t SpillFile::capacity() const
+{
+  return capacity_;
+}
+
+void SpillFile::write(uint64_t offset, uint8_t const* data, uint32_t size)
+{
+  while (size > 0)
+  {
+    ssize_t written = pwrite(fd_, data, size, offset);
+    if (written < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      throw BagIOException(string("Error writing to spill file: ") + strerror(errno));
+    }
+    data += written;
+    offset += written;
+    size -= written;
+  }
+}
+
+void SpillFile::read(uint64_t offset, uint8_t* data, uint32_t size) const
+{
+  while (size > 0)
+  {
+    ssize_t nread = pread(fd_, data, size, offset);
+    if (nread <= 0)
+    {
+      if (nread < 0 && errno == EINTR)
+        continue;
+      throw BagIOException(string("Error reading from spill file: ") + (nread < 0 ? strerror(errno) : "end of file"));
+    }
+    data += nread;
+    offset += nread;
+    size -= nread;
+  }
+}
+
+// Find room for size contiguous bytes in a ring of capacity bytes holding used bytes of data, which start at head and
+// end at tail, possibly wrapping around. Returns false if data has to be removed first.
+static bool findRingSpace(uint64_t capacity, uint64_t used, uint64_t head, uint64_t tail, uint64_t size,
+                          uint64_t& offset)
+{
+  // Nothing is stored, so start again at the beginning of the ring
+  if (used == 0)
+  {
+    offset = 0;
+    return size <= capacity;
+  }
+
+  // Live data is in [head, tail), or in [head, capacity) and [0, tail) when it has wrapped around
+  if (tail > head)
+  {
+    if (capacity - tail >= size)
+    {
+      offset = tail;
+      return true;
+    }
+    if (head >= size)
+    {
+      offset = 0;
+      return true;
+    }
+    return false;
+  }
+  if (head - tail >= size)
+  {
+    offset = tail;
+    return true;
+  }
+  return false;
+}
+
 SnapshotterClientOptions::SnapshotterClientOptions() : action_(SnapshotterClientOptions::TRIGGER_WRITE)
 {
 }
 
 SnapshotMessage::SnapshotMessage(topic_tools::ShapeShifter::ConstPtr _msg,
                                  boost::shared_ptr<ros::M_string> _connection_header, Time _time)
-  : msg(_msg), connection_header(_connection_header), time(_time)
+  : msg(_msg), connection_header(_connection_header), time(_time), size(_msg ? _msg->size() : 0), offset(0)
 {
 }
 
-MessageQueue::MessageQueue(SnapshotterTopicOptions const& options) : options_(options), size_(0)
+MessageQueue::MessageQueue(SnapshotterTopicOptions const& options, string const& spill_directory)
+  : options_(options)
+  , size_(0)
+  , ring_tail_(0)
+  , ring_size_(0)
+  , old_ring_msgs_(0)
+  , ring_readers_(boost::make_shared<int>(0))
+  , spare_ring_readers_(boost::make_shared<int>(0))
+  , spilled_size_(0)
+  , spill_directory_(spill_directory)
+  , spill_tail_(0)
+  , spill_size_(0)
+  , old_spill_msgs_(0)
+  , spill_readers_(boost::make_shared<int>(0))
+  , spare_spill_readers_(boost::make_shared<int>(0))
 {
+  // With a memory limit, all message data fits in a buffer allocated once up front. A spare one to continue in while a
+  // snapshot is written is only allocated by copy().
+  if (options_.memory_limit_ > 0)
+  {
+    ring_.reset(new uint8_t[options_.memory_limit_]);
+    // Messages pushed out of the ring go to disk, if enabled
+    if (options_.spill_limit_ > 0 && !spill_directory_.empty())
+    {
+      spill_.reset(new SpillFile(spill_directory_, options_.spill_limit_));
+      spare_spill_.reset(new SpillFile(spill_directory_, options_.spill_limit_));
+    }
+  }
 }
 
 void MessageQueue::setSubscriber(shared_ptr<ros::Subscriber> sub)
@@ -99,12 +233,12 @@ void MessageQueue::setSubscriber(shared_ptr<ros::Subscriber> sub)
 void MessageQueue::fillStatus(rosgraph_msgs::TopicStatistics& status)
 {
   boost::mutex::scoped_lock l(lock);
-  if (!queue_.size())
+  if (queue_.empty() && spilled_.empty())
     return;
-  status.traffic = size_;
-  status.delivered_msgs = queue_.size();
-  status.window_start = queue_.front().time;
-  status.window_stop = queue_.back().time;
+  status.traffic = size_ + spilled_size_;
+  status.delivered_msgs = queue_.size() + spilled_.size();
+  status.window_start = spilled_.empty() ? queue_.front().time : spilled_.front().time;
+  status.window_stop = queue_.empty() ? spilled_.back().time : queue_.back().time;
 }
 
 void MessageQueue::clear()
@@ -117,20 +251,29 @@ void MessageQueue::_clear()
 {
   queue_.clear();
   size_ = 0;
+  ring_tail_ = 0;
+  ring_size_ = 0;
+  old_ring_msgs_ = 0;
+  spilled_.clear();
+  spilled_size_ = 0;
+  spill_tail_ = 0;
+  spill_size_ = 0;
+  old_spill_msgs_ = 0;
 }
 
 ros::Duration MessageQueue::duration() const
 {
   // No duration if 0 or 1 messages
-  if (queue_.size() <= 1)
+  if (queue_.size() + spilled_.size() <= 1)
     return ros::Duration();
-  return queue_.back().time - queue_.front().time;
+  Time newest = queue_.empty() ? spilled_.back().time : queue_.back().time;
+  return newest - (spilled_.empty() ? queue_.front().time : spilled_.front().time);
 }
 
 bool MessageQueue::preparePush(int32_t size, ros::Time const& time)
 {
   // If new message is older than back of queue, time has gone backwards and buffer must be cleared
-  if (!queue_.empty() and time < queue_.back().time)
+  if ((!queue_.empty() and time < queue_.back().time) or (!spilled_.empty() and time < spilled_.back().time))
   {
     ROS_WARN("Time has gone backwards. Clearing buffer for this topic.");
     _clear();
@@ -143,19 +286,20 @@ bool MessageQueue::preparePush(int32_t size, ros::Time const& time)
   // If memory limit is enforced, remove elements from front of queue until limit would be met once message is added
   if (options_.memory_limit_ > SnapshotterTopicOptions::NO_MEMORY_LIMIT)
     while (queue_.size() != 0 && size_ + size > options_.memory_limit_)
-      _pop();
+      _evict();
 
   // If duration limit is encforced, remove elements from front of queue until duration limit would be met once message
-  // is added
-  if (options_.duration_limit_ > SnapshotterTopicOptions::NO_DURATION_LIMIT && queue_.size() != 0)
+  // is added. This also applies to messages on disk, which are the oldest.
+  if (options_.duration_limit_ > SnapshotterTopicOptions::NO_DURATION_LIMIT &&
+      (queue_.size() != 0 || spilled_.size() != 0))
   {
-    ros::Duration dt = time - queue_.front().time;
+    ros::Duration dt = time - (spilled_.empty() ? queue_.front().time : spilled_.front().time);
     while (dt > options_.duration_limit_)
     {
-      _pop();
-      if (queue_.empty())
+      _popOldest();
+      if (queue_.empty() && spilled_.empty())
         break;
-      dt = time - queue_.front().time;
+      dt = time - (spilled_.empty() ? queue_.front().time : spilled_.front().time);
     }
   }
   return true;
@@ -178,13 +322,31 @@ SnapshotMessage MessageQueue::pop()
 }
 void MessageQueue::_push(SnapshotMessage const& _out)
 {
-  int32_t size = _out.msg->size();
+  if (ring_ && !switchRing())
+  {
+    ROS_WARN_THROTTLE(1.0, "Dropping messages while both rings are still read by snapshots being written");
+    return;
+  }
+  int32_t size = _out.size;
   // If message cannot be added without violating limits, it must be dropped
   if (not preparePush(size, _out.time))
     return;
-  queue_.push_back(_out);
+  if (ring_)
+  {
+    // Copy the serialized message into the ring so the received message can be released right away
+    SnapshotMessage out(_out);
+    out.offset = allocate(size);
+    out.buffer = ring_;
+    ros::serialization::OStream stream(ring_.get() + out.offset, size);
+    _out.msg->write(stream);
+    out.msg.reset();
+    queue_.push_back(out);
+    ring_size_ += size;
+  }
+  else
+    queue_.push_back(_out);
   // Add size of new message to running count to maintain correctness
-  size_ += _out.msg->size();
+  size_ += size;
 }
 
 SnapshotMessage MessageQueue::_pop()
@@ -192,14 +354,154 @@ SnapshotMessage MessageQueue::_pop()
   SnapshotMessage tmp = queue_.front();
   queue_.pop_front();
   //  Remove size of popped message to maintain correctness of size_
-  size_ -= tmp.msg->size();
+  size_ -= tmp.size;
+  if (old_ring_msgs_ > 0)
+    old_ring_msgs_--;
+  else if (tmp.buffer)
+    ring_size_ -= tmp.size;
   return tmp;
 }
 
-MessageQueue::range_t MessageQueue::rangeFromTimes(Time const& start, Time const& stop)
+void MessageQueue::_popOldest()
+{
+  if (spilled_.empty())
+  {
+    _pop();
+    return;
+  }
+
+  SnapshotMessage const& tmp = spilled_.front();
+  spilled_size_ -= tmp.size;
+  if (old_spill_msgs_ > 0)
+    old_spill_msgs_--;
+  else
+    spill_size_ -= tmp.size;
+  spilled_.pop_front();
+}
+
+void MessageQueue::_evict()
+{
+  if (!spill_)
+  {
+    _pop();
+    return;
+  }
+
+  try
+  {
+    _spill();
+  }
+  catch (BagIOException const& err)
+  {
+    ROS_ERROR_THROTTLE(1.0, "Dropping messages which could not be moved to disk: %s", err.what());
+    _pop();
+  }
+}
+
+void MessageQueue::_spill()
+{
+  // Take up to an eighth of the ring, or at least one message, from the front of the queue as long as the messages
+  // are stored next to each other, so they are moved with a single write
+  boost::shared_array<uint8_t> buffer = queue_.front().buffer;
+  uint64_t first_offset = queue_.front().offset;
+  uint64_t max_segment = std::max(options_.memory_limit_ / 8, 1);
+  uint64_t segment = 0;
+  size_t count = 0;
+  for (queue_t::const_iterator it = queue_.begin(); it != queue_.end(); ++it, ++count)
+  {
+    if (it->buffer != buffer || it->offset != first_offset + segment)
+      break;
+    if (count > 0 && segment + it->size > max_segment)
+      break;
+    segment += it->size;
+  }
+
+  // Segments which don't fit on disk at all are dropped
+  uint64_t capacity = spill_->capacity();
+  if (segment > capacity)
+  {
+    while (count-- > 0)
+      _pop();
+    return;
+  }
+
+  // Same as in allocate(), don't overwrite a spill file which a snapshot being written may still read from. The two
+  // files take turns, so nothing is allocated here. If the spare one is still read by an earlier snapshot as well,
+  // the segment is dropped until either snapshot is done.
+  if (spill_readers_.use_count() > 1)
+  {
+    if (spare_spill_readers_.use_count() > 1)
+      throw BagIOException("both spill files are still read by snapshots being written");
+    while (!spilled_.empty() && spilled_.front().file == spare_spill_)
+      _popOldest();
+    spill_.swap(spare_spill_);
+    spill_readers_.swap(spare_spill_readers_);
+    spill_tail_ = 0;
+    spill_size_ = 0;
+    old_spill_msgs_ = spilled_.size();
+  }
+
+  uint64_t offset;
+  while (!findRingSpace(capacity, spill_size_, spill_size_ == 0 ? 0 : spilled_[old_spill_msgs_].offset, spill_tail_,
+                        segment, offset))
+    _popOldest();
+
+  spill_->write(offset, buffer.get() + first_offset, segment);
+  spill_tail_ = offset + segment;
+  while (count-- > 0)
+  {
+    SnapshotMessage msg = _pop();
+    msg.offset = offset + (msg.offset - first_offset);
+    msg.buffer.reset();
+    msg.file = spill_;
+    spilled_.push_back(msg);
+    spilled_size_ += msg.size;
+    spill_size_ += msg.size;
+  }
+}
+
+bool MessageQueue::switchRing()
+{
+  // A snapshot being written may still read from the current ring, so continue in the spare one, after removing the
+  // messages of this queue still stored there. Nothing is allocated here: if there is no spare ring, or an earlier
+  // snapshot still reads it as well, messages are dropped until a snapshot is done.
+  if (ring_readers_.use_count() > 1)
+  {
+    if (!spare_ring_ || spare_ring_readers_.use_count() > 1)
+      return false;
+    while (!queue_.empty() && queue_.front().buffer == spare_ring_)
+      _evict();
+    ring_.swap(spare_ring_);
+    ring_readers_.swap(spare_ring_readers_);
+    ring_tail_ = 0;
+    ring_size_ = 0;
+    old_ring_msgs_ = queue_.size();
+  }
+  // Once no snapshot reads the spare ring, let it go, so only one ring is kept between snapshots. Its memory is freed
+  // when the last messages of this queue stored in it are removed.
+  else if (spare_ring_ && spare_ring_readers_.use_count() == 1)
+    spare_ring_.reset();
+  return true;
+}
+
+uint32_t MessageQueue::allocate(uint32_t size)
 {
-  range_t::first_type begin = queue_.begin();
-  range_t::second_type end = queue_.end();
+  uint32_t capacity = options_.memory_limit_;
+  uint64_t offset;
+  while (!findRingSpace(capacity, ring_size_, ring_size_ == 0 ? 0 : queue_[old_ring_msgs_].offset, ring_tail_, size,
+                        offset))
+    _evict();
+
+  ring_tail_ = offset + size;
+  return offset;
+}
+
+template <typename Queue>
+static std::pair<typename Queue::const_iterator, typename Queue::const_iterator>
+queueRangeFromTimes(Queue const& queue, Time const& start, Time const& stop)
+{
+  typename Queue::const_iterator begin = queue.begin();
+  typename Queue::const_iterator end = queue.end();
 
   // Increment / Decrement iterators until time contraints are met
   if (not start.isZero())
@@ -212,12 +514,85 @@ MessageQueue::range_t MessageQueue::rangeFromTimes(Time const& start, Time const
     while (end != begin and (*(end - 1)).time > stop)
       --end;
   }
-  return range_t(begin, end);
+  return std::make_pair(begin, end);
+}
+
+MessageQueue::range_t MessageQueue::rangeFromTimes(Time const& start, Time const& stop)
+{
+  return queueRangeFromTimes(queue_, start, stop);
+}
+
+MessageQueue::range_t MessageQueue::spilledRangeFromTimes(Time const& start, Time const& stop)
+{
+  return queueRangeFromTimes(spilled_, start, stop);
+}
+
+shared_ptr<MessageQueue> MessageQueue::copy()
+{
+  // Allocate the ring that pushes continue in while the copy is written here, rather than when a message is received
+  bool need_spare;
+  {
+    boost::mutex::scoped_lock l(lock);
+    need_spare = ring_ && !spare_ring_;
+  }
+  boost::shared_array<uint8_t> spare;
+  if (need_spare)
+    spare.reset(new uint8_t[options_.memory_limit_]);
+
+  // The copy needs no ring of its own, its messages keep referencing the ring they are stored in
+  shared_ptr<MessageQueue> copied(boost::make_shared<MessageQueue>(
+      SnapshotterTopicOptions(options_.duration_limit_, SnapshotterTopicOptions::NO_MEMORY_LIMIT)));
+
+  boost::mutex::scoped_lock l(lock);
+  if (!spare_ring_)
+    spare_ring_ = spare;
+  copied->queue_ = queue_;
+  copied->size_ = size_;
+  copied->spilled_ = spilled_;
+  copied->spilled_size_ = spilled_size_;
+  // Messages left in the spare ring or spill file are the oldest ones
+  if (ring_size_ > 0)
+    copied->reading_.push_back(ring_readers_);
+  if (spare_ring_ && !queue_.empty() && queue_.front().buffer == spare_ring_)
+    copied->reading_.push_back(spare_ring_readers_);
+  if (spill_size_ > 0)
+    copied->reading_.push_back(spill_readers_);
+  if (spare_spill_ && !spilled_.empty() && spilled_.front().file == spare_spill_)
+    copied->reading_.push_back(spare_spill_readers_);
+  return copied;
+}
+
+void MessageQueue::write(rosbag::Bag& bag, string const& topic, SnapshotMessage const& msg) const
+{
+  if (msg.msg)
+  {
+    bag.write(topic, msg.time, msg.msg, msg.connection_header);
+    return;
+  }
+
+  ros::M_string const& header = *msg.connection_header;
+  ros::M_string::const_iterator type = header.find("type");
+  ros::M_string::const_iterator md5sum = header.find("md5sum");
+  ros::M_string::const_iterator msg_def = header.find("message_definition");
+  if (type == header.end() || md5sum == header.end() || msg_def == header.end())
+    throw BagException("Connection header of " + topic + " is missing the message type");
+
+  uint8_t const* data;
+  if (msg.file)
+  {
+    read_buffer_.resize(msg.size);
+    msg.file->read(msg.offset, read_buffer_.data(), msg.size);
+    data = read_buffer_.data();
+  }
+  else
+    data = msg.buffer.get() + msg.offset;
+  bag.writeRaw(topic, msg.time, type->second, md5sum->second, msg_def->second, data, msg.size, msg.connection_header);
 }
 
 const int Snapshotter::QUEUE_SIZE = 10;
 
-Snapshotter::Snapshotter(SnapshotterOptions const& options) : options_(options), recording_(true), writing_(false)
+Snapshotter::Snapshotter(SnapshotterOptions const& options)
+  : options_(options), recording_(true), writing_(false), last_success_(false), written_msgs_(0), total_msgs_(0)
 {
   status_pub_ = nh_.advertise<rosbag_msgs::SnapshotStatus>("snapshot_status", 10);
 }
@@ -228,6 +603,8 @@ void Snapshotter::fixTopicOptions(SnapshotterTopicOptions& options)
     options.duration_limit_ = options_.default_duration_limit_;
   if (options.memory_limit_ == SnapshotterTopicOptions::INHERIT_MEMORY_LIMIT)
     options.memory_limit_ = options_.default_memory_limit_;
+  if (options.spill_limit_ == SnapshotterTopicOptions::INHERIT_SPILL_LIMIT)
+    options.spill_limit_ = options_.default_spill_limit_;
 }
 
 bool Snapshotter::postfixFilename(string& file)
@@ -256,7 +633,7 @@ string Snapshotter::timeAsStr()
 void Snapshotter::topicCB(const ros::MessageEvent<topic_tools::ShapeShifter const>& msg_event,
                          boost::shared_ptr<MessageQueue> queue)
 {
-  // If recording is paused (or writing), exit
+  // If recording is paused, exit
   {
     boost::shared_lock<boost::upgrade_mutex> lock(state_lock_);
     if (!recording_)
@@ -287,45 +664,66 @@ void Snapshotter::subscribe(string const& topic, boost::shared_ptr<MessageQueue>
   queue->setSubscriber(sub);
 }
 
-bool Snapshotter::writeTopic(rosbag::Bag& bag, MessageQueue& message_queue, string const& topic,
-                            rosbag_msgs::TriggerSnapshot::Request& req, rosbag_msgs::TriggerSnapshot::Response& res)
+void Snapshotter::writeTopic(rosbag::Bag& bag, MessageQueue& message_queue, string const& topic,
+                            rosbag_msgs::TriggerSnapshot::Request const& req, boost::atomic<uint32_t>& written_msgs)
 {
   // acquire lock for this queue
   boost::mutex::scoped_lock l(message_queue.lock);
 
-  MessageQueue::range_t range = message_queue.rangeFromTimes(req.start_time, req.stop_time);
-
-  // open bag if this the first valid topic and there is data
-  if (not bag.isOpen() and range.second > range.first)
+  // write the messages on disk first, they are older than the ones in memory
+  MessageQueue::range_t ranges[] = { message_queue.spilledRangeFromTimes(req.start_time, req.stop_time),
+                                     message_queue.rangeFromTimes(req.start_time, req.stop_time) };
+  BOOST_FOREACH (MessageQueue::range_t const& range, ranges)
   {
-    try
-    {
-      bag.open(req.filename, bagmode::Write);
-    }
-    catch (rosbag::BagException const& err)
+    for (MessageQueue::range_t::first_type msg_it = range.first; msg_it != range.second; ++msg_it)
     {
-      res.success = false;
-      res.message = string("failed to open bag: ") + err.what();
-      return false;
+      message_queue.write(bag, topic, *msg_it);
+      written_msgs++;
     }
-    ROS_INFO("Writing snapshot to %s", req.filename.c_str());
   }
+}
+
+void Snapshotter::writeBuffers(rosbag::Bag& bag, buffers_t& snapshot, rosbag_msgs::TriggerSnapshot::Request const& req,
+                               boost::atomic<uint32_t>& written_msgs)
+{
+  BOOST_FOREACH (buffers_t::value_type& pair, snapshot)
+  {
+    writeTopic(bag, *(pair.second), pair.first, req, written_msgs);
+    // Release the snapshot's copy of this topic as soon as it is on disk
+    pair.second.reset();
+  }
+}
 
-  // write queue
+void Snapshotter::writeSnapshot(shared_ptr<rosbag::Bag> bag, shared_ptr<buffers_t> snapshot,
+                                rosbag_msgs::TriggerSnapshot::Request req, string write_filename)
+{
+  ros::WallTime start = ros::WallTime::now();
+  string error;
   try
   {
-    for (MessageQueue::range_t::first_type msg_it = range.first; msg_it != range.second; ++msg_it)
-    {
-      SnapshotMessage const& msg = *msg_it;
-      bag.write(topic, msg.time, msg.msg, msg.connection_header);
-    }
+    writeBuffers(*bag, *snapshot, req, written_msgs_);
+    bag->close();
+    if (rename(write_filename.c_str(), req.filename.c_str()) != 0)
+      error = "failed to rename " + write_filename + ": " + strerror(errno);
   }
   catch (rosbag::BagException const& err)
   {
-    res.success = false;
-    res.message = string("failed to write bag: ") + err.what();
+    error = err.what();
   }
-  return true;
+  // The bound arguments of write_thread_ live until it is joined at the next trigger, release the copies left after
+  // an error now
+  snapshot->clear();
+
+  if (error.empty())
+    ROS_INFO("Wrote snapshot to %s in %f seconds", req.filename.c_str(), (ros::WallTime::now() - start).toSec());
+  else
+    ROS_ERROR("Failed to write snapshot to %s: %s", req.filename.c_str(), error.c_str());
+
+  boost::unique_lock<boost::upgrade_mutex> write_lock(state_lock_);
+  writing_ = false;
+  last_filename_ = req.filename;
+  last_success_ = error.empty();
+  last_error_ = error;
 }
 
 bool Snapshotter::triggerSnapshotCb(rosbag_msgs::TriggerSnapshot::Request& req,
@@ -337,10 +735,8 @@ bool Snapshotter::triggerSnapshotCb(rosbag_msgs::TriggerSnapshot::Request& req,
     res.message = "invalid";
     return true;
   }
-  bool recording_prior;  // Store if we were recording prior to write to restore this state after write
   {
     boost::upgrade_lock<boost::upgrade_mutex> read_lock(state_lock_);
-    recording_prior = recording_;
     if (writing_)
     {
       res.success = false;
@@ -348,27 +744,24 @@ bool Snapshotter::triggerSnapshotCb(rosbag_msgs::TriggerSnapshot::Request& req,
       return true;
     }
     boost::upgrade_to_unique_lock<boost::upgrade_mutex> write_lock(read_lock);
-    if (recording_prior)
-      pause();
     writing_ = true;
   }
 
-  // Ensure that state is updated when function exits, regardlesss of branch path / exception events
-  BOOST_SCOPE_EXIT(&state_lock_, &writing_, recording_prior, this_)
+  // Clear the writing flag again unless the snapshot is handed over to the write thread
+  bool started = false;
+  BOOST_SCOPE_EXIT(&state_lock_, &writing_, &started)
   {
-    // Clear buffers beacuase time gaps (skipped messages) may have occured while paused
-    boost::unique_lock<boost::upgrade_mutex> write_lock(state_lock_);
-    // Turn off writing flag and return recording to its state before writing
-    writing_ = false;
-    if (recording_prior)
-      this_->resume();
+    if (not started)
+    {
+      boost::unique_lock<boost::upgrade_mutex> write_lock(state_lock_);
+      writing_ = false;
+    }
   }
   BOOST_SCOPE_EXIT_END
 
-  // Create bag
-  Bag bag;
-
-  // Write each selected topic's queue to bag file
+  // Copy the buffers of the selected topics. Recording carries on while the copy is written.
+  ros::WallTime copy_start = ros::WallTime::now();
+  shared_ptr<buffers_t> snapshot(boost::make_shared<buffers_t>());
   if (req.topics.size())
   {
     BOOST_FOREACH (std::string& topic, req.topics)
@@ -392,9 +785,8 @@ bool Snapshotter::triggerSnapshotCb(rosbag_msgs::TriggerSnapshot::Request& req,
         ROS_WARN("Requested topic %s is not subscribed, skipping.", topic.c_str());
         continue;
       }
-      MessageQueue& message_queue = *(*found).second;
-      if (not writeTopic(bag, message_queue, topic, req, res))
-        return true;
+      if (snapshot->find(topic) == snapshot->end())
+        (*snapshot)[topic] = (*found).second->copy();
     }
   }
   // If topic list empty, record all buffered topics
@@ -402,21 +794,51 @@ bool Snapshotter::triggerSnapshotCb(rosbag_msgs::TriggerSnapshot::Request& req,
   {
     BOOST_FOREACH (buffers_t::value_type& pair, buffers_)
     {
-      MessageQueue& message_queue = *(pair.second);
-      std::string const& topic = pair.first;
-      if (not writeTopic(bag, message_queue, topic, req, res))
-        return true;
+      (*snapshot)[pair.first] = pair.second->copy();
     }
   }
 
+  uint32_t messages = 0;
+  BOOST_FOREACH (buffers_t::value_type& pair, *snapshot)
+  {
+    MessageQueue::range_t range = pair.second->rangeFromTimes(req.start_time, req.stop_time);
+    MessageQueue::range_t spilled = pair.second->spilledRangeFromTimes(req.start_time, req.stop_time);
+    messages += (range.second - range.first) + (spilled.second - spilled.first);
+  }
+  res.copy_time = ros::Duration((ros::WallTime::now() - copy_start).toSec());
+  res.messages = messages;
+
   // If no topics were subscribed/valid/contained data, this is considered a non-success
-  if (not bag.isOpen())
+  if (messages == 0)
   {
     res.success = false;
     res.message = res.NO_DATA;
     return true;
   }
 
+  // Open the bag here so that failures are reported in the response. Like rosbag record, the bag is written
+  // with a .active suffix and only moved to its final name once complete.
+  string write_filename = req.filename + ".active";
+  shared_ptr<Bag> bag(boost::make_shared<Bag>());
+  try
+  {
+    bag->open(write_filename, bagmode::Write);
+  }
+  catch (rosbag::BagException const& err)
+  {
+    res.success = false;
+    res.message = string("failed to open bag: ") + err.what();
+    return true;
+  }
+  ROS_INFO("Writing snapshot of %u messages to %s", messages, req.filename.c_str());
+
+  written_msgs_ = 0;
+  total_msgs_ = messages;
+  if (write_thread_.joinable())
+    write_thread_.join();
+  write_thread_ = boost::thread(boost::bind(&Snapshotter::writeSnapshot, this, bag, snapshot, req, write_filename));
+  started = true;
+
   res.success = true;
   return true;
 }
@@ -445,12 +867,6 @@ void Snapshotter::resume()
 bool Snapshotter::enableCB(std_srvs::SetBool::Request& req, std_srvs::SetBool::Response& res)
 {
   boost::upgrade_lock<boost::upgrade_mutex> read_lock(state_lock_);
-  if (req.data && writing_)  // Cannot enable while writing
-  {
-    res.success = false;
-    res.message = "cannot enable recording while writing.";
-    return true;
-  }
   // Obtain write lock and update state if requested state is different from current
   if (req.data and not recording_)
   {
@@ -478,6 +894,15 @@ void Snapshotter::publishStatus(ros::TimerEvent const& e)
   {
     boost::shared_lock<boost::upgrade_mutex> lock(state_lock_);
     msg.enabled = recording_;
+    msg.writing = writing_;
+    msg.last_filename = last_filename_;
+    msg.last_success = last_success_;
+    msg.last_error = last_error_;
+  }
+  if (msg.writing)
+  {
+    msg.written_msgs = written_msgs_;
+    msg.total_msgs = total_msgs_;
   }
   std::string node_id = ros::this_node::getName();
   BOOST_FOREACH (buffers_t::value_type& pair, buffers_)
@@ -503,7 +928,15 @@ int Snapshotter::run()
     string topic = ros::names::resolve(nh_.getNamespace(), pair.first);
     fixTopicOptions(pair.second);
     shared_ptr<MessageQueue> queue;
-    queue.reset(new MessageQueue(pair.second));
+    try
+    {
+      queue.reset(new MessageQueue(pair.second, options_.spill_directory_));
+    }
+    catch (BagIOException const& err)
+    {
+      ROS_FATAL("Failed to set up buffer for %s: %s", topic.c_str(), err.what());
+      return 1;
+    }
     std::pair<buffers_t::iterator, bool> res = buffers_.insert(buffers_t::value_type(topic, queue));
     ROS_ASSERT_MSG(res.second, "failed to add %s to topics. Perhaps it is a duplicate?", topic.c_str());
     subscribe(topic, queue);
@@ -520,6 +953,10 @@ int Snapshotter::run()
   // Use multiple callback threads
   ros::MultiThreadedSpinner spinner(4);  // Use 4 threads
   spinner.spin();                        // spin() will not return until the node has been shutdown
+
+  // Let a snapshot that is still being written finish
+  if (write_thread_.joinable())
+    write_thread_.join();
   return 0;
 }
 
@@ -60,10 +60,10 @@ public:
     void writeEncryptedHeader(boost::function<void(ros::M_string const&)>, ros::M_string const& header_fields, ChunkedFile&);
     bool readEncryptedHeader(boost::function<bool(ros::Header&)>, ros::Header& header, Buffer& header_buffer, ChunkedFile&);
 
-private:
+protected:
     void buildSymmetricKey();
 
-private:
+protected:
     // User name of GPG key used for symmetric key encryption
     std::string gpg_key_user_;
     // Symmetric key for encryption/decryption
@@ -74,6 +74,35 @@ private:
     AES_KEY aes_encrypt_key_;
     AES_KEY aes_decrypt_key_;
 };
+
+//! AES-128 GCM encryption through OpenSSL EVP, which uses AES-NI where available
+/*!
+ * The symmetric key is exchanged with GPG as by AesCbcEncryptor. Chunks and headers are stored as ciphertext of the
+ * same length as the plaintext, followed by the nonce and the authentication tag, so chunks can be decrypted in place
+ * and tampering is detected.
+ */
+class AesGcmEncryptor : public AesCbcEncryptor
+{
+public:
+    static const unsigned int NONCE_SIZE = 12;
+    static const unsigned int TAG_SIZE = 16;
+
+public:
+    AesGcmEncryptor() { }
+    ~AesGcmEncryptor() { }
+
+    uint32_t encryptChunk(const uint32_t chunk_size, const uint64_t chunk_data_pos, ChunkedFile& file);
+    void decryptChunk(ChunkHeader const& chunk_header, Buffer& decrypted_chunk, ChunkedFile& file) const;
+    bool canDecryptInPlace() const { return true; }
+    void decryptChunkInPlace(ChunkHeader const& chunk_header, Buffer& chunk) const;
+    void addFieldsToFileHeader(ros::M_string& header_fields) const;
+    void writeEncryptedHeader(boost::function<void(ros::M_string const&)>, ros::M_string const& header_fields, ChunkedFile&);
+    bool readEncryptedHeader(boost::function<bool(ros::Header&)>, ros::Header& header, Buffer& header_buffer, ChunkedFile&);
+
+private:
+    void encrypt(uint8_t* data, uint32_t size) const;
+    uint32_t decrypt(uint8_t* data, uint32_t size) const;
+};
 }
 #endif
 
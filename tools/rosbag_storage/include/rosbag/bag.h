@@ -61,6 +61,8 @@
 #include <boost/config.hpp>
 #include <boost/format.hpp>
 #include <boost/iterator/iterator_facade.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
 
 #include <pluginlib/class_loader.hpp>
 
@@ -96,6 +98,11 @@ class MessageInstance;
 class View;
 class Query;
 
+//! A bag file
+/*!
+ * Messages of a bag opened for reading may be read from several threads at once, for example with a View per
+ * thread. Writing is not thread-safe.
+ */
 class ROSBAG_STORAGE_DECL Bag
 {
     friend class MessageInstance;
@@ -139,11 +146,37 @@ public:
     uint32_t        getMinorVersion() const;                      //!< Get the minor-version of the open bag file
     uint64_t        getSize()         const;                      //!< Get the current size of the bag file (a lower bound)
 
+    //! Summarize a bag file without loading the index of every message
+    /*!
+     * \param filename The bag file to summarize
+     * \param exact    Load the message indexes for exact time bounds of each connection
+     *
+     * Message counts are always exact. Unless exact is set, the time bounds of each connection are those of the
+     * chunks holding its messages. Sizes are estimated from the space the chunks take up in the file, split by
+     * message count. Version 1.2 bags have no chunk information and are always summarized exactly.
+     *
+     * Can throw BagException
+     */
+    static BagSummary summarize(std::string const& filename, bool exact = false);
+
+    //! Summarize the bag file opened for reading, from its message indexes
+    BagSummary getSummary() const;
+
     void            setCompression(CompressionType compression);  //!< Set the compression method to use for writing chunks
     CompressionType getCompression() const;                       //!< Get the compression method to use for writing chunks
     void            setChunkThreshold(uint32_t chunk_threshold);  //!< Set the threshold for creating new chunks
     uint32_t        getChunkThreshold() const;                    //!< Get the threshold for creating new chunks
 
+    //! Reserve disk space for the bag file to grow to size bytes
+    /*!
+     * \param size The number of bytes to reserve, counted from the start of the file
+     * \return false if the platform or file system can't reserve space
+     *
+     * The file keeps its size, so the bag stays valid while it is written. Reserved space the bag hasn't grown into
+     * is released when it is closed. Can throw BagException
+     */
+    bool            preallocate(uint64_t size);
+
     //! Set encryptor of the bag file
     /*!
      * \param plugin_name The name of the encryptor plugin
@@ -203,6 +236,26 @@ public:
     void write(std::string const& topic, ros::Time const& time, boost::shared_ptr<T> const& msg,
                boost::shared_ptr<ros::M_string> connection_header = boost::shared_ptr<ros::M_string>());
 
+    //! Write an already serialized message into the bag file
+    /*!
+     * \param topic    The topic name
+     * \param time     Timestamp of the message
+     * \param datatype The message datatype
+     * \param md5sum   The message md5sum
+     * \param msg_def  The full text of the message definition
+     * \param data     The serialized message
+     * \param size     The size of the serialized message in bytes
+     * \param connection_header  A connection header.
+     *
+     * The serialized bytes are appended to the current chunk as-is, without
+     * going through ros::serialization.
+     *
+     * Can throw BagIOException
+     */
+    void writeRaw(std::string const& topic, ros::Time const& time, std::string const& datatype,
+                  std::string const& md5sum, std::string const& msg_def, uint8_t const* data, uint32_t size,
+                  boost::shared_ptr<ros::M_string> connection_header = boost::shared_ptr<ros::M_string>());
+
     void swap(Bag&);
 
     bool isOpen() const;
@@ -214,6 +267,19 @@ private:
 
     void init();
 
+    //! Buffers for reading messages. Each thread reading from the bag has its own, until the bag is closed.
+    struct ReadContext
+    {
+        ReadContext();
+
+        uint64_t decompressed_chunk;  //!< position of the chunk in decompress_buffer
+        Buffer   chunk_buffer;        //!< reusable buffer to read chunk into
+        Buffer   decompress_buffer;   //!< reusable buffer to decompress chunks into
+        Buffer   record_buffer;       //!< reusable buffer in which to read 1.2 message data records
+    };
+
+    ReadContext& getReadContext() const;
+
     // This helper function actually does the write with an arbitrary serializable message
     template<class T>
     void doWrite(std::string const& topic, ros::Time const& time, T const& msg, boost::shared_ptr<ros::M_string> const& connection_header);
@@ -225,7 +291,7 @@ private:
     void closeWrite();
 
     template<class T>
-    boost::shared_ptr<T> instantiateBuffer(IndexEntry const& index_entry) const;  //!< deserializes the message held in record_buffer_
+    boost::shared_ptr<T> instantiateBuffer(IndexEntry const& index_entry) const;  //!< deserializes the message of index_entry
 
     void startWriting();
     void stopWriting();
@@ -239,8 +305,18 @@ private:
     void writeFileHeaderRecord();
     void writeConnectionRecord(ConnectionInfo const* connection_info, const bool encrypt);
     void appendConnectionRecordToBuffer(Buffer& buf, ConnectionInfo const* connection_info);
+    uint32_t startWritingMessage(std::string const& topic, ros::Time const& time,
+                                 boost::shared_ptr<ros::M_string> const& connection_header, ConnectionInfo*& connection_info);
+    uint32_t lookupConnectionId(std::string const& topic, boost::shared_ptr<ros::M_string> const& connection_header,
+                                ConnectionInfo*& connection_info);
+    ConnectionInfo* addConnection(uint32_t conn_id, std::string const& topic, std::string const& datatype,
+                                  std::string const& md5sum, std::string const& msg_def,
+                                  boost::shared_ptr<ros::M_string> const& connection_header);
     template<class T>
     void writeMessageDataRecord(uint32_t conn_id, ros::Time const& time, T const& msg);
+    void writeMessageDataRecord(uint32_t conn_id, ros::Time const& time, uint8_t const* data, uint32_t data_len);
+    uint32_t startMessageDataRecord(uint32_t conn_id, ros::Time const& time, uint32_t data_len);
+    void stopMessageDataRecord(uint32_t record_offset, uint32_t conn_id, ros::Time const& time);
     void writeIndexRecords();
     void writeConnectionRecords();
     void writeChunkInfoRecords();
@@ -254,12 +330,15 @@ private:
     void readFileHeaderRecord();
     void readConnectionRecord();
     void readChunkHeader(ChunkHeader& chunk_header) const;
+    void readChunkHeaderFields(ros::M_string& fields, ChunkHeader& chunk_header) const;
+    void readChunk(uint64_t chunk_pos, ChunkHeader& chunk_header, Buffer& chunk) const;
     void readChunkInfoRecord();
+    void summarizeChunks(BagSummary& summary) const;
     void readConnectionIndexRecord200();
 
     void readTopicIndexRecord102();
     void readMessageDefinitionRecord102();
-    void readMessageDataRecord102(uint64_t offset, ros::Header& header) const;
+    void readMessageDataRecord102(uint64_t offset, ros::Header& header, Buffer& record_buffer) const;
 
     ros::Header readMessageDataHeader(IndexEntry const& index_entry);
     uint32_t    readMessageDataSize(IndexEntry const& index_entry) const;
@@ -267,10 +346,10 @@ private:
     template<typename Stream>
     void readMessageDataIntoStream(IndexEntry const& index_entry, Stream& stream) const;
 
-    void     decompressChunk(uint64_t chunk_pos) const;
-    void     decompressRawChunk(ChunkHeader const& chunk_header) const;
-    void     decompressBz2Chunk(ChunkHeader const& chunk_header) const;
-    void     decompressLz4Chunk(ChunkHeader const& chunk_header) const;
+    Buffer*  decompressChunk(uint64_t chunk_pos) const;
+    void     decompressRawChunk(ChunkHeader const& chunk_header, ReadContext& context) const;
+    void     decompressBz2Chunk(ChunkHeader const& chunk_header, ReadContext& context) const;
+    void     decompressLz4Chunk(ChunkHeader const& chunk_header, ReadContext& context) const;
     uint32_t getChunkOffset() const;
 
     // Record header I/O
@@ -282,6 +361,7 @@ private:
 
     void readHeaderFromBuffer(Buffer& buffer, uint32_t offset, ros::Header& header, uint32_t& data_size, uint32_t& bytes_read) const;
     void readMessageDataHeaderFromBuffer(Buffer& buffer, uint32_t offset, ros::Header& header, uint32_t& data_size, uint32_t& bytes_read) const;
+    void readMessageDataFieldsFromBuffer(Buffer& buffer, uint32_t offset, uint32_t& connection_id, ros::Time& time, uint32_t& data_size, uint32_t& bytes_read) const;
     bool readHeader(ros::Header& header) const;
     bool readDataLength(uint32_t& data_size) const;
     bool isOp(ros::M_string& fields, uint8_t reqOp) const;
@@ -310,6 +390,7 @@ private:
     void write(std::string const& s);
     void read(char* b, std::streamsize n) const;
     void seek(uint64_t pos, int origin = std::ios_base::beg) const;
+    void seekToEnd();
 
 private:
     BagMode             mode_;
@@ -320,6 +401,7 @@ private:
     uint32_t            bag_revision_;
 
     uint64_t file_size_;
+    mutable bool at_end_;          //!< file_ is still at the end of the file, where the last write left it
     uint64_t file_header_pos_;
     uint64_t index_data_pos_;
     uint32_t connection_count_;
@@ -332,6 +414,7 @@ private:
 
     std::map<std::string, uint32_t>                topic_connection_ids_;
     std::map<ros::M_string, uint32_t>              header_connection_ids_;
+    std::map<std::string, std::pair<boost::shared_ptr<ros::M_string>, uint32_t> > last_header_connection_ids_;  //!< last connection header written on each topic, and its connection id
     std::map<uint32_t, ConnectionInfo*>            connections_;
 
     std::vector<ChunkInfo>                         chunks_;
@@ -340,16 +423,12 @@ private:
     std::map<uint32_t, std::multiset<IndexEntry> > curr_chunk_connection_indexes_;
 
     mutable Buffer   header_buffer_;           //!< reusable buffer in which to assemble the record header before writing to file
-    mutable Buffer   record_buffer_;           //!< reusable buffer in which to assemble the record data before writing to file
-
-    mutable Buffer   chunk_buffer_;            //!< reusable buffer to read chunk into
-    mutable Buffer   decompress_buffer_;       //!< reusable buffer to decompress chunks into
 
     mutable Buffer   outgoing_chunk_buffer_;   //!< reusable buffer to read chunk into
 
-    mutable Buffer*  current_buffer_;
-
-    mutable uint64_t decompressed_chunk_;      //!< position of decompressed chunk
+    mutable std::map<boost::thread::id, boost::shared_ptr<ReadContext> > read_contexts_;  //!< read buffers of each thread, freed on close()
+    mutable boost::mutex file_mutex_;          //!< locks reads through file_ and header_buffer_ after the bag is opened, and read_contexts_
+    bool                 encrypted_;           //!< chunks are encrypted, so must be decrypted by the encryptor
 
     // Encryptor plugin loader
     pluginlib::ClassLoader<rosbag::EncryptorBase> encryptor_loader_;
@@ -408,18 +487,21 @@ void Bag::readMessageDataIntoStream(IndexEntry const& index_entry, Stream& strea
     {
     case 200:
     {
-        decompressChunk(index_entry.chunk_pos);
-        readMessageDataHeaderFromBuffer(*current_buffer_, index_entry.offset, header, data_size, bytes_read);
+        Buffer* buffer = decompressChunk(index_entry.chunk_pos);
+        uint32_t connection_id;
+        ros::Time time;
+        readMessageDataFieldsFromBuffer(*buffer, index_entry.offset, connection_id, time, data_size, bytes_read);
         if (data_size > 0)
-            memcpy(stream.advance(data_size), current_buffer_->getData() + index_entry.offset + bytes_read, data_size);
+            memcpy(stream.advance(data_size), buffer->getData() + index_entry.offset + bytes_read, data_size);
         break;
     }
     case 102:
     {
-        readMessageDataRecord102(index_entry.chunk_pos, header);
-        data_size = record_buffer_.getSize();
+        Buffer& record_buffer = getReadContext().record_buffer;
+        readMessageDataRecord102(index_entry.chunk_pos, header, record_buffer);
+        data_size = record_buffer.getSize();
         if (data_size > 0)
-            memcpy(stream.advance(data_size), record_buffer_.getData(), data_size);
+            memcpy(stream.advance(data_size), record_buffer.getData(), data_size);
         break;
     }
     default:
@@ -433,17 +515,14 @@ boost::shared_ptr<T> Bag::instantiateBuffer(IndexEntry const& index_entry) const
     {
     case 200:
 	{
-        decompressChunk(index_entry.chunk_pos);
+        Buffer* buffer = decompressChunk(index_entry.chunk_pos);
 
-        // Read the message header
-        ros::Header header;
+        // Read the connection id from the message header
+        uint32_t connection_id;
+        ros::Time time;
         uint32_t data_size;
         uint32_t bytes_read;
-        readMessageDataHeaderFromBuffer(*current_buffer_, index_entry.offset, header, data_size, bytes_read);
-
-        // Read the connection id from the header
-        uint32_t connection_id;
-        readField(*header.getValues(), CONNECTION_FIELD_NAME, true, &connection_id);
+        readMessageDataFieldsFromBuffer(*buffer, index_entry.offset, connection_id, time, data_size, bytes_read);
 
         std::map<uint32_t, ConnectionInfo*>::const_iterator connection_iter = connections_.find(connection_id);
         if (connection_iter == connections_.end())
@@ -458,7 +537,7 @@ boost::shared_ptr<T> Bag::instantiateBuffer(IndexEntry const& index_entry) const
         ros::serialization::PreDeserialize<T>::notify(predes_params);
 
         // Deserialize the message
-        ros::serialization::IStream s(current_buffer_->getData() + index_entry.offset + bytes_read, data_size);
+        ros::serialization::IStream s(buffer->getData() + index_entry.offset + bytes_read, data_size);
         ros::serialization::deserialize(s, *p);
 
         return p;
@@ -467,7 +546,8 @@ boost::shared_ptr<T> Bag::instantiateBuffer(IndexEntry const& index_entry) const
 	{
         // Read the message record
         ros::Header header;
-        readMessageDataRecord102(index_entry.chunk_pos, header);
+        Buffer& record_buffer = getReadContext().record_buffer;
+        readMessageDataRecord102(index_entry.chunk_pos, header, record_buffer);
 
         ros::M_string& fields = *header.getValues();
 
@@ -502,7 +582,7 @@ boost::shared_ptr<T> Bag::instantiateBuffer(IndexEntry const& index_entry) const
         ros::serialization::PreDeserialize<T>::notify(predes_params);
 
         // Deserialize the message
-        ros::serialization::IStream s(record_buffer_.getData(), record_buffer_.getSize());
+        ros::serialization::IStream s(record_buffer.getData(), record_buffer.getSize());
         ros::serialization::deserialize(s, *p);
 
         return p;
@@ -514,158 +594,29 @@ boost::shared_ptr<T> Bag::instantiateBuffer(IndexEntry const& index_entry) const
 
 template<class T>
 void Bag::doWrite(std::string const& topic, ros::Time const& time, T const& msg, boost::shared_ptr<ros::M_string> const& connection_header) {
-
-    if (time < ros::TIME_MIN)
-    {
-        throw BagException("Tried to insert a message with time less than ros::TIME_MIN");
-    }
-
-    // Whenever we write we increment our revision
-    bag_revision_++;
-
-    // Get ID for connection header
     ConnectionInfo* connection_info = NULL;
-    uint32_t conn_id = 0;
-    if (!connection_header) {
-        // No connection header: we'll manufacture one, and store by topic
-
-        std::map<std::string, uint32_t>::iterator topic_connection_ids_iter = topic_connection_ids_.find(topic);
-        if (topic_connection_ids_iter == topic_connection_ids_.end()) {
-            conn_id = connections_.size();
-            topic_connection_ids_[topic] = conn_id;
-        }
-        else {
-            conn_id = topic_connection_ids_iter->second;
-            connection_info = connections_[conn_id];
-        }
-    }
-    else {
-        // Store the connection info by the address of the connection header
-
-        // Add the topic name to the connection header, so that when we later search by 
-        // connection header, we can disambiguate connections that differ only by topic name (i.e.,
-        // same callerid, same message type), #3755.  This modified connection header is only used
-        // for our bookkeeping, and will not appear in the resulting .bag.
-        ros::M_string connection_header_copy(*connection_header);
-        connection_header_copy["topic"] = topic;
-
-        std::map<ros::M_string, uint32_t>::iterator header_connection_ids_iter = header_connection_ids_.find(connection_header_copy);
-        if (header_connection_ids_iter == header_connection_ids_.end()) {
-            conn_id = connections_.size();
-            header_connection_ids_[connection_header_copy] = conn_id;
-        }
-        else {
-            conn_id = header_connection_ids_iter->second;
-            connection_info = connections_[conn_id];
-        }
-    }
+    uint32_t conn_id = startWritingMessage(topic, time, connection_header, connection_info);
 
-    {
-        // Seek to the end of the file (needed in case previous operation was a read)
-        seek(0, std::ios::end);
-        file_size_ = file_.getOffset();
-
-        // Write the chunk header if we're starting a new chunk
-        if (!chunk_open_)
-            startWritingChunk(time);
-
-        // Write connection info record, if necessary
-        if (connection_info == NULL) {
-            connection_info = new ConnectionInfo();
-            connection_info->id       = conn_id;
-            connection_info->topic    = topic;
-            connection_info->datatype = std::string(ros::message_traits::datatype(msg));
-            connection_info->md5sum   = std::string(ros::message_traits::md5sum(msg));
-            connection_info->msg_def  = std::string(ros::message_traits::definition(msg));
-            if (connection_header != NULL) {
-                connection_info->header = connection_header;
-            }
-            else {
-                connection_info->header = boost::make_shared<ros::M_string>();
-                (*connection_info->header)["type"]               = connection_info->datatype;
-                (*connection_info->header)["md5sum"]             = connection_info->md5sum;
-                (*connection_info->header)["message_definition"] = connection_info->msg_def;
-            }
-            connections_[conn_id] = connection_info;
-            // No need to encrypt connection records in chunks
-            writeConnectionRecord(connection_info, false);
-            appendConnectionRecordToBuffer(outgoing_chunk_buffer_, connection_info);
-        }
-
-        // Add to topic indexes
-        IndexEntry index_entry;
-        index_entry.time      = time;
-        index_entry.chunk_pos = curr_chunk_info_.pos;
-        index_entry.offset    = getChunkOffset();
-
-        std::multiset<IndexEntry>& chunk_connection_index = curr_chunk_connection_indexes_[connection_info->id];
-        chunk_connection_index.insert(chunk_connection_index.end(), index_entry);
-        std::multiset<IndexEntry>& connection_index = connection_indexes_[connection_info->id];
-        connection_index.insert(connection_index.end(), index_entry);
-
-        // Increment the connection count
-        curr_chunk_info_.connection_counts[connection_info->id]++;
-
-        // Write the message data
-        writeMessageDataRecord(conn_id, time, msg);
-
-        // Check if we want to stop this chunk
-        uint32_t chunk_size = getChunkOffset();
-        CONSOLE_BRIDGE_logDebug("  curr_chunk_size=%d (threshold=%d)", chunk_size, chunk_threshold_);
-        if (chunk_size > chunk_threshold_) {
-            // Empty the outgoing chunk
-            stopWritingChunk();
-            outgoing_chunk_buffer_.setSize(0);
-
-            // We no longer have a valid curr_chunk_info
-            curr_chunk_info_.pos = -1;
-        }
-    }
+    // Write connection info record, if necessary
+    if (connection_info == NULL)
+        addConnection(conn_id, topic, ros::message_traits::datatype(msg), ros::message_traits::md5sum(msg),
+                      ros::message_traits::definition(msg), connection_header);
+
+    writeMessageDataRecord(conn_id, time, msg);
 }
 
 template<class T>
 void Bag::writeMessageDataRecord(uint32_t conn_id, ros::Time const& time, T const& msg) {
-    ros::M_string header;
-    header[OP_FIELD_NAME]         = toHeaderString(&OP_MSG_DATA);
-    header[CONNECTION_FIELD_NAME] = toHeaderString(&conn_id);
-    header[TIME_FIELD_NAME]       = toHeaderString(&time);
-
-    // Assemble message in memory first, because we need to write its length
     uint32_t msg_ser_len = ros::serialization::serializationLength(msg);
 
-    record_buffer_.setSize(msg_ser_len);
-    
-    ros::serialization::OStream s(record_buffer_.getData(), msg_ser_len);
+    // Serialize the message straight into the outgoing chunk, after its record header
+    uint32_t record_offset = outgoing_chunk_buffer_.getSize();
+    uint32_t data_offset   = startMessageDataRecord(conn_id, time, msg_ser_len);
 
-    // todo: serialize into the outgoing_chunk_buffer & remove record_buffer_
+    ros::serialization::OStream s(outgoing_chunk_buffer_.getData() + data_offset, msg_ser_len);
     ros::serialization::serialize(s, msg);
 
-    // We do an extra seek here since writing our data record may
-    // have indirectly moved our file-pointer if it was a
-    // MessageInstance for our own bag
-    seek(0, std::ios::end);
-    file_size_ = file_.getOffset();
-
-    CONSOLE_BRIDGE_logDebug("Writing MSG_DATA [%llu:%d]: conn=%d sec=%d nsec=%d data_len=%d",
-              (unsigned long long) file_.getOffset(), getChunkOffset(), conn_id, time.sec, time.nsec, msg_ser_len);
-
-    writeHeader(header);
-    writeDataLength(msg_ser_len);
-    write((char*) record_buffer_.getData(), msg_ser_len);
-    
-    // todo: use better abstraction than appendHeaderToBuffer
-    appendHeaderToBuffer(outgoing_chunk_buffer_, header);
-    appendDataLengthToBuffer(outgoing_chunk_buffer_, msg_ser_len);
-
-    uint32_t offset = outgoing_chunk_buffer_.getSize();
-    outgoing_chunk_buffer_.setSize(outgoing_chunk_buffer_.getSize() + msg_ser_len);
-    memcpy(outgoing_chunk_buffer_.getData() + offset, record_buffer_.getData(), msg_ser_len);
-    
-    // Update the current chunk time range
-    if (time > curr_chunk_info_.end_time)
-    	curr_chunk_info_.end_time = time;
-    else if (time < curr_chunk_info_.start_time)
-        curr_chunk_info_.start_time = time;
+    stopMessageDataRecord(record_offset, conn_id, time);
 }
 
 inline void swap(Bag& a, Bag& b) {
@@ -75,8 +75,14 @@ public:
     void        write(std::string const& s);
     void        write(void* ptr, size_t size);                          //!< write size bytes from ptr to the file
     void        read(void* ptr, size_t size);                           //!< read size bytes from the file into ptr
+#ifndef _WIN32
+    //! read size bytes at offset into ptr, without using or moving the current position. May be called from several threads.
+    void        readAt(uint64_t offset, void* ptr, size_t size) const;
+#endif
     std::string getline();
     bool        truncate(uint64_t length);
+    //! reserve disk space for the file to grow to length bytes without changing its size; false if unsupported
+    bool        preallocate(uint64_t length);
     void        seek(uint64_t offset, int origin = std::ios_base::beg); //!< seek to given offset from origin
     void        decompress(CompressionType compression, uint8_t* dest, unsigned int dest_len, uint8_t* source, unsigned int source_len);
     void        swap(ChunkedFile& other);
@@ -95,6 +101,7 @@ private:
     uint64_t    compressed_in_;  //!< number of bytes written to current compressed stream
     char*       unused_;         //!< extra data read by compressed stream
     int         nUnused_;        //!< number of bytes of extra data read by compressed stream
+    bool        preallocated_;   //!< space beyond the end of the file has been reserved, to be released on close
 
     boost::shared_ptr<StreamFactory> stream_factory_;
 
@@ -37,6 +37,7 @@
 
 #include "rosbag/buffer.h"
 #include "rosbag/chunked_file.h"
+#include "rosbag/exceptions.h"
 #include "rosbag/structures.h"
 
 #include "ros/header.h"
@@ -90,6 +91,23 @@ public:
      */
     virtual void decryptChunk(ChunkHeader const& chunk_header, Buffer& decrypted_chunk, ChunkedFile& file) const = 0;
 
+    //! Whether chunks can be decrypted with decryptChunkInPlace
+    virtual bool canDecryptInPlace() const { return false; }
+
+    //! Decrypt chunk already read from bag file
+    /*!
+     * \param chunk_header The header of the encrypted chunk
+     * \param chunk The encrypted chunk, which is replaced by the decrypted chunk
+     *
+     * Unlike decryptChunk, this method doesn't use the file stream, so chunks can be read and decrypted from several
+     * threads at once. It is only called if canDecryptInPlace returns true.
+     */
+    virtual void decryptChunkInPlace(ChunkHeader const& chunk_header, Buffer& chunk) const {
+        (void) chunk_header;
+        (void) chunk;
+        throw BagException("Encryptor cannot decrypt chunks in place");
+    }
+
     //! Add encryptor information to bag file header
     /*!
      * \param header_fields The header fields of the bag
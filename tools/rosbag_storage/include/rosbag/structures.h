@@ -73,6 +73,44 @@ struct ROSBAG_STORAGE_DECL ChunkHeader
     uint32_t    uncompressed_size;    //! uncompressed size of the chunk in bytes
 };
 
+struct ROSBAG_STORAGE_DECL ConnectionSummary
+{
+    ConnectionSummary() : id(-1), message_count(0), size(0) { }
+
+    uint32_t    id;
+    std::string topic;
+    std::string datatype;
+    std::string md5sum;
+
+    uint32_t    message_count;    //! number of messages in the connection
+    ros::Time   start_time;       //! earliest timestamp of a message, or of a chunk holding one unless the summary is exact
+    ros::Time   end_time;         //! latest timestamp of a message, or of a chunk holding one unless the summary is exact
+    uint64_t    size;             //! approximate number of bytes the messages take up in the bag file
+
+    //! Average number of messages per second, or 0 if there are fewer than two
+    double getFrequency() const {
+        double duration = (end_time - start_time).toSec();
+        return message_count > 1 && duration > 0.0 ? (message_count - 1) / duration : 0.0;
+    }
+};
+
+struct ROSBAG_STORAGE_DECL BagSummary
+{
+    BagSummary() : exact(false), version(0), size(0), message_count(0), chunk_count(0) { }
+
+    bool        exact;            //! whether the time bounds were read from the message indexes
+    uint32_t    version;          //! bag file version, e.g. 200 for 2.0
+    uint64_t    size;             //! size of the bag file in bytes
+    uint64_t    message_count;    //! number of messages in the bag
+    uint32_t    chunk_count;      //! number of chunks in the bag
+    ros::Time   start_time;       //! earliest timestamp of a message
+    ros::Time   end_time;         //! latest timestamp of a message
+
+    std::map<uint32_t, ConnectionSummary> connections;   //! summary of each connection, by connection id
+
+    ros::Duration getDuration() const { return end_time - start_time; }
+};
+
 struct ROSBAG_STORAGE_DECL IndexEntry
 {
     ros::Time time;            //! timestamp of the message
@@ -35,6 +35,9 @@
 #ifndef ROSBAG_VIEW_H
 #define ROSBAG_VIEW_H
 
+#include <vector>
+
+#include <boost/bind.hpp>
 #include <boost/function.hpp>
 #include <boost/iterator/iterator_facade.hpp>
 
@@ -150,7 +153,32 @@ public:
 
     ros::Time getBeginTime();
     ros::Time getEndTime();
-  
+
+    //! Call a function for every message of the view from several threads, in no particular order
+    /*!
+     * param f               Called with the index of the calling thread, in [0, threads), and the message
+     * param threads         The number of threads to use, or 0 for one per hardware thread
+     * param per_connection  Pass the messages of each connection in time order, from one thread at a time
+     *
+     * By default the messages are handed out by chunk, so each chunk is read and decompressed by one thread only.
+     * Exceptions thrown by f stop the remaining work and are rethrown to the caller.
+     */
+    void parallelForEach(boost::function<void(uint32_t, MessageInstance const&)> const& f, uint32_t threads = 0,
+                         bool per_connection = false);
+
+    //! Map every message of the view to a result of type T from several threads, and reduce the results
+    /*!
+     * param map             Adds a message to the partial result of a thread
+     * param reduce          Merges the partial result of a thread, the second argument, into the first
+     * param init            The initial value of the partial results and of the returned result
+     *
+     * See parallelForEach for the other parameters.
+     */
+    template<class T>
+    T parallelMapReduce(boost::function<void(T&, MessageInstance const&)> const& map,
+                        boost::function<void(T&, T const&)> const& reduce, T const& init = T(),
+                        uint32_t threads = 0, bool per_connection = false);
+
 protected:
     friend class iterator;
 
@@ -163,6 +191,12 @@ private:
     View(View const& view);
     View& operator=(View const& view);
 
+    static uint32_t getThreadCount(uint32_t threads);
+
+    template<class T>
+    static void mapInto(std::vector<T>* results, boost::function<void(T&, MessageInstance const&)> const& map,
+                        uint32_t thread, MessageInstance const& m);
+
 protected:
     std::vector<MessageRange*> ranges_;
     std::vector<BagQuery*>     queries_;
@@ -174,6 +208,27 @@ protected:
     bool reduce_overlap_;
 };
 
+template<class T>
+void View::mapInto(std::vector<T>* results, boost::function<void(T&, MessageInstance const&)> const& map,
+                   uint32_t thread, MessageInstance const& m) {
+    map((*results)[thread], m);
+}
+
+template<class T>
+T View::parallelMapReduce(boost::function<void(T&, MessageInstance const&)> const& map,
+                          boost::function<void(T&, T const&)> const& reduce, T const& init,
+                          uint32_t threads, bool per_connection) {
+    threads = getThreadCount(threads);
+
+    std::vector<T> results(threads, init);
+    parallelForEach(boost::bind(&View::mapInto<T>, &results, boost::cref(map), _1, _2), threads, per_connection);
+
+    T result(init);
+    for (typename std::vector<T>::const_iterator i = results.begin(); i != results.end(); ++i)
+        reduce(result, *i);
+    return result;
+}
+
 } // namespace rosbag
 
 #endif
@@ -36,11 +36,17 @@
 #include "rosbag/aes_encryptor.h"
 #include "rosbag/gpgme_utils.h"
 
+#include <algorithm>
+
+#include <openssl/evp.h>
 #include <openssl/rand.h>
 
+#include <boost/shared_ptr.hpp>
+
 #include <pluginlib/class_list_macros.hpp>
 
 PLUGINLIB_EXPORT_CLASS(rosbag::AesCbcEncryptor, rosbag::EncryptorBase)
+PLUGINLIB_EXPORT_CLASS(rosbag::AesGcmEncryptor, rosbag::EncryptorBase)
 
 namespace rosbag
 {
@@ -323,4 +329,146 @@ void AesCbcEncryptor::buildSymmetricKey() {
     encrypted_symmetric_key_ = encryptStringGpg(gpg_key_user_, symmetric_key_);
 }
 
+// AesGcmEncryptor
+
+const unsigned int AesGcmEncryptor::NONCE_SIZE;
+const unsigned int AesGcmEncryptor::TAG_SIZE;
+
+// EVP takes int lengths, so longer data is passed in pieces
+static const uint32_t MAX_EVP_UPDATE_SIZE = 1 << 30;
+
+static boost::shared_ptr<EVP_CIPHER_CTX> newCipherContext() {
+    boost::shared_ptr<EVP_CIPHER_CTX> ctx(EVP_CIPHER_CTX_new(), EVP_CIPHER_CTX_free);
+    if (!ctx) {
+        throw BagException("Failed to create a cipher context");
+    }
+    return ctx;
+}
+
+//! Encrypt data in place
+/*!
+ * \param data The buffer holding size bytes of data, followed by room for the nonce and the tag
+ * \param size The byte size of the data
+ */
+void AesGcmEncryptor::encrypt(uint8_t* data, uint32_t size) const {
+    if (symmetric_key_.length() != AES_BLOCK_SIZE) {
+        throw BagException("No symmetric key to encrypt with");
+    }
+    uint8_t* nonce = data + size;
+    uint8_t* tag = nonce + NONCE_SIZE;
+    // Nonces are random, as chunks of a bag being appended to are encrypted by another instance with the same key
+    if (!RAND_bytes(nonce, NONCE_SIZE)) {
+        throw BagException("Failed to build nonce");
+    }
+
+    boost::shared_ptr<EVP_CIPHER_CTX> ctx = newCipherContext();
+    if (!EVP_EncryptInit_ex(ctx.get(), EVP_aes_128_gcm(), NULL, NULL, NULL) ||
+        !EVP_CIPHER_CTX_ctrl(ctx.get(), EVP_CTRL_GCM_SET_IVLEN, NONCE_SIZE, NULL) ||
+        !EVP_EncryptInit_ex(ctx.get(), NULL, NULL, &symmetric_key_[0], nonce)) {
+        throw BagException("Failed to initialize AES-GCM encryption");
+    }
+    for (uint32_t done = 0; done < size; ) {
+        int len = std::min(size - done, MAX_EVP_UPDATE_SIZE);
+        if (!EVP_EncryptUpdate(ctx.get(), data + done, &len, data + done, len)) {
+            throw BagException("Failed to encrypt with AES-GCM");
+        }
+        done += len;
+    }
+    int len = 0;
+    if (!EVP_EncryptFinal_ex(ctx.get(), data + size, &len) ||
+        !EVP_CIPHER_CTX_ctrl(ctx.get(), EVP_CTRL_GCM_GET_TAG, TAG_SIZE, tag)) {
+        throw BagException("Failed to finish AES-GCM encryption");
+    }
+}
+
+//! Decrypt data in place
+/*!
+ * \return The byte size of the decrypted data
+ * \param data The encrypted data, followed by the nonce and the tag
+ * \param size The byte size of the encrypted data, the nonce and the tag
+ */
+uint32_t AesGcmEncryptor::decrypt(uint8_t* data, uint32_t size) const {
+    if (size < NONCE_SIZE + TAG_SIZE) {
+        throw BagFormatException((boost::format("No nonce and tag in encrypted data: %d") % size).str());
+    }
+    size -= NONCE_SIZE + TAG_SIZE;
+    uint8_t const* nonce = data + size;
+    uint8_t const* tag = nonce + NONCE_SIZE;
+
+    boost::shared_ptr<EVP_CIPHER_CTX> ctx = newCipherContext();
+    if (!EVP_DecryptInit_ex(ctx.get(), EVP_aes_128_gcm(), NULL, NULL, NULL) ||
+        !EVP_CIPHER_CTX_ctrl(ctx.get(), EVP_CTRL_GCM_SET_IVLEN, NONCE_SIZE, NULL) ||
+        !EVP_DecryptInit_ex(ctx.get(), NULL, NULL, &symmetric_key_[0], nonce)) {
+        throw BagException("Failed to initialize AES-GCM decryption");
+    }
+    for (uint32_t done = 0; done < size; ) {
+        int len = std::min(size - done, MAX_EVP_UPDATE_SIZE);
+        if (!EVP_DecryptUpdate(ctx.get(), data + done, &len, data + done, len)) {
+            throw BagException("Failed to decrypt with AES-GCM");
+        }
+        done += len;
+    }
+    int len = 0;
+    if (!EVP_CIPHER_CTX_ctrl(ctx.get(), EVP_CTRL_GCM_SET_TAG, TAG_SIZE, const_cast<uint8_t*>(tag)) ||
+        EVP_DecryptFinal_ex(ctx.get(), data + size, &len) <= 0) {
+        throw BagFormatException("Encrypted data failed authentication");
+    }
+    return size;
+}
+
+uint32_t AesGcmEncryptor::encryptChunk(const uint32_t chunk_size, const uint64_t chunk_data_pos, ChunkedFile& file) {
+    // Read existing (compressed) chunk, leaving room for the nonce and the tag
+    std::basic_string<unsigned char> chunk(chunk_size + NONCE_SIZE + TAG_SIZE, 0);
+    file.seek(chunk_data_pos);
+    file.read((char*) &chunk[0], chunk_size);
+    encrypt(&chunk[0], chunk_size);
+    // Write encrypted chunk over the original one
+    file.seek(chunk_data_pos);
+    file.write((char*) &chunk[0], chunk.length());
+    return chunk.length();
+}
+
+void AesGcmEncryptor::decryptChunk(ChunkHeader const& chunk_header, Buffer& decrypted_chunk, ChunkedFile& file) const {
+    decrypted_chunk.setSize(chunk_header.compressed_size);
+    file.read((char*) decrypted_chunk.getData(), chunk_header.compressed_size);
+    decryptChunkInPlace(chunk_header, decrypted_chunk);
+}
+
+void AesGcmEncryptor::decryptChunkInPlace(ChunkHeader const& chunk_header, Buffer& chunk) const {
+    if (chunk.getSize() != chunk_header.compressed_size) {
+        throw BagFormatException((boost::format("Error in encrypted chunk size: %d") % chunk.getSize()).str());
+    }
+    chunk.setSize(decrypt(chunk.getData(), chunk.getSize()));
+}
+
+void AesGcmEncryptor::addFieldsToFileHeader(ros::M_string &header_fields) const {
+    AesCbcEncryptor::addFieldsToFileHeader(header_fields);
+    header_fields[ENCRYPTOR_FIELD_NAME] = "rosbag/AesGcmEncryptor";
+}
+
+void AesGcmEncryptor::writeEncryptedHeader(boost::function<void(ros::M_string const&)>, ros::M_string const& header_fields, ChunkedFile& file) {
+    boost::shared_array<uint8_t> header_buffer;
+    uint32_t header_len;
+    ros::Header::write(header_fields, header_buffer, header_len);
+    std::basic_string<unsigned char> encrypted_header(header_len + NONCE_SIZE + TAG_SIZE, 0);
+    memcpy(&encrypted_header[0], header_buffer.get(), header_len);
+    encrypt(&encrypted_header[0], header_len);
+    // Write
+    uint32_t encrypted_header_len = encrypted_header.length();
+    file.write((char*) &encrypted_header_len, 4);
+    file.write((char*) &encrypted_header[0], encrypted_header_len);
+}
+
+bool AesGcmEncryptor::readEncryptedHeader(boost::function<bool(ros::Header&)>, ros::Header& header, Buffer& header_buffer, ChunkedFile& file) {
+    // Read and decrypt the encrypted header
+    uint32_t encrypted_header_len;
+    file.read((char*) &encrypted_header_len, 4);
+    header_buffer.setSize(encrypted_header_len);
+    file.read((char*) header_buffer.getData(), encrypted_header_len);
+    header_buffer.setSize(decrypt(header_buffer.getData(), encrypted_header_len));
+    // Parse the header
+    std::string error_msg;
+    return header.parse(header_buffer.getData(), header_buffer.getSize(), error_msg);
+}
+
 }  // namespace rosbag
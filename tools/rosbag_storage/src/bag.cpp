@@ -89,17 +89,27 @@ void Bag::init() {
     chunk_threshold_ = 768 * 1024;  // 768KB chunks
     bag_revision_ = 0;
     file_size_ = 0;
+    at_end_ = false;
     file_header_pos_ = 0;
     index_data_pos_ = 0;
     connection_count_ = 0;
     chunk_count_ = 0;
     chunk_open_ = false;
     curr_chunk_data_pos_ = 0;
-    current_buffer_ = 0;
-    decompressed_chunk_ = 0;
     setEncryptorPlugin(std::string("rosbag/NoEncryptor"));
 }
 
+Bag::ReadContext::ReadContext() : decompressed_chunk(0) { }
+
+Bag::ReadContext& Bag::getReadContext() const {
+    boost::mutex::scoped_lock lock(file_mutex_);
+
+    boost::shared_ptr<ReadContext>& context = read_contexts_[boost::this_thread::get_id()];
+    if (!context)
+        context = boost::make_shared<ReadContext>();
+    return *context;
+}
+
 void Bag::open(string const& filename, uint32_t mode) {
     mode_ = (BagMode) mode;
 
@@ -171,6 +181,7 @@ void Bag::close() {
 
     topic_connection_ids_.clear();
     header_connection_ids_.clear();
+    last_header_connection_ids_.clear();
     for (map<uint32_t, ConnectionInfo*>::iterator i = connections_.begin(); i != connections_.end(); i++)
         delete i->second;
     connections_.clear();
@@ -178,6 +189,12 @@ void Bag::close() {
     connection_indexes_.clear();
     curr_chunk_connection_indexes_.clear();
 
+    // Free the chunk buffers of every thread which read from the bag
+    {
+        boost::mutex::scoped_lock lock(file_mutex_);
+        read_contexts_.clear();
+    }
+
     init();
 }
 
@@ -189,8 +206,121 @@ string   Bag::getFileName() const { return file_.getFileName(); }
 BagMode  Bag::getMode()     const { return mode_;               }
 uint64_t Bag::getSize()     const { return file_size_;          }
 
+// Summary
+
+BagSummary Bag::summarize(string const& filename, bool exact) {
+    Bag bag;
+    bag.mode_ = bagmode::Read;
+    bag.file_.openRead(filename);
+    bag.readVersion();
+
+    if (exact || bag.version_ != 200) {
+        bag.close();
+        bag.open(filename, bagmode::Read);
+        return bag.getSummary();
+    }
+
+    // Read only the records at the end of the file, skipping the connection indexes after each chunk
+    bag.readFileHeaderRecord();
+    bag.seek(bag.index_data_pos_);
+    for (uint32_t i = 0; i < bag.connection_count_; i++)
+        bag.readConnectionRecord();
+    for (uint32_t i = 0; i < bag.chunk_count_; i++)
+        bag.readChunkInfoRecord();
+
+    bag.seek(0, std::ios::end);
+    bag.file_size_ = bag.file_.getOffset();
+
+    BagSummary summary;
+    bag.summarizeChunks(summary);
+    return summary;
+}
+
+BagSummary Bag::getSummary() const {
+    if (!(mode_ & bagmode::Read))
+        throw BagException("Bag must be opened for reading to be summarized");
+
+    BagSummary summary;
+    summarizeChunks(summary);
+    summary.exact = true;
+
+    summary.message_count = 0;
+    for (map<uint32_t, ConnectionSummary>::iterator i = summary.connections.begin(); i != summary.connections.end(); i++) {
+        ConnectionSummary& connection = i->second;
+
+        map<uint32_t, multiset<IndexEntry> >::const_iterator index = connection_indexes_.find(connection.id);
+        if (index == connection_indexes_.end() || index->second.empty()) {
+            connection.message_count = 0;
+            continue;
+        }
+
+        connection.message_count = index->second.size();
+        connection.start_time    = index->second.begin()->time;
+        connection.end_time      = index->second.rbegin()->time;
+
+        if (summary.message_count == 0 || connection.start_time < summary.start_time)
+            summary.start_time = connection.start_time;
+        if (summary.message_count == 0 || connection.end_time > summary.end_time)
+            summary.end_time = connection.end_time;
+        summary.message_count += connection.message_count;
+    }
+
+    return summary;
+}
+
+void Bag::summarizeChunks(BagSummary& summary) const {
+    summary.version     = version_;
+    summary.size        = file_size_;
+    summary.chunk_count = chunks_.size();
+
+    for (map<uint32_t, ConnectionInfo*>::const_iterator i = connections_.begin(); i != connections_.end(); i++) {
+        ConnectionSummary& connection = summary.connections[i->first];
+        connection.id       = i->second->id;
+        connection.topic    = i->second->topic;
+        connection.datatype = i->second->datatype;
+        connection.md5sum   = i->second->md5sum;
+    }
+
+    for (size_t i = 0; i < chunks_.size(); i++) {
+        ChunkInfo const& chunk_info = chunks_[i];
+
+        // The chunk record and the connection indexes following it extend to the next chunk
+        uint64_t chunk_end  = i + 1 < chunks_.size() ? chunks_[i + 1].pos : index_data_pos_;
+        uint64_t chunk_size = chunk_end > chunk_info.pos ? chunk_end - chunk_info.pos : 0;
+
+        uint64_t chunk_message_count = 0;
+        for (map<uint32_t, uint32_t>::const_iterator j = chunk_info.connection_counts.begin(); j != chunk_info.connection_counts.end(); j++)
+            chunk_message_count += j->second;
+        if (chunk_message_count == 0)
+            continue;
+
+        for (map<uint32_t, uint32_t>::const_iterator j = chunk_info.connection_counts.begin(); j != chunk_info.connection_counts.end(); j++) {
+            ConnectionSummary& connection = summary.connections[j->first];
+            if (connection.message_count == 0 || chunk_info.start_time < connection.start_time)
+                connection.start_time = chunk_info.start_time;
+            if (connection.message_count == 0 || chunk_info.end_time > connection.end_time)
+                connection.end_time = chunk_info.end_time;
+            connection.message_count += j->second;
+            connection.size          += chunk_size * j->second / chunk_message_count;
+        }
+
+        if (summary.message_count == 0 || chunk_info.start_time < summary.start_time)
+            summary.start_time = chunk_info.start_time;
+        if (summary.message_count == 0 || chunk_info.end_time > summary.end_time)
+            summary.end_time = chunk_info.end_time;
+        summary.message_count += chunk_message_count;
+    }
+}
+
 uint32_t Bag::getChunkThreshold() const { return chunk_threshold_; }
 
+bool Bag::preallocate(uint64_t size) {
+    if (!isOpen() || !(mode_ & (bagmode::Write | bagmode::Append)))
+        throw BagException("Bag must be opened for writing to preallocate space");
+
+    return file_.preallocate(size);
+}
+
 void Bag::setChunkThreshold(uint32_t chunk_threshold) {
     if (isOpen() && chunk_open_)
         stopWritingChunk();
@@ -220,6 +350,7 @@ void Bag::setEncryptorPlugin(std::string const& plugin_name, std::string const&
     }
     encryptor_ = encryptor_loader_.createInstance(plugin_name);
     encryptor_->initialize(*this, plugin_param);
+    encrypted_ = plugin_name != "rosbag/NoEncryptor";
 }
 
 // Version
@@ -469,6 +600,9 @@ void Bag::stopWritingChunk() {
 
     // Clear the connection counts
     curr_chunk_info_.connection_counts.clear();
+
+    // The index records were appended at the end of the file
+    at_end_ = true;
     
     // Flag that we're starting a new chunk
     chunk_open_ = false;
@@ -497,13 +631,207 @@ void Bag::writeChunkHeader(CompressionType compression, uint32_t compressed_size
     writeDataLength(chunk_header.compressed_size);
 }
 
+// Message writing
+
+void Bag::writeRaw(string const& topic, Time const& time, string const& datatype, string const& md5sum,
+                   string const& msg_def, uint8_t const* data, uint32_t size, shared_ptr<M_string> connection_header) {
+    ConnectionInfo* connection_info = NULL;
+    uint32_t conn_id = startWritingMessage(topic, time, connection_header, connection_info);
+
+    // Write connection info record, if necessary
+    if (connection_info == NULL)
+        addConnection(conn_id, topic, datatype, md5sum, msg_def, connection_header);
+
+    writeMessageDataRecord(conn_id, time, data, size);
+}
+
+//! Look up the connection of the message about to be written, and make sure a chunk is open for it
+/*!
+ * \return the connection id; connection_info is left NULL if the connection is new
+ */
+uint32_t Bag::startWritingMessage(string const& topic, Time const& time, shared_ptr<M_string> const& connection_header,
+                                  ConnectionInfo*& connection_info) {
+    if (time < ros::TIME_MIN)
+    {
+        throw BagException("Tried to insert a message with time less than ros::TIME_MIN");
+    }
+
+    // Whenever we write we increment our revision
+    bag_revision_++;
+
+    // Get ID for connection header
+    uint32_t conn_id = lookupConnectionId(topic, connection_header, connection_info);
+
+    // Seek to the end of the file (needed in case previous operation was a read)
+    seekToEnd();
+
+    // Write the chunk header if we're starting a new chunk
+    if (!chunk_open_)
+        startWritingChunk(time);
+
+    return conn_id;
+}
+
+uint32_t Bag::lookupConnectionId(string const& topic, shared_ptr<M_string> const& connection_header,
+                                 ConnectionInfo*& connection_info) {
+    uint32_t conn_id = 0;
+    if (!connection_header) {
+        // No connection header: we'll manufacture one, and store by topic
+
+        map<string, uint32_t>::iterator topic_connection_ids_iter = topic_connection_ids_.find(topic);
+        if (topic_connection_ids_iter == topic_connection_ids_.end()) {
+            conn_id = connections_.size();
+            topic_connection_ids_[topic] = conn_id;
+        }
+        else {
+            conn_id = topic_connection_ids_iter->second;
+            connection_info = connections_[conn_id];
+        }
+    }
+    else {
+        // Fast path: the same connection header as the last message on this topic.
+        // Holding on to the header guarantees its address can't be reused by another
+        // one, and keeping only the last one per topic bounds the memory it takes.
+        std::pair<shared_ptr<M_string>, uint32_t>& last_header = last_header_connection_ids_[topic];
+        if (last_header.first == connection_header) {
+            conn_id = last_header.second;
+            connection_info = connections_[conn_id];
+            return conn_id;
+        }
+
+        // Store the connection info by the contents of the connection header
+
+        // Add the topic name to the connection header, so that when we later search by 
+        // connection header, we can disambiguate connections that differ only by topic name (i.e.,
+        // same callerid, same message type), #3755.  This modified connection header is only used
+        // for our bookkeeping, and will not appear in the resulting .bag.
+        M_string connection_header_copy(*connection_header);
+        connection_header_copy["topic"] = topic;
+
+        map<M_string, uint32_t>::iterator header_connection_ids_iter = header_connection_ids_.find(connection_header_copy);
+        if (header_connection_ids_iter == header_connection_ids_.end()) {
+            conn_id = connections_.size();
+            header_connection_ids_[connection_header_copy] = conn_id;
+        }
+        else {
+            conn_id = header_connection_ids_iter->second;
+            connection_info = connections_[conn_id];
+        }
+        last_header.first  = connection_header;
+        last_header.second = conn_id;
+    }
+    return conn_id;
+}
+
+ConnectionInfo* Bag::addConnection(uint32_t conn_id, string const& topic, string const& datatype, string const& md5sum,
+                                   string const& msg_def, shared_ptr<M_string> const& connection_header) {
+    ConnectionInfo* connection_info = new ConnectionInfo();
+    connection_info->id       = conn_id;
+    connection_info->topic    = topic;
+    connection_info->datatype = datatype;
+    connection_info->md5sum   = md5sum;
+    connection_info->msg_def  = msg_def;
+    if (connection_header != NULL) {
+        connection_info->header = connection_header;
+    }
+    else {
+        connection_info->header = boost::make_shared<M_string>();
+        (*connection_info->header)["type"]               = connection_info->datatype;
+        (*connection_info->header)["md5sum"]             = connection_info->md5sum;
+        (*connection_info->header)["message_definition"] = connection_info->msg_def;
+    }
+    connections_[conn_id] = connection_info;
+    // No need to encrypt connection records in chunks
+    writeConnectionRecord(connection_info, false);
+    appendConnectionRecordToBuffer(outgoing_chunk_buffer_, connection_info);
+
+    return connection_info;
+}
+
+void Bag::writeMessageDataRecord(uint32_t conn_id, Time const& time, uint8_t const* data, uint32_t data_len) {
+    uint32_t record_offset = outgoing_chunk_buffer_.getSize();
+    uint32_t data_offset   = startMessageDataRecord(conn_id, time, data_len);
+
+    if (data_len > 0)
+        memcpy(outgoing_chunk_buffer_.getData() + data_offset, data, data_len);
+
+    stopMessageDataRecord(record_offset, conn_id, time);
+}
+
+//! Index a message data record and append its header to the outgoing chunk
+/*!
+ * \return the offset in outgoing_chunk_buffer_ of the data_len bytes reserved for the message data
+ */
+uint32_t Bag::startMessageDataRecord(uint32_t conn_id, Time const& time, uint32_t data_len) {
+    // Add to topic indexes
+    IndexEntry index_entry;
+    index_entry.time      = time;
+    index_entry.chunk_pos = curr_chunk_info_.pos;
+    index_entry.offset    = getChunkOffset();
+
+    std::multiset<IndexEntry>& chunk_connection_index = curr_chunk_connection_indexes_[conn_id];
+    chunk_connection_index.insert(chunk_connection_index.end(), index_entry);
+    std::multiset<IndexEntry>& connection_index = connection_indexes_[conn_id];
+    connection_index.insert(connection_index.end(), index_entry);
+
+    // Increment the connection count
+    curr_chunk_info_.connection_counts[conn_id]++;
+
+    M_string header;
+    header[OP_FIELD_NAME]         = toHeaderString(&OP_MSG_DATA);
+    header[CONNECTION_FIELD_NAME] = toHeaderString(&conn_id);
+    header[TIME_FIELD_NAME]       = toHeaderString(&time);
+
+    appendHeaderToBuffer(outgoing_chunk_buffer_, header);
+    appendDataLengthToBuffer(outgoing_chunk_buffer_, data_len);
+
+    uint32_t data_offset = outgoing_chunk_buffer_.getSize();
+    outgoing_chunk_buffer_.setSize(data_offset + data_len);
+    return data_offset;
+}
+
+//! Write the message data record assembled in outgoing_chunk_buffer_ at record_offset to the file
+void Bag::stopMessageDataRecord(uint32_t record_offset, uint32_t conn_id, Time const& time) {
+    // We do an extra seek here since serializing our data record may
+    // have indirectly moved our file-pointer if it was a
+    // MessageInstance for our own bag
+    seekToEnd();
+
+    uint32_t record_len = outgoing_chunk_buffer_.getSize() - record_offset;
+
+    CONSOLE_BRIDGE_logDebug("Writing MSG_DATA [%llu:%d]: conn=%d sec=%d nsec=%d record_len=%d",
+              (unsigned long long) file_.getOffset(), getChunkOffset(), conn_id, time.sec, time.nsec, record_len);
+
+    write((char*) outgoing_chunk_buffer_.getData() + record_offset, record_len);
+
+    // Update the current chunk time range
+    if (time > curr_chunk_info_.end_time)
+        curr_chunk_info_.end_time = time;
+    else if (time < curr_chunk_info_.start_time)
+        curr_chunk_info_.start_time = time;
+
+    // Check if we want to stop this chunk
+    uint32_t chunk_size = getChunkOffset();
+    CONSOLE_BRIDGE_logDebug("  curr_chunk_size=%d (threshold=%d)", chunk_size, chunk_threshold_);
+    if (chunk_size > chunk_threshold_) {
+        // Empty the outgoing chunk
+        stopWritingChunk();
+        outgoing_chunk_buffer_.setSize(0);
+
+        // We no longer have a valid curr_chunk_info
+        curr_chunk_info_.pos = -1;
+    }
+}
+
 void Bag::readChunkHeader(ChunkHeader& chunk_header) const {
     ros::Header header;
     if (!readHeader(header) || !readDataLength(chunk_header.compressed_size))
         throw BagFormatException("Error reading CHUNK record");
-        
-    M_string& fields = *header.getValues();
 
+    readChunkHeaderFields(*header.getValues(), chunk_header);
+}
+
+void Bag::readChunkHeaderFields(M_string& fields, ChunkHeader& chunk_header) const {
     if (!isOp(fields, OP_CHUNK))
         throw BagFormatException("Expected CHUNK op not found");
 
@@ -773,40 +1101,73 @@ void Bag::readMessageDefinitionRecord102() {
     CONSOLE_BRIDGE_logDebug("Read MSG_DEF: topic=%s md5sum=%s datatype=%s", topic.c_str(), md5sum.c_str(), datatype.c_str());
 }
 
-void Bag::decompressChunk(uint64_t chunk_pos) const {
-    if (curr_chunk_info_.pos == chunk_pos) {
-        current_buffer_ = &outgoing_chunk_buffer_;
-        return;
-    }
-
-    current_buffer_ = &decompress_buffer_;
+Buffer* Bag::decompressChunk(uint64_t chunk_pos) const {
+    if (curr_chunk_info_.pos == chunk_pos)
+        return &outgoing_chunk_buffer_;
 
-    if (decompressed_chunk_ == chunk_pos)
-        return;
+    ReadContext& context = getReadContext();
+    if (context.decompressed_chunk == chunk_pos)
+        return &context.decompress_buffer;
 
-    // Seek to the start of the chunk
-    seek(chunk_pos);
+    context.decompressed_chunk = 0;
 
-    // Read the chunk header
+    // Read the (decrypted) chunk data into chunk_buffer
     ChunkHeader chunk_header;
-    readChunkHeader(chunk_header);
+    readChunk(chunk_pos, chunk_header, context.chunk_buffer);
 
-    // Read and decompress the chunk.  These assume we are at the right place in the stream already
+    // Decompress the chunk into decompress_buffer
     if (chunk_header.compression == COMPRESSION_NONE)
-        decompressRawChunk(chunk_header);
+        decompressRawChunk(chunk_header, context);
     else if (chunk_header.compression == COMPRESSION_BZ2)
-        decompressBz2Chunk(chunk_header);
+        decompressBz2Chunk(chunk_header, context);
     else if (chunk_header.compression == COMPRESSION_LZ4)
-        decompressLz4Chunk(chunk_header);
+        decompressLz4Chunk(chunk_header, context);
     else
         throw BagFormatException("Unknown compression: " + chunk_header.compression);
-    
-    decompressed_chunk_ = chunk_pos;
+
+    context.decompressed_chunk = chunk_pos;
+    return &context.decompress_buffer;
+}
+
+void Bag::readChunk(uint64_t chunk_pos, ChunkHeader& chunk_header, Buffer& chunk) const {
+#if !defined(_WIN32)
+    // Chunks of a bag that isn't being written are read with positional reads, which don't need the lock and don't
+    // disturb the position of file_, unless the encryptor has to read them from the file stream itself
+    if (mode_ == bagmode::Read && (!encrypted_ || encryptor_->canDecryptInPlace())) {
+        uint32_t header_len;
+        file_.readAt(chunk_pos, &header_len, 4);
+
+        // Read the header together with the data length following it
+        chunk.setSize(header_len + 4);
+        file_.readAt(chunk_pos + 4, chunk.getData(), header_len + 4);
+
+        ros::Header header;
+        string error_msg;
+        if (!header.parse(chunk.getData(), header_len, error_msg))
+            throw BagFormatException("Error reading CHUNK record");
+        memcpy(&chunk_header.compressed_size, chunk.getData() + header_len, 4);
+        readChunkHeaderFields(*header.getValues(), chunk_header);
+
+        chunk.setSize(chunk_header.compressed_size);
+        file_.readAt(chunk_pos + 4 + header_len + 4, chunk.getData(), chunk_header.compressed_size);
+        if (encrypted_)
+            encryptor_->decryptChunkInPlace(chunk_header, chunk);
+        return;
+    }
+#endif
+
+    boost::mutex::scoped_lock lock(file_mutex_);
+
+    seek(chunk_pos);
+    readChunkHeader(chunk_header);
+    encryptor_->decryptChunk(chunk_header, chunk, file_);
 }
 
-void Bag::readMessageDataRecord102(uint64_t offset, ros::Header& header) const {
+void Bag::readMessageDataRecord102(uint64_t offset, ros::Header& header, Buffer& record_buffer) const {
     CONSOLE_BRIDGE_logDebug("readMessageDataRecord: offset=%llu", (unsigned long long) offset);
 
+    boost::mutex::scoped_lock lock(file_mutex_);
+
     seek(offset);
 
     uint32_t data_size;
@@ -822,37 +1183,33 @@ void Bag::readMessageDataRecord102(uint64_t offset, ros::Header& header) const {
     if (op != OP_MSG_DATA)
         throw BagFormatException((format("Expected MSG_DATA op, got %d") % op).str());
 
-    record_buffer_.setSize(data_size);
-    file_.read((char*) record_buffer_.getData(), data_size);
+    record_buffer.setSize(data_size);
+    file_.read((char*) record_buffer.getData(), data_size);
 }
 
-// Reading this into a buffer isn't completely necessary, but we do it anyways for now
-void Bag::decompressRawChunk(ChunkHeader const& chunk_header) const {
+// The chunk is already in chunk_buffer, so just hand it over
+void Bag::decompressRawChunk(ChunkHeader const& chunk_header, ReadContext& context) const {
     assert(chunk_header.compression == COMPRESSION_NONE);
 
     CONSOLE_BRIDGE_logDebug("compressed_size: %d uncompressed_size: %d", chunk_header.compressed_size, chunk_header.uncompressed_size);
 
-    encryptor_->decryptChunk(chunk_header, decompress_buffer_, file_);
-
-    // todo check read was successful
+    context.decompress_buffer.swap(context.chunk_buffer);
 }
 
-void Bag::decompressBz2Chunk(ChunkHeader const& chunk_header) const {
+void Bag::decompressBz2Chunk(ChunkHeader const& chunk_header, ReadContext& context) const {
     assert(chunk_header.compression == COMPRESSION_BZ2);
 
     CompressionType compression = compression::BZ2;
 
     CONSOLE_BRIDGE_logDebug("compressed_size: %d uncompressed_size: %d", chunk_header.compressed_size, chunk_header.uncompressed_size);
 
-    encryptor_->decryptChunk(chunk_header, chunk_buffer_, file_);
-
-    decompress_buffer_.setSize(chunk_header.uncompressed_size);
-    file_.decompress(compression, decompress_buffer_.getData(), decompress_buffer_.getSize(), chunk_buffer_.getData(), chunk_buffer_.getSize());
+    context.decompress_buffer.setSize(chunk_header.uncompressed_size);
+    file_.decompress(compression, context.decompress_buffer.getData(), context.decompress_buffer.getSize(), context.chunk_buffer.getData(), context.chunk_buffer.getSize());
 
     // todo check read was successful
 }
 
-void Bag::decompressLz4Chunk(ChunkHeader const& chunk_header) const {
+void Bag::decompressLz4Chunk(ChunkHeader const& chunk_header, ReadContext& context) const {
     assert(chunk_header.compression == COMPRESSION_LZ4);
 
     CompressionType compression = compression::LZ4;
@@ -860,10 +1217,8 @@ void Bag::decompressLz4Chunk(ChunkHeader const& chunk_header) const {
     CONSOLE_BRIDGE_logDebug("lz4 compressed_size: %d uncompressed_size: %d",
              chunk_header.compressed_size, chunk_header.uncompressed_size);
 
-    encryptor_->decryptChunk(chunk_header, chunk_buffer_, file_);
-
-    decompress_buffer_.setSize(chunk_header.uncompressed_size);
-    file_.decompress(compression, decompress_buffer_.getData(), decompress_buffer_.getSize(), chunk_buffer_.getData(), chunk_buffer_.getSize());
+    context.decompress_buffer.setSize(chunk_header.uncompressed_size);
+    file_.decompress(compression, context.decompress_buffer.getData(), context.decompress_buffer.getSize(), context.chunk_buffer.getData(), context.chunk_buffer.getSize());
 
     // todo check read was successful
 }
@@ -875,31 +1230,35 @@ ros::Header Bag::readMessageDataHeader(IndexEntry const& index_entry) {
     switch (version_)
     {
     case 200:
-        decompressChunk(index_entry.chunk_pos);
-        readMessageDataHeaderFromBuffer(*current_buffer_, index_entry.offset, header, data_size, bytes_read);
+        readMessageDataHeaderFromBuffer(*decompressChunk(index_entry.chunk_pos), index_entry.offset, header, data_size, bytes_read);
         return header;
     case 102:
-        readMessageDataRecord102(index_entry.chunk_pos, header);
+        readMessageDataRecord102(index_entry.chunk_pos, header, getReadContext().record_buffer);
         return header;
     default:
         throw BagFormatException((format("Unhandled version: %1%") % version_).str());
     }
 }
 
-// NOTE: this loads the header, which is unnecessary
 uint32_t Bag::readMessageDataSize(IndexEntry const& index_entry) const {
-    ros::Header header;
-    uint32_t data_size;
-    uint32_t bytes_read;
     switch (version_)
     {
     case 200:
-        decompressChunk(index_entry.chunk_pos);
-        readMessageDataHeaderFromBuffer(*current_buffer_, index_entry.offset, header, data_size, bytes_read);
+    {
+        uint32_t connection_id;
+        Time time;
+        uint32_t data_size;
+        uint32_t bytes_read;
+        readMessageDataFieldsFromBuffer(*decompressChunk(index_entry.chunk_pos), index_entry.offset, connection_id, time, data_size, bytes_read);
         return data_size;
+    }
     case 102:
-        readMessageDataRecord102(index_entry.chunk_pos, header);
-        return record_buffer_.getSize();
+    {
+        ros::Header header;
+        Buffer& record_buffer = getReadContext().record_buffer;
+        readMessageDataRecord102(index_entry.chunk_pos, header, record_buffer);
+        return record_buffer.getSize();
+    }
     default:
         throw BagFormatException((format("Unhandled version: %1%") % version_).str());
     }
@@ -1052,13 +1411,12 @@ void Bag::readHeaderFromBuffer(Buffer& buffer, uint32_t offset, ros::Header& hea
 }
 
 void Bag::readMessageDataHeaderFromBuffer(Buffer& buffer, uint32_t offset, ros::Header& header, uint32_t& data_size, uint32_t& total_bytes_read) const {
-    (void)buffer;
     total_bytes_read = 0;
     uint8_t op = 0xFF;
     do {
         CONSOLE_BRIDGE_logDebug("reading header from buffer: offset=%d", offset);
         uint32_t bytes_read;
-        readHeaderFromBuffer(*current_buffer_, offset, header, data_size, bytes_read);
+        readHeaderFromBuffer(buffer, offset, header, data_size, bytes_read);
 
         offset += bytes_read;
         total_bytes_read += bytes_read;
@@ -1071,6 +1429,52 @@ void Bag::readMessageDataHeaderFromBuffer(Buffer& buffer, uint32_t offset, ros::
         throw BagFormatException("Expected MSG_DATA op not found");
 }
 
+// Matches the length and name of a record header field, returning a pointer to its value or NULL
+static uint8_t const* matchHeaderField(uint8_t const* ptr, string const& name, uint32_t value_len) {
+    uint32_t field_len;
+    memcpy(&field_len, ptr, 4);
+    if (field_len != name.size() + 1 + value_len)
+        return NULL;
+    ptr += 4;
+    if (memcmp(ptr, name.data(), name.size()) != 0 || ptr[name.size()] != '=')
+        return NULL;
+    return ptr + name.size() + 1;
+}
+
+void Bag::readMessageDataFieldsFromBuffer(Buffer& buffer, uint32_t offset, uint32_t& connection_id, Time& time, uint32_t& data_size, uint32_t& bytes_read) const {
+    // The header written by startMessageDataRecord: conn, op and time, each as length, name, '=' and value
+    static const uint32_t MSG_DATA_HEADER_LEN = (4 + 5 + 4) + (4 + 3 + 1) + (4 + 5 + 8);
+
+    // Fast path: pick the fields straight out of the buffer if the header has exactly that layout
+    if (offset + 4 + MSG_DATA_HEADER_LEN + 4 <= buffer.getSize()) {
+        uint8_t const* start = buffer.getData() + offset;
+        uint32_t header_len;
+        memcpy(&header_len, start, 4);
+
+        uint8_t const* conn = NULL;
+        uint8_t const* op   = NULL;
+        uint8_t const* stamp = NULL;
+        if (header_len == MSG_DATA_HEADER_LEN &&
+            (conn  = matchHeaderField(start + 4, CONNECTION_FIELD_NAME, 4)) != NULL &&
+            (op    = matchHeaderField(conn + 4,  OP_FIELD_NAME, 1))         != NULL && *op == OP_MSG_DATA &&
+            (stamp = matchHeaderField(op + 1,    TIME_FIELD_NAME, 8))       != NULL)
+        {
+            memcpy(&connection_id, conn, 4);
+            memcpy(&time.sec,  stamp, 4);
+            memcpy(&time.nsec, stamp + 4, 4);
+            memcpy(&data_size, stamp + 8, 4);
+            bytes_read = 4 + MSG_DATA_HEADER_LEN + 4;
+            return;
+        }
+    }
+
+    // Any other field order or extra fields, and records preceding the message data, take the generic path
+    ros::Header header;
+    readMessageDataHeaderFromBuffer(buffer, offset, header, data_size, bytes_read);
+    readField(*header.getValues(), CONNECTION_FIELD_NAME, true, &connection_id);
+    readField(*header.getValues(), TIME_FIELD_NAME, true, time);
+}
+
 bool Bag::readHeader(ros::Header& header) const {
     // Read the header length
     uint32_t header_len;
@@ -1142,8 +1546,17 @@ std::string Bag::toHeaderString(Time const* field) const {
 void Bag::write(string const& s)                  { write(s.c_str(), s.length()); }
 void Bag::write(char const* s, std::streamsize n) { file_.write((char*) s, n);    }
 
-void Bag::read(char* b, std::streamsize n) const  { file_.read(b, n);             }
-void Bag::seek(uint64_t pos, int origin) const    { file_.seek(pos, origin);      }
+void Bag::read(char* b, std::streamsize n) const  { at_end_ = false; file_.read(b, n);        }
+void Bag::seek(uint64_t pos, int origin) const    { at_end_ = false; file_.seek(pos, origin); }
+
+//! Position file_ for writing at the end of the file, without a seek if nothing has moved it since the last write
+void Bag::seekToEnd() {
+    if (!at_end_) {
+        seek(0, std::ios::end);
+        at_end_ = true;
+    }
+    file_size_ = file_.getOffset();
+}
 
 void Bag::swap(Bag& other) {
     using std::swap;
@@ -1163,17 +1576,16 @@ void Bag::swap(Bag& other) {
     swap(curr_chunk_data_pos_, other.curr_chunk_data_pos_);
     swap(topic_connection_ids_, other.topic_connection_ids_);
     swap(header_connection_ids_, other.header_connection_ids_);
+    swap(last_header_connection_ids_, other.last_header_connection_ids_);
     swap(connections_, other.connections_);
     swap(chunks_, other.chunks_);
     swap(connection_indexes_, other.connection_indexes_);
     swap(curr_chunk_connection_indexes_, other.curr_chunk_connection_indexes_);
     swap(header_buffer_, other.header_buffer_);
-    swap(record_buffer_, other.record_buffer_);
-    swap(chunk_buffer_, other.chunk_buffer_);
-    swap(decompress_buffer_, other.decompress_buffer_);
     swap(outgoing_chunk_buffer_, other.outgoing_chunk_buffer_);
-    swap(current_buffer_, other.current_buffer_);
-    swap(decompressed_chunk_, other.decompressed_chunk_);
+    swap(read_contexts_, other.read_contexts_);
+    swap(encrypted_, other.encrypted_);
+    swap(at_end_, other.at_end_);
     swap(encryptor_, other.encryptor_);
 }
 
@@ -40,6 +40,12 @@
 #include <boost/make_shared.hpp>
 
 //#include <ros/ros.h>
+#ifndef _WIN32
+#    include <errno.h>
+#    include <fcntl.h>
+#    include <unistd.h>
+#    include <sys/stat.h>
+#endif
 #ifdef _WIN32
 #    ifdef __MINGW32__
 #      define fseeko fseeko64
@@ -66,7 +72,8 @@ ChunkedFile::ChunkedFile() :
     offset_(0),
     compressed_in_(0),
     unused_(NULL),
-    nUnused_(0)
+    nUnused_(0),
+    preallocated_(false)
 {
     stream_factory_ = boost::make_shared<StreamFactory>(this);
 }
@@ -141,6 +148,19 @@ void ChunkedFile::close() {
     // Close any compressed stream by changing to uncompressed mode
     setWriteMode(compression::Uncompressed);
 
+#ifndef _WIN32
+    // Release the reserved space the file didn't grow into. The contents are complete either way, so failing to
+    // release it only wastes disk space.
+    if (preallocated_) {
+        struct stat st;
+        if (fflush(file_) == 0 && fstat(fileno(file_), &st) == 0) {
+            int result = ftruncate(fileno(file_), st.st_size);
+            (void) result;
+        }
+        preallocated_ = false;
+    }
+#endif
+
     // Close the file
     int success = fclose(file_);
     if (success != 0)
@@ -200,11 +220,47 @@ void ChunkedFile::write(string const& s)        { write((void*) s.c_str(), s.siz
 void ChunkedFile::write(void* ptr, size_t size) { write_stream_->write(ptr, size);    }
 void ChunkedFile::read(void* ptr, size_t size)  { read_stream_->read(ptr, size);      }
 
+#ifndef _WIN32
+void ChunkedFile::readAt(uint64_t offset, void* ptr, size_t size) const {
+    char* dest = (char*) ptr;
+    while (size > 0) {
+        ssize_t nread = pread(fileno(file_), dest, size, offset);
+        if (nread < 0 && errno == EINTR)
+            continue;
+        if (nread <= 0)
+            throw BagIOException((format("Error reading from file: %1%") % filename_.c_str()).str());
+        dest   += nread;
+        offset += nread;
+        size   -= nread;
+    }
+}
+#endif
+
 bool ChunkedFile::truncate(uint64_t length) {
     int fd = fileno(file_);
     return ftruncate(fd, length) == 0;
 }
 
+bool ChunkedFile::preallocate(uint64_t length) {
+    if (!file_)
+        throw BagIOException("Can't preallocate - file not open");
+
+#if defined(__linux__)
+    int result;
+    do
+        result = fallocate(fileno(file_), FALLOC_FL_KEEP_SIZE, 0, length);
+    while (result != 0 && errno == EINTR);
+    if (result != 0)
+        return false;
+
+    preallocated_ = true;
+    return true;
+#else
+    (void) length;
+    return false;
+#endif
+}
+
 //! \todo add error handling
 string ChunkedFile::getline() {
     char buffer[1024];
@@ -236,6 +292,7 @@ void ChunkedFile::swap(ChunkedFile& other) {
     swap(compressed_in_, other.compressed_in_);
     swap(unused_, other.unused_);
     swap(nUnused_, other.nUnused_);
+    swap(preallocated_, other.preallocated_);
 
     swap(stream_factory_, other.stream_factory_);
 
@@ -29,9 +29,15 @@
 #include "rosbag/bag.h"
 #include "rosbag/message_instance.h"
 
+#include <algorithm>
 #include <set>
 #include <assert.h>
 
+#include <boost/atomic.hpp>
+#include <boost/exception_ptr.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread/thread.hpp>
+
 using std::map;
 using std::string;
 using std::vector;
@@ -344,5 +350,143 @@ MessageInstance* View::newMessageInstance(ConnectionInfo const* connection_info,
   return new MessageInstance(connection_info, index, bag);
 }
 
+// View::parallelForEach
+
+namespace {
+
+struct ParallelEntry
+{
+    ConnectionInfo const* connection;
+    IndexEntry const*     index;
+    Bag const*            bag;
+};
+
+//! Orders the entries of a chunk by their position in the chunk
+struct ParallelEntryOffsetCompare
+{
+    bool operator()(ParallelEntry const& a, ParallelEntry const& b) const {
+        if (a.index->offset != b.index->offset)
+            return a.index->offset < b.index->offset;
+        return a.index < b.index;
+    }
+};
+
+//! Orders the entries of a connection by time, like View::iterator does
+struct ParallelEntryTimeCompare
+{
+    bool operator()(ParallelEntry const& a, ParallelEntry const& b) const {
+        if (a.index->time != b.index->time)
+            return a.index->time < b.index->time;
+        if (a.index->chunk_pos != b.index->chunk_pos)
+            return a.index->chunk_pos < b.index->chunk_pos;
+        if (a.index->offset != b.index->offset)
+            return a.index->offset < b.index->offset;
+        return a.index < b.index;
+    }
+};
+
+bool sameIndexEntry(ParallelEntry const& a, ParallelEntry const& b) {
+    return a.index == b.index;
+}
+
+struct ParallelState
+{
+    ParallelState() : next_task(0), failed(false) { }
+
+    std::vector<std::vector<ParallelEntry> > tasks;
+    boost::atomic<size_t>                    next_task;
+    boost::atomic<bool>                      failed;
+    boost::mutex                             error_mutex;
+    boost::exception_ptr                     error;
+};
+
+void runParallelWorker(ParallelState* state, uint32_t worker,
+                       boost::function<MessageInstance*(ParallelEntry const&)> const& instantiate,
+                       boost::function<void(uint32_t, MessageInstance const&)> const& f)
+{
+    try {
+        while (!state->failed) {
+            size_t task = state->next_task++;
+            if (task >= state->tasks.size())
+                break;
+
+            for (ParallelEntry const& entry : state->tasks[task]) {
+                if (state->failed)
+                    break;
+
+                boost::scoped_ptr<MessageInstance> m(instantiate(entry));
+                f(worker, *m);
+            }
+        }
+    }
+    catch (...) {
+        boost::mutex::scoped_lock lock(state->error_mutex);
+        if (!state->error)
+            state->error = boost::current_exception();
+        state->failed = true;
+    }
+}
+
+} // namespace
+
+uint32_t View::getThreadCount(uint32_t threads) {
+    if (threads == 0)
+        threads = boost::thread::hardware_concurrency();
+    return threads > 0 ? threads : 1;
+}
+
+void View::parallelForEach(boost::function<void(uint32_t, MessageInstance const&)> const& f, uint32_t threads,
+                           bool per_connection)
+{
+    update();
+    threads = getThreadCount(threads);
+
+    // Group the messages into tasks: one per chunk, or one per connection if the order within connections matters
+    map<std::pair<Bag const*, uint64_t>, vector<ParallelEntry> > groups;
+    for (MessageRange const* range : ranges_) {
+        Bag const* bag = range->bag_query->bag;
+        for (multiset<IndexEntry>::const_iterator i = range->begin; i != range->end; ++i) {
+            ParallelEntry entry = { range->connection_info, &*i, bag };
+            uint64_t key = per_connection ? range->connection_info->id : i->chunk_pos;
+            groups[std::make_pair(bag, key)].push_back(entry);
+        }
+    }
+
+    ParallelState state;
+    state.tasks.reserve(groups.size());
+    for (map<std::pair<Bag const*, uint64_t>, vector<ParallelEntry> >::iterator i = groups.begin(); i != groups.end(); ++i) {
+        vector<ParallelEntry>& entries = i->second;
+        if (per_connection)
+            std::sort(entries.begin(), entries.end(), ParallelEntryTimeCompare());
+        else
+            std::sort(entries.begin(), entries.end(), ParallelEntryOffsetCompare());
+
+        // Overlapping queries on the same connection yield the same index entry more than once
+        if (reduce_overlap_)
+            entries.erase(std::unique(entries.begin(), entries.end(), sameIndexEntry), entries.end());
+
+        state.tasks.push_back(vector<ParallelEntry>());
+        state.tasks.back().swap(entries);
+    }
+
+    if (state.tasks.empty())
+        return;
+    if (threads > state.tasks.size())
+        threads = state.tasks.size();
+
+    boost::function<MessageInstance*(ParallelEntry const&)> instantiate =
+        [this](ParallelEntry const& entry) { return newMessageInstance(entry.connection, *entry.index, *entry.bag); };
+
+    // The calling thread is worker 0
+    boost::thread_group workers;
+    for (uint32_t worker = 1; worker < threads; worker++)
+        workers.create_thread(boost::bind(&runParallelWorker, &state, worker, boost::cref(instantiate), boost::cref(f)));
+    runParallelWorker(&state, 0, instantiate, f);
+    workers.join_all();
+
+    if (state.error)
+        boost::rethrow_exception(state.error);
+}
+
 
 } // namespace rosbag
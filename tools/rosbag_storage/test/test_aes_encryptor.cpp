@@ -110,7 +110,7 @@ void importGpgKey(gpgme_ctx_t &ctx) {
     gpgme_data_release(key_data);
 }
 
-TEST(AesCbcEncryptor, EncryptAndDecryptBag) {
+void encryptAndDecryptBag(std::string const& plugin_name) {
     // Import key
     rosbag::initGpgme();
     gpgme_ctx_t ctx;
@@ -135,7 +135,7 @@ TEST(AesCbcEncryptor, EncryptAndDecryptBag) {
     char *temp_dir = mkdtemp(temp_dir_templ);
     std::string bag_file_name = std::string(temp_dir) + "/foo.bag";
     rosbag::Bag bag(bag_file_name, rosbag::bagmode::Write);
-    bag.setEncryptorPlugin("rosbag/AesCbcEncryptor", GPG_KEY_USER);
+    bag.setEncryptorPlugin(plugin_name, GPG_KEY_USER);
     std_msgs::String msg;
     msg.data = MESSAGE;
     bag.write(TOPIC_NAME, ros::TIME_MIN, msg);
@@ -157,6 +157,14 @@ TEST(AesCbcEncryptor, EncryptAndDecryptBag) {
     gpgme_release(ctx);
 }
 
+TEST(AesCbcEncryptor, EncryptAndDecryptBag) {
+    encryptAndDecryptBag("rosbag/AesCbcEncryptor");
+}
+
+TEST(AesGcmEncryptor, EncryptAndDecryptBag) {
+    encryptAndDecryptBag("rosbag/AesGcmEncryptor");
+}
+
 int main(int argc, char **argv) {
     testing::InitGoogleTest(&argc, argv);
     return RUN_ALL_TESTS();
@@ -0,0 +1,144 @@
+/*
+ * Copyright (c) 2008, Willow Garage, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of Willow Garage, Inc. nor the names of its
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef ROSOUT_BINARY_LOG_H
+#define ROSOUT_BINARY_LOG_H
+
+#include <stdint.h>
+#include <cstdio>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <boost/function.hpp>
+
+#include "ros/time.h"
+#include "rosgraph_msgs/Log.h"
+#include "rosout/macros.h"
+
+namespace rosout
+{
+
+/**
+ * \brief Writes log messages to a binary log, as an append-only series of segment files
+ *
+ * The segments are named <prefix>.<number>.bin and numbered from after the last one already there, removing
+ * the oldest ones beyond a maximum number of segments. Each
+ * holds the serialized messages, followed once the segment is complete by an index of them sorted by time,
+ * which records their node and level. A segment that was never completed (e.g. after a crash) can still
+ * be read, only more slowly.
+ */
+class ROSOUT_DECL BinaryLogWriter
+{
+public:
+  /**
+   * \param prefix Path and file name prefix of the segments
+   * \param max_segment_size Size in bytes after which a segment is completed and a new one started
+   * \param max_segments Number of segments kept when a new one is started, including it; 0 keeps all of them
+   */
+  BinaryLogWriter(const std::string& prefix, uint64_t max_segment_size = 100 * 1024 * 1024, uint32_t max_segments = 0);
+  ~BinaryLogWriter();
+
+  //! Appends msg to the current segment; returns false and prints why if it could not be written
+  bool write(const rosgraph_msgs::Log& msg);
+  bool flush();
+  //! Completes the current segment
+  void close();
+
+private:
+  bool openSegment();
+  void removeOldSegments();
+  bool truncateToWritten();
+  void closeFile();
+
+  struct IndexEntry
+  {
+    ros::Time stamp;
+    uint64_t offset;
+    uint32_t node;
+    uint8_t level;
+  };
+
+  std::string prefix_;
+  uint64_t max_segment_size_;
+  uint32_t max_segments_;
+  uint32_t segment_number_;             //!< number of the current or next segment
+  std::string file_name_;
+  FILE* file_;
+  uint64_t offset_;                     //!< size of the current segment
+  std::map<std::string, uint32_t> nodes_;  //!< node names in the current segment, and their position in the index
+  std::vector<IndexEntry> index_;
+  std::vector<uint8_t> buffer_;         //!< reused to serialize messages
+};
+
+/**
+ * \brief Selects messages from a binary log
+ */
+struct ROSOUT_DECL LogQuery
+{
+  LogQuery();
+
+  ros::Time start;    //!< earliest stamp, inclusive
+  ros::Time end;      //!< latest stamp, inclusive
+  uint8_t levels;     //!< mask of the rosgraph_msgs::Log levels to select
+  std::string node;   //!< node name to select, empty for all of them
+};
+
+/**
+ * \brief Reads the segments of a binary log written by BinaryLogWriter
+ *
+ * Queries skip the segments whose index rules out a match, and only read the messages the index selects.
+ */
+class ROSOUT_DECL BinaryLogReader
+{
+public:
+  //! Finds the segments of the binary log with the given prefix
+  explicit BinaryLogReader(const std::string& prefix);
+
+  std::vector<std::string> const& getSegments() const;
+
+  /**
+   * \brief Calls callback for each message matching query, segment by segment and ordered by stamp
+   * within a complete segment; throws std::runtime_error if a segment is corrupt
+   */
+  void query(const LogQuery& query, const boost::function<void(const rosgraph_msgs::Log&)>& callback) const;
+
+  //! Returns the messages matching query, ordered by stamp
+  std::vector<rosgraph_msgs::Log> query(const LogQuery& query) const;
+
+private:
+  void querySegment(const std::string& file_name, const LogQuery& query,
+                    const boost::function<void(const rosgraph_msgs::Log&)>& callback) const;
+
+  std::vector<std::string> segments_;
+};
+
+} // namespace rosout
+
+#endif
@@ -30,6 +30,10 @@
 #include <cstring>
 #include <cstdlib>
 #include <cctype>
+#include <deque>
+
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread.hpp>
 
 #include "ros/ros.h"
 #include "ros/file_log.h"
@@ -42,6 +46,7 @@
   #endif
 #endif
 #include "rosgraph_msgs/Log.h"
+#include "rosout/binary_log.h"
 
 /**
  * @mainpage
@@ -54,6 +59,14 @@
 
 /**
  * the rosout node subscribes to /rosout, logs the messages to file, and re-broadcasts the messages to /rosout_agg
+ *
+ * Messages are formatted and written to file by a separate thread, in batches. It flushes the file every
+ * /rosout/flush_interval seconds (default 1.0). At most /rosout/queue_size messages (default 10000) wait to be
+ * written; more are dropped, and the number dropped is written to the file.
+ *
+ * /rosout/log_format selects the files written: "text" (default) for rosout.log, "binary" for the indexed
+ * segments read by rosout::BinaryLogReader, or "both". Like rosout.log and its backups, at most 11 segments of
+ * 100 MB are kept.
  */
 class Rosout
 {
@@ -68,6 +81,17 @@ public:
   ros::Subscriber rosout_sub_;
   ros::Publisher agg_pub_;
   bool omit_topics_;
+  boost::scoped_ptr<rosout::BinaryLogWriter> binary_log_;
+
+  size_t max_queue_size_;
+  double flush_interval_;
+  std::deque<rosgraph_msgs::Log::ConstPtr> queue_;  // Messages waiting for the writer thread
+  size_t dropped_;                                  // Messages dropped since the writer thread last reported it
+  bool shutting_down_;
+  boost::mutex queue_mutex_;                        // Protects the three members above
+  boost::condition_variable queue_condition_;
+  std::string buffer_;                              // Formatted lines the writer thread has not written yet
+  boost::thread writer_thread_;
 
   Rosout() :
     log_file_name_(ros::file_log::getLogDirectory() + "/rosout.log"),
@@ -76,11 +100,35 @@ public:
     current_file_size_(0),
     max_backup_index_(10),
     current_backup_index_(0),
-    omit_topics_(false)
+    omit_topics_(false),
+    max_queue_size_(10000),
+    flush_interval_(1.0),
+    dropped_(0),
+    shutting_down_(false)
   {
     init();
   }
 
+  ~Rosout()
+  {
+    {
+      boost::mutex::scoped_lock lock(queue_mutex_);
+      shutting_down_ = true;
+      queue_condition_.notify_all();
+    }
+
+    if (writer_thread_.joinable())
+    {
+      writer_thread_.join();
+    }
+
+    if (handle_ && fclose(handle_))
+    {
+      std::cerr << "Error closing rosout log file '" << log_file_name_.c_str() << "': " << strerror(errno) << std::endl;
+    }
+    binary_log_.reset();
+  }
+
   void init()
   {
     const char* disable_file_logging_env = getenv("ROSOUT_DISABLE_FILE_LOGGING");
@@ -96,161 +144,330 @@ public:
       disable_file_logging == "off" ||
       disable_file_logging == "no")
     {
-      handle_ = fopen(log_file_name_.c_str(), "w");
-
-      if (handle_ == 0)
+      std::string log_format("text");
+      node_.getParam("/rosout/log_format", log_format);
+      if (log_format != "text" && log_format != "binary" && log_format != "both")
       {
-        std::cerr << "Error opening rosout log file '" << log_file_name_.c_str() << "': " << strerror(errno);
+        std::cerr << "Unknown rosout log format '" << log_format << "', logging as text" << std::endl;
+        log_format = "text";
       }
-      else
+      if (log_format != "text")
       {
-        std::cout << "logging to " << log_file_name_.c_str() << std::endl;
-
-        std::stringstream ss;
-        ss <<  "\n\n" << ros::Time::now() << "  Node Startup\n";
-        int written = fprintf(handle_, "%s", ss.str().c_str());
-        if (written < 0)
-        {
-          std::cerr << "Error writting to rosout log file '" << log_file_name_.c_str() << "': " << strerror(ferror(handle_)) << std::endl;
-        }
-        else if (written > 0)
-        {
-          current_file_size_ += written;
-          if (fflush(handle_))
-          {
-            std::cerr << "Error flushing rosout log file '" << log_file_name_.c_str() << "': " << strerror(ferror(handle_));
-          }
-        }
+        std::string binary_log_prefix = ros::file_log::getLogDirectory() + "/rosout";
+        // Keep as much as the text log and its backups
+        binary_log_.reset(new rosout::BinaryLogWriter(binary_log_prefix, max_file_size_, max_backup_index_ + 1));
+        std::cout << "logging to " << binary_log_prefix << ".*.bin" << std::endl;
       }
+      if (log_format != "binary")
+      {
+        openTextLog();
+      }
+    }
+
+    int queue_size;
+    if (node_.getParam("/rosout/queue_size", queue_size) && queue_size > 0)
+    {
+      max_queue_size_ = queue_size;
+    }
+    node_.getParam("/rosout/flush_interval", flush_interval_);
+
+    if (handle_ || binary_log_)
+    {
+      writer_thread_ = boost::thread(boost::bind(&Rosout::writerThread, this));
     }
 
     agg_pub_ = node_.advertise<rosgraph_msgs::Log>("/rosout_agg", 0);
     std::cout << "re-publishing aggregated messages to /rosout_agg" << std::endl;
 
-    rosout_sub_ = node_.subscribe("/rosout", 0, &Rosout::rosoutCallback, this);
+    rosout_sub_ = node_.subscribe("/rosout", max_queue_size_, &Rosout::rosoutCallback, this);
     std::cout << "subscribed to /rosout" << std::endl;
   }
 
+  void openTextLog()
+  {
+    handle_ = fopen(log_file_name_.c_str(), "w");
+
+    if (handle_ == 0)
+    {
+      std::cerr << "Error opening rosout log file '" << log_file_name_.c_str() << "': " << strerror(errno);
+    }
+    else
+    {
+      std::cout << "logging to " << log_file_name_.c_str() << std::endl;
+
+      std::stringstream ss;
+      ss <<  "\n\n" << ros::Time::now() << "  Node Startup\n";
+      int written = fprintf(handle_, "%s", ss.str().c_str());
+      if (written < 0)
+      {
+        std::cerr << "Error writting to rosout log file '" << log_file_name_.c_str() << "': " << strerror(ferror(handle_)) << std::endl;
+      }
+      else if (written > 0)
+      {
+        current_file_size_ += written;
+        if (fflush(handle_))
+        {
+          std::cerr << "Error flushing rosout log file '" << log_file_name_.c_str() << "': " << strerror(ferror(handle_));
+        }
+      }
+    }
+  }
+
   void rosoutCallback(const rosgraph_msgs::Log::ConstPtr& msg)
   {
     agg_pub_.publish(msg);
 
-    if (!handle_)
+    // Only queue messages if the writer thread was started for the log file
+    if (!writer_thread_.joinable())
     {
       return;
     }
 
-    std::stringstream ss;
-    ss << msg->header.stamp << " ";
-    switch (msg->level)
+    boost::mutex::scoped_lock lock(queue_mutex_);
+    if (queue_.size() >= max_queue_size_)
+    {
+      ++dropped_;
+      return;
+    }
+    queue_.push_back(msg);
+    queue_condition_.notify_one();
+  }
+
+  void writerThread()
+  {
+    std::deque<rosgraph_msgs::Log::ConstPtr> local_queue;
+    ros::WallTime last_flush;
+    bool unflushed = false;
+    bool shutting_down = false;
+
+    while (!shutting_down)
+    {
+      size_t dropped;
+      {
+        boost::mutex::scoped_lock lock(queue_mutex_);
+
+        if (queue_.empty() && !shutting_down_)
+        {
+          if (!unflushed)
+          {
+            queue_condition_.wait(lock);
+          }
+          else
+          {
+            // Wait for more messages until the file is due to be flushed
+            ros::WallDuration to_flush = last_flush + ros::WallDuration(flush_interval_) - ros::WallTime::now();
+            if (to_flush > ros::WallDuration())
+            {
+              queue_condition_.wait_for(lock, boost::chrono::nanoseconds(to_flush.toNSec()));
+            }
+          }
+        }
+
+        local_queue.swap(queue_);
+        dropped = dropped_;
+        dropped_ = 0;
+        shutting_down = shutting_down_;
+      }
+
+      // check parameter server for omit_topics flag and set class member
+      node_.getParamCached("/rosout/omit_topics", omit_topics_);
+
+      for (size_t i = 0; i < local_queue.size(); ++i)
+      {
+        if (handle_)
+        {
+          appendLine(*local_queue[i]);
+        }
+        if (binary_log_)
+        {
+          unflushed = binary_log_->write(*local_queue[i]) || unflushed;
+        }
+      }
+      local_queue.clear();
+
+      if (dropped > 0)
+      {
+        appendDropped(dropped);
+      }
+
+      unflushed = writeBuffer() || unflushed;
+
+      // The first messages after a quiet period are flushed right away, later ones once per flush interval
+      if (unflushed && (shutting_down || ros::WallTime::now() - last_flush >= ros::WallDuration(flush_interval_)))
+      {
+        if (handle_ && fflush(handle_))
+        {
+          std::cerr << "Error flushing rosout log file '" << log_file_name_.c_str() << "': " << strerror(errno);
+        }
+        if (binary_log_ && !binary_log_->flush())
+        {
+          std::cerr << "Error flushing rosout binary log: " << strerror(errno) << std::endl;
+        }
+        last_flush = ros::WallTime::now();
+        unflushed = false;
+      }
+    }
+  }
+
+  void appendTime(const ros::Time& time)
+  {
+    char stamp[32];
+    int len = snprintf(stamp, sizeof(stamp), "%u.%09u ", time.sec, time.nsec);
+    buffer_.append(stamp, len);
+  }
+
+  // Formats msg into buffer_, and rotates the log file once it grows too big
+  void appendLine(const rosgraph_msgs::Log& msg)
+  {
+    size_t start = buffer_.size();
+
+    appendTime(msg.header.stamp);
+    switch (msg.level)
     {
     case rosgraph_msgs::Log::FATAL:
-      ss << "FATAL ";
+      buffer_ += "FATAL ";
       break;
     case rosgraph_msgs::Log::ERROR:
-      ss << "ERROR ";
+      buffer_ += "ERROR ";
       break;
     case rosgraph_msgs::Log::WARN:
-      ss << "WARN ";
+      buffer_ += "WARN ";
       break;
     case rosgraph_msgs::Log::DEBUG:
-      ss << "DEBUG ";
+      buffer_ += "DEBUG ";
       break;
     case rosgraph_msgs::Log::INFO:
-      ss << "INFO ";
+      buffer_ += "INFO ";
       break;
     default:
-      ss << msg->level << " ";
+      buffer_ += msg.level;
+      buffer_ += ' ';
     }
 
-    ss << msg->name << " ";
-    ss << "[" << msg->file << ":" << msg->line << "(" << msg->function << ")] ";
-
-    // check parameter server for omit_topics flag and set class member
-    node_.getParamCached("/rosout/omit_topics", omit_topics_);
+    buffer_ += msg.name;
+    buffer_ += " [";
+    buffer_ += msg.file;
+    char line[16];
+    int len = snprintf(line, sizeof(line), ":%u(", msg.line);
+    buffer_.append(line, len);
+    buffer_ += msg.function;
+    buffer_ += ")] ";
 
     if (!omit_topics_)
     {
-      ss << "[topics: ";
-      std::vector<std::string>::const_iterator it = msg->topics.begin();
-      std::vector<std::string>::const_iterator end = msg->topics.end();
+      buffer_ += "[topics: ";
+      std::vector<std::string>::const_iterator it = msg.topics.begin();
+      std::vector<std::string>::const_iterator end = msg.topics.end();
       for ( ; it != end; ++it )
       {
         const std::string& topic = *it;
 
-        if ( it != msg->topics.begin() )
+        if ( it != msg.topics.begin() )
         {
-          ss << ", ";
+          buffer_ += ", ";
         }
 
-        ss << topic;
+        buffer_ += topic;
       }
-      ss << "] ";
+      buffer_ += "] ";
+    }
+
+    buffer_ += msg.msg;
+    buffer_ += '\n';
+
+    current_file_size_ += buffer_.size() - start;
+    // check for rolling
+    if (current_file_size_ > max_file_size_)
+    {
+      writeBuffer();
+      rotate();
+    }
+  }
+
+  void appendDropped(size_t dropped)
+  {
+    rosgraph_msgs::Log msg;
+    msg.header.stamp = ros::Time::now();
+    msg.level = rosgraph_msgs::Log::WARN;
+    msg.name = "/rosout";
+    msg.file = __FILE__;
+    msg.function = __FUNCTION__;
+    msg.line = __LINE__;
+    std::stringstream ss;
+    ss << "Dropped " << dropped << " messages because they could not be written to file fast enough";
+    msg.msg = ss.str();
+    if (handle_)
+    {
+      appendLine(msg);
+    }
+    if (binary_log_)
+    {
+      binary_log_->write(msg);
+    }
+  }
+
+  // Returns true if anything was written
+  bool writeBuffer()
+  {
+    if (!handle_ || buffer_.empty())
+    {
+      buffer_.clear();
+      return false;
     }
 
-    ss << msg->msg;
-    ss << "\n";
-    int written = fprintf(handle_, "%s", ss.str().c_str());
-    if (written < 0)
+    if (fwrite(buffer_.data(), 1, buffer_.size(), handle_) != buffer_.size())
     {
       std::cerr << "Error writting to rosout log file '" << log_file_name_.c_str() << "': " << strerror(ferror(handle_)) << std::endl;
     }
-    else if (written > 0)
+    buffer_.clear();
+    return true;
+  }
+
+  void rotate()
+  {
+    std::cout << "rosout log file " << log_file_name_.c_str() << " reached max size, rotating log files" << std::endl;
+    if (fclose(handle_))
+    {
+      std::cerr << "Error closing rosout log file '" << log_file_name_.c_str() << "': " << strerror(errno) << std::endl;
+    }
+    if (current_backup_index_ == max_backup_index_)
     {
-      current_file_size_ += written;
-      if (fflush(handle_))
+      std::stringstream backup_file_name;
+      backup_file_name << log_file_name_ << "." << max_backup_index_;
+      int rc = remove(backup_file_name.str().c_str());
+      if (rc != 0)
       {
-        std::cerr << "Error flushing rosout log file '" << log_file_name_.c_str() << "': " << strerror(errno);
+        std::cerr << "Error deleting oldest rosout log file '" << backup_file_name.str().c_str() << "': " << strerror(errno) << std::endl;
       }
-
-      // check for rolling
-      if (current_file_size_ > max_file_size_)
+    }
+    std::size_t i = std::min(max_backup_index_, current_backup_index_ + 1);
+    while (i > 0)
+    {
+      std::stringstream current_file_name;
+      current_file_name << log_file_name_;
+      if (i > 1)
       {
-        std::cout << "rosout log file " << log_file_name_.c_str() << " reached max size, rotating log files" << std::endl;
-        if (fclose(handle_))
-        {
-          std::cerr << "Error closing rosout log file '" << log_file_name_.c_str() << "': " << strerror(errno) << std::endl;
-        }
-        if (current_backup_index_ == max_backup_index_)
-        {
-          std::stringstream backup_file_name;
-          backup_file_name << log_file_name_ << "." << max_backup_index_;
-          int rc = remove(backup_file_name.str().c_str());
-          if (rc != 0)
-          {
-            std::cerr << "Error deleting oldest rosout log file '" << backup_file_name.str().c_str() << "': " << strerror(errno) << std::endl;
-          }
-        }
-        std::size_t i = std::min(max_backup_index_, current_backup_index_ + 1);
-        while (i > 0)
-        {
-          std::stringstream current_file_name;
-          current_file_name << log_file_name_;
-          if (i > 1)
-          {
-            current_file_name << "." << (i - 1);
-          }
-          std::stringstream rotated_file_name;
-          rotated_file_name << log_file_name_ << "." << i;
-          int rc = rename(current_file_name.str().c_str(), rotated_file_name.str().c_str());
-          if (rc != 0)
-          {
-            std::cerr << "Error rotating rosout log file '" << current_file_name.str().c_str() << "' to '" << rotated_file_name.str().c_str() << "': " << strerror(errno) << std::endl;
-          }
-          --i;
-        }
-        if (current_backup_index_ < max_backup_index_)
-        {
-          ++current_backup_index_;
-        }
-        handle_ = fopen(log_file_name_.c_str(), "w");
-        if (handle_ == 0)
-        {
-          std::cerr << "Error opening rosout log file '" << log_file_name_.c_str() << "': " << strerror(errno);
-        }
-        current_file_size_ = 0;
+        current_file_name << "." << (i - 1);
+      }
+      std::stringstream rotated_file_name;
+      rotated_file_name << log_file_name_ << "." << i;
+      int rc = rename(current_file_name.str().c_str(), rotated_file_name.str().c_str());
+      if (rc != 0)
+      {
+        std::cerr << "Error rotating rosout log file '" << current_file_name.str().c_str() << "' to '" << rotated_file_name.str().c_str() << "': " << strerror(errno) << std::endl;
       }
+      --i;
+    }
+    if (current_backup_index_ < max_backup_index_)
+    {
+      ++current_backup_index_;
+    }
+    handle_ = fopen(log_file_name_.c_str(), "w");
+    if (handle_ == 0)
+    {
+      std::cerr << "Error opening rosout log file '" << log_file_name_.c_str() << "': " << strerror(errno);
     }
+    current_file_size_ = 0;
   }
 };
 
@@ -264,4 +481,3 @@ int main(int argc, char **argv)
 
   return 0;
 }
-
@@ -0,0 +1,594 @@
+/*
+ * Copyright (c) 2008, Willow Garage, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of Willow Garage, Inc. nor the names of its
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "rosout/binary_log.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+
+#include <boost/bind.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include "ros/serialization.h"
+
+#ifdef _WIN32
+#  ifdef __MINGW32__
+#    define fseeko fseeko64
+#    define ftello ftello64
+#  else
+#    define fseeko _fseeki64
+#    define ftello _ftelli64
+#  endif
+#endif
+
+namespace rosout
+{
+
+namespace
+{
+
+// A segment is a header, records of a uint32 length followed by a serialized rosgraph_msgs::Log, and once it
+// is complete an index and a trailer pointing to it. The index lists the node names, the mask of the levels
+// present, and an entry per record sorted by stamp. All integers are little endian.
+const char SEGMENT_MAGIC[] = "ROSOUTB1";
+const char INDEX_MAGIC[] = "ROSOUTI1";
+const size_t MAGIC_SIZE = 8;
+const size_t TRAILER_SIZE = 8 + MAGIC_SIZE;
+const size_t INDEX_ENTRY_SIZE = 24;  // sec, nsec, offset, node, level and padding
+
+void appendUint32(std::vector<uint8_t>& buffer, uint32_t value)
+{
+  for (int i = 0; i < 4; ++i)
+  {
+    buffer.push_back((value >> (8 * i)) & 0xff);
+  }
+}
+
+void appendUint64(std::vector<uint8_t>& buffer, uint64_t value)
+{
+  for (int i = 0; i < 8; ++i)
+  {
+    buffer.push_back((value >> (8 * i)) & 0xff);
+  }
+}
+
+uint32_t readUint32(const uint8_t* data)
+{
+  return data[0] | (data[1] << 8) | (data[2] << 16) | ((uint32_t)data[3] << 24);
+}
+
+uint64_t readUint64(const uint8_t* data)
+{
+  return readUint32(data) | ((uint64_t)readUint32(data + 4) << 32);
+}
+
+ros::Time readStamp(const uint8_t* entry)
+{
+  return ros::Time(readUint32(entry), readUint32(entry + 4));
+}
+
+// Numbers and paths of the segments with the given prefix, sorted by number
+std::vector<std::pair<uint32_t, std::string> > findSegments(const std::string& prefix)
+{
+  std::vector<std::pair<uint32_t, std::string> > segments;
+
+  boost::filesystem::path path(prefix);
+  boost::filesystem::path dir = path.has_parent_path() ? path.parent_path() : boost::filesystem::path(".");
+  std::string base = path.filename().string() + ".";
+  if (!boost::filesystem::is_directory(dir))
+  {
+    return segments;
+  }
+
+  boost::filesystem::directory_iterator end;
+  for (boost::filesystem::directory_iterator it(dir); it != end; ++it)
+  {
+    std::string name = it->path().filename().string();
+    if (name.size() <= base.size() + 4 || name.compare(0, base.size(), base) != 0 ||
+        name.compare(name.size() - 4, 4, ".bin") != 0)
+    {
+      continue;
+    }
+    std::string number = name.substr(base.size(), name.size() - base.size() - 4);
+    if (number.find_first_not_of("0123456789") != std::string::npos)
+    {
+      continue;
+    }
+    segments.push_back(std::make_pair((uint32_t)strtoul(number.c_str(), NULL, 10), it->path().string()));
+  }
+
+  std::sort(segments.begin(), segments.end());
+  return segments;
+}
+
+struct CompareStamps
+{
+  template<typename T>
+  bool operator()(const T& a, const T& b) const
+  {
+    return stamp(a) < stamp(b);
+  }
+
+  template<typename T>
+  static const ros::Time& stamp(const T& entry) { return entry.stamp; }
+  static const ros::Time& stamp(const rosgraph_msgs::Log& msg) { return msg.header.stamp; }
+};
+
+void appendMessage(std::vector<rosgraph_msgs::Log>* messages, const rosgraph_msgs::Log& msg)
+{
+  messages->push_back(msg);
+}
+
+void readAt(FILE* file, const std::string& file_name, uint64_t offset, void* data, size_t size)
+{
+  if (fseeko(file, offset, SEEK_SET) != 0 || fread(data, 1, size, file) != size)
+  {
+    throw std::runtime_error("Error reading rosout binary log segment '" + file_name + "'");
+  }
+}
+
+// Returns false unless data holds exactly one serialized message
+bool deserialize(std::vector<uint8_t>& data, rosgraph_msgs::Log& msg)
+{
+  ros::serialization::IStream stream(data.empty() ? NULL : &data[0], data.size());
+  try
+  {
+    ros::serialization::deserialize(stream, msg);
+  }
+  catch (const ros::serialization::StreamOverrunException&)
+  {
+    return false;
+  }
+  return stream.getLength() == 0;
+}
+
+} // namespace
+
+BinaryLogWriter::BinaryLogWriter(const std::string& prefix, uint64_t max_segment_size, uint32_t max_segments)
+: prefix_(prefix)
+, max_segment_size_(max_segment_size)
+, max_segments_(max_segments)
+, segment_number_(0)
+, file_(NULL)
+, offset_(0)
+{
+  std::vector<std::pair<uint32_t, std::string> > segments = findSegments(prefix);
+  if (!segments.empty())
+  {
+    segment_number_ = segments.back().first + 1;
+  }
+}
+
+BinaryLogWriter::~BinaryLogWriter()
+{
+  close();
+}
+
+void BinaryLogWriter::removeOldSegments()
+{
+  // Make room for the segment about to be opened
+  std::vector<std::pair<uint32_t, std::string> > segments = findSegments(prefix_);
+  for (size_t i = 0; i + max_segments_ <= segments.size(); ++i)
+  {
+    boost::system::error_code error;
+    boost::filesystem::remove(segments[i].second, error);
+    if (error)
+    {
+      std::cerr << "Error removing rosout binary log segment '" << segments[i].second << "': " << error.message() << std::endl;
+    }
+  }
+}
+
+bool BinaryLogWriter::openSegment()
+{
+  if (max_segments_ > 0)
+  {
+    removeOldSegments();
+  }
+
+  std::stringstream file_name;
+  file_name << prefix_ << "." << segment_number_ << ".bin";
+  file_name_ = file_name.str();
+
+  file_ = fopen(file_name_.c_str(), "wb");
+  if (!file_)
+  {
+    std::cerr << "Error opening rosout binary log segment '" << file_name_ << "': " << strerror(errno) << std::endl;
+    return false;
+  }
+  if (fwrite(SEGMENT_MAGIC, 1, MAGIC_SIZE, file_) != MAGIC_SIZE)
+  {
+    std::cerr << "Error writing to rosout binary log segment '" << file_name_ << "': " << strerror(errno) << std::endl;
+    fclose(file_);
+    file_ = NULL;
+    return false;
+  }
+  offset_ = MAGIC_SIZE;
+  return true;
+}
+
+bool BinaryLogWriter::write(const rosgraph_msgs::Log& msg)
+{
+  if (!file_ && !openSegment())
+  {
+    return false;
+  }
+
+  uint32_t length = ros::serialization::serializationLength(msg);
+  buffer_.clear();
+  appendUint32(buffer_, length);
+  buffer_.resize(4 + length);
+  ros::serialization::OStream stream(&buffer_[4], length);
+  ros::serialization::serialize(stream, msg);
+
+  if (fwrite(&buffer_[0], 1, buffer_.size(), file_) != buffer_.size())
+  {
+    std::cerr << "Error writing to rosout binary log segment '" << file_name_ << "': " << strerror(errno) << std::endl;
+    if (!truncateToWritten())
+    {
+      std::cerr << "Leaving rosout binary log segment '" << file_name_ << "' without an index" << std::endl;
+      closeFile();
+    }
+    return false;
+  }
+
+  IndexEntry entry;
+  entry.stamp = msg.header.stamp;
+  entry.offset = offset_;
+  entry.node = nodes_.insert(std::make_pair(msg.name, (uint32_t)nodes_.size())).first->second;
+  entry.level = msg.level;
+  index_.push_back(entry);
+  offset_ += buffer_.size();
+
+  if (offset_ >= max_segment_size_)
+  {
+    close();
+  }
+  return true;
+}
+
+bool BinaryLogWriter::truncateToWritten()
+{
+  // The index refers to records by offset, so the segment has to end after the last record that reached the
+  // file for the next one to be where it is indexed. Records still buffered when the write failed are lost too.
+  clearerr(file_);
+  if (fflush(file_) != 0)
+  {
+    return false;
+  }
+  boost::system::error_code error;
+  uint64_t size = boost::filesystem::file_size(file_name_, error);
+  if (error || size < MAGIC_SIZE)
+  {
+    return false;
+  }
+
+  uint64_t end = offset_;
+  size_t lost = 0;
+  while (!index_.empty() && end > size)
+  {
+    end = index_.back().offset;
+    index_.pop_back();
+    ++lost;
+  }
+  if (fseeko(file_, end, SEEK_SET) != 0)
+  {
+    return false;
+  }
+  boost::filesystem::resize_file(file_name_, end, error);
+  if (error)
+  {
+    return false;
+  }
+
+  if (lost > 0)
+  {
+    std::cerr << lost << " messages already written to rosout binary log segment '" << file_name_ << "' were lost" << std::endl;
+  }
+  offset_ = end;
+  return true;
+}
+
+void BinaryLogWriter::closeFile()
+{
+  if (fclose(file_))
+  {
+    std::cerr << "Error closing rosout binary log segment '" << file_name_ << "': " << strerror(errno) << std::endl;
+  }
+
+  file_ = NULL;
+  nodes_.clear();
+  index_.clear();
+  ++segment_number_;
+}
+
+bool BinaryLogWriter::flush()
+{
+  return !file_ || fflush(file_) == 0;
+}
+
+void BinaryLogWriter::close()
+{
+  if (!file_)
+  {
+    return;
+  }
+
+  // Nodes in the order of their position
+  std::vector<std::string const*> names(nodes_.size());
+  for (std::map<std::string, uint32_t>::const_iterator it = nodes_.begin(); it != nodes_.end(); ++it)
+  {
+    names[it->second] = &it->first;
+  }
+
+  // Messages from different nodes arrive a little out of order
+  std::stable_sort(index_.begin(), index_.end(), CompareStamps());
+
+  buffer_.clear();
+  appendUint32(buffer_, names.size());
+  for (size_t i = 0; i < names.size(); ++i)
+  {
+    appendUint32(buffer_, names[i]->size());
+    buffer_.insert(buffer_.end(), names[i]->begin(), names[i]->end());
+  }
+
+  uint32_t level_mask = 0;
+  for (size_t i = 0; i < index_.size(); ++i)
+  {
+    level_mask |= index_[i].level;
+  }
+  appendUint32(buffer_, level_mask);
+
+  appendUint32(buffer_, index_.size());
+  for (size_t i = 0; i < index_.size(); ++i)
+  {
+    const IndexEntry& entry = index_[i];
+    appendUint32(buffer_, entry.stamp.sec);
+    appendUint32(buffer_, entry.stamp.nsec);
+    appendUint64(buffer_, entry.offset);
+    appendUint32(buffer_, entry.node);
+    appendUint32(buffer_, entry.level);
+  }
+
+  appendUint64(buffer_, offset_);
+  buffer_.insert(buffer_.end(), INDEX_MAGIC, INDEX_MAGIC + MAGIC_SIZE);
+
+  if (fwrite(&buffer_[0], 1, buffer_.size(), file_) != buffer_.size() || fflush(file_) != 0)
+  {
+    std::cerr << "Error writing the index of rosout binary log segment '" << file_name_ << "': " << strerror(errno) << std::endl;
+    // Without its trailer the segment is read record by record, so remove the part of the index that was written
+    if (!truncateToWritten())
+    {
+      std::cerr << "Leaving rosout binary log segment '" << file_name_ << "' with part of an index" << std::endl;
+    }
+  }
+  closeFile();
+}
+
+LogQuery::LogQuery()
+: start()
+, end(ros::TIME_MAX)
+, levels(0xff)
+{
+}
+
+BinaryLogReader::BinaryLogReader(const std::string& prefix)
+{
+  std::vector<std::pair<uint32_t, std::string> > segments = findSegments(prefix);
+  for (size_t i = 0; i < segments.size(); ++i)
+  {
+    segments_.push_back(segments[i].second);
+  }
+}
+
+std::vector<std::string> const& BinaryLogReader::getSegments() const
+{
+  return segments_;
+}
+
+void BinaryLogReader::query(const LogQuery& query, const boost::function<void(const rosgraph_msgs::Log&)>& callback) const
+{
+  for (size_t i = 0; i < segments_.size(); ++i)
+  {
+    querySegment(segments_[i], query, callback);
+  }
+}
+
+std::vector<rosgraph_msgs::Log> BinaryLogReader::query(const LogQuery& query) const
+{
+  std::vector<rosgraph_msgs::Log> messages;
+  this->query(query, boost::bind(appendMessage, &messages, _1));
+  std::stable_sort(messages.begin(), messages.end(), CompareStamps());
+  return messages;
+}
+
+void BinaryLogReader::querySegment(const std::string& file_name, const LogQuery& query,
+                                   const boost::function<void(const rosgraph_msgs::Log&)>& callback) const
+{
+  boost::shared_ptr<FILE> file(fopen(file_name.c_str(), "rb"), fclose);
+  if (!file)
+  {
+    throw std::runtime_error("Error opening rosout binary log segment '" + file_name + "': " + strerror(errno));
+  }
+
+  char magic[MAGIC_SIZE];
+  readAt(file.get(), file_name, 0, magic, MAGIC_SIZE);
+  if (memcmp(magic, SEGMENT_MAGIC, MAGIC_SIZE) != 0)
+  {
+    throw std::runtime_error("Not a rosout binary log segment: '" + file_name + "'");
+  }
+
+  if (fseeko(file.get(), 0, SEEK_END) != 0)
+  {
+    throw std::runtime_error("Error reading rosout binary log segment '" + file_name + "'");
+  }
+  uint64_t size = ftello(file.get());
+
+  std::vector<uint8_t> data;
+  rosgraph_msgs::Log msg;
+
+  uint8_t trailer[TRAILER_SIZE];
+  bool complete = false;
+  uint64_t index_offset = 0;
+  if (size >= MAGIC_SIZE + TRAILER_SIZE)
+  {
+    readAt(file.get(), file_name, size - TRAILER_SIZE, trailer, TRAILER_SIZE);
+    index_offset = readUint64(trailer);
+    complete = memcmp(trailer + 8, INDEX_MAGIC, MAGIC_SIZE) == 0 && index_offset >= MAGIC_SIZE &&
+               index_offset <= size - TRAILER_SIZE;
+  }
+
+  if (!complete)
+  {
+    // The segment is still being written, or its writer stopped before completing it: go through all of it,
+    // up to a record that was not written entirely, or to part of an index that failed to be written
+    uint64_t offset = MAGIC_SIZE;
+    uint8_t length_data[4];
+    while (offset + 4 <= size)
+    {
+      readAt(file.get(), file_name, offset, length_data, 4);
+      uint32_t length = readUint32(length_data);
+      if (offset + 4 + length > size)
+      {
+        break;
+      }
+      data.resize(length);
+      readAt(file.get(), file_name, offset + 4, data.empty() ? NULL : &data[0], length);
+      offset += 4 + length;
+
+      if (!deserialize(data, msg))
+      {
+        break;
+      }
+      if (msg.header.stamp >= query.start && msg.header.stamp <= query.end && (msg.level & query.levels) &&
+          (query.node.empty() || msg.name == query.node))
+      {
+        callback(msg);
+      }
+    }
+    return;
+  }
+
+  std::vector<uint8_t> index(size - TRAILER_SIZE - index_offset);
+  readAt(file.get(), file_name, index_offset, index.empty() ? NULL : &index[0], index.size());
+  const uint8_t* pos = index.empty() ? NULL : &index[0];
+  const uint8_t* end = pos + index.size();
+
+  // Find the node, if only one is selected
+  if (end - pos < 4)
+  {
+    throw std::runtime_error("Corrupt index in rosout binary log segment '" + file_name + "'");
+  }
+  uint32_t node_count = readUint32(pos);
+  pos += 4;
+  bool node_found = query.node.empty();
+  uint32_t node = 0;
+  for (uint32_t i = 0; i < node_count; ++i)
+  {
+    if (end - pos < 4 || (uint64_t)(end - pos - 4) < readUint32(pos))
+    {
+      throw std::runtime_error("Corrupt index in rosout binary log segment '" + file_name + "'");
+    }
+    uint32_t length = readUint32(pos);
+    if (!node_found && query.node.compare(0, std::string::npos, (const char*) pos + 4, length) == 0)
+    {
+      node_found = true;
+      node = i;
+    }
+    pos += 4 + length;
+  }
+  if (end - pos < 8)
+  {
+    throw std::runtime_error("Corrupt index in rosout binary log segment '" + file_name + "'");
+  }
+  uint32_t level_mask = readUint32(pos);
+  uint32_t entry_count = readUint32(pos + 4);
+  pos += 8;
+  if (!node_found || !(level_mask & query.levels))
+  {
+    return;
+  }
+  if ((uint64_t)(end - pos) < (uint64_t)entry_count * INDEX_ENTRY_SIZE)
+  {
+    throw std::runtime_error("Corrupt index in rosout binary log segment '" + file_name + "'");
+  }
+
+  // Binary search for the first entry not before the start of the query
+  uint32_t first = 0;
+  uint32_t count = entry_count;
+  while (count > 0)
+  {
+    uint32_t step = count / 2;
+    if (readStamp(pos + (first + step) * INDEX_ENTRY_SIZE) < query.start)
+    {
+      first += step + 1;
+      count -= step + 1;
+    }
+    else
+    {
+      count = step;
+    }
+  }
+
+  uint8_t length_data[4];
+  for (uint32_t i = first; i < entry_count; ++i)
+  {
+    const uint8_t* entry = pos + i * INDEX_ENTRY_SIZE;
+    if (readStamp(entry) > query.end)
+    {
+      break;
+    }
+    if ((!query.node.empty() && readUint32(entry + 16) != node) || !(entry[20] & query.levels))
+    {
+      continue;
+    }
+
+    uint64_t offset = readUint64(entry + 8);
+    readAt(file.get(), file_name, offset, length_data, 4);
+    uint32_t length = readUint32(length_data);
+    if (offset + 4 + length > index_offset)
+    {
+      throw std::runtime_error("Corrupt index in rosout binary log segment '" + file_name + "'");
+    }
+    data.resize(length);
+    readAt(file.get(), file_name, offset + 4, data.empty() ? NULL : &data[0], length);
+    if (!deserialize(data, msg))
+    {
+      throw std::runtime_error("Corrupt record in rosout binary log segment '" + file_name + "'");
+    }
+    callback(msg);
+  }
+}
+
+} // namespace rosout
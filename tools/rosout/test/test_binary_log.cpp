@@ -0,0 +1,322 @@
+/*
+ * Copyright (c) 2008, Willow Garage, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of Willow Garage, Inc. nor the names of its
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <csignal>
+#include <cstdio>
+#include <sstream>
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+#include <gtest/gtest.h>
+
+#include <boost/filesystem.hpp>
+
+#include "rosout/binary_log.h"
+
+using namespace rosout;
+
+class BinaryLogTest : public testing::Test
+{
+protected:
+  virtual void SetUp()
+  {
+    dir_ = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path();
+    boost::filesystem::create_directories(dir_);
+    prefix_ = (dir_ / "rosout").string();
+  }
+
+  virtual void TearDown()
+  {
+    boost::filesystem::remove_all(dir_);
+  }
+
+  static rosgraph_msgs::Log makeLog(uint32_t sec, uint8_t level, const std::string& name)
+  {
+    rosgraph_msgs::Log msg;
+    msg.header.stamp = ros::Time(sec, 0);
+    msg.level = level;
+    msg.name = name;
+    std::stringstream ss;
+    ss << name << " " << sec;
+    msg.msg = ss.str();
+    msg.file = "file.cpp";
+    msg.function = "function";
+    msg.line = sec;
+    msg.topics.push_back("/rosout");
+    return msg;
+  }
+
+  boost::filesystem::path dir_;
+  std::string prefix_;
+};
+
+TEST_F(BinaryLogTest, roundTrip)
+{
+  {
+    BinaryLogWriter writer(prefix_);
+    // Out of order, as messages from different nodes may arrive
+    uint32_t secs[] = { 3, 1, 2, 5, 4 };
+    for (size_t i = 0; i < 5; ++i)
+    {
+      ASSERT_TRUE(writer.write(makeLog(secs[i], rosgraph_msgs::Log::INFO, "/node")));
+    }
+  }
+
+  BinaryLogReader reader(prefix_);
+  ASSERT_EQ(reader.getSegments().size(), 1U);
+  std::vector<rosgraph_msgs::Log> messages = reader.query(LogQuery());
+  ASSERT_EQ(messages.size(), 5U);
+  for (uint32_t i = 0; i < 5; ++i)
+  {
+    EXPECT_EQ(messages[i].header.stamp, ros::Time(i + 1, 0));
+    EXPECT_EQ(messages[i].msg, makeLog(i + 1, 0, "/node").msg);
+    EXPECT_EQ(messages[i].line, i + 1);
+    ASSERT_EQ(messages[i].topics.size(), 1U);
+    EXPECT_EQ(messages[i].topics[0], "/rosout");
+  }
+}
+
+TEST_F(BinaryLogTest, queries)
+{
+  {
+    // Small segments, so that the queries span several of them
+    BinaryLogWriter writer(prefix_, 1024);
+    for (uint32_t i = 0; i < 100; ++i)
+    {
+      uint8_t level = (i % 10 == 0) ? rosgraph_msgs::Log::ERROR : rosgraph_msgs::Log::INFO;
+      ASSERT_TRUE(writer.write(makeLog(i, level, (i % 2) ? "/odd" : "/even")));
+    }
+  }
+
+  BinaryLogReader reader(prefix_);
+  EXPECT_GT(reader.getSegments().size(), 1U);
+
+  LogQuery query;
+  query.start = ros::Time(20, 0);
+  query.end = ros::Time(29, 0);
+  std::vector<rosgraph_msgs::Log> messages = reader.query(query);
+  ASSERT_EQ(messages.size(), 10U);
+  EXPECT_EQ(messages.front().header.stamp, ros::Time(20, 0));
+  EXPECT_EQ(messages.back().header.stamp, ros::Time(29, 0));
+
+  query.node = "/odd";
+  messages = reader.query(query);
+  ASSERT_EQ(messages.size(), 5U);
+  for (size_t i = 0; i < messages.size(); ++i)
+  {
+    EXPECT_EQ(messages[i].name, "/odd");
+  }
+
+  query = LogQuery();
+  query.levels = rosgraph_msgs::Log::ERROR | rosgraph_msgs::Log::FATAL;
+  messages = reader.query(query);
+  ASSERT_EQ(messages.size(), 10U);
+  for (size_t i = 0; i < messages.size(); ++i)
+  {
+    EXPECT_EQ(messages[i].header.stamp, ros::Time(i * 10, 0));
+  }
+
+  query.node = "/missing";
+  EXPECT_TRUE(reader.query(query).empty());
+}
+
+TEST_F(BinaryLogTest, removesOldestSegments)
+{
+  {
+    BinaryLogWriter writer(prefix_, 1024, 3);
+    for (uint32_t i = 0; i < 100; ++i)
+    {
+      ASSERT_TRUE(writer.write(makeLog(i, rosgraph_msgs::Log::INFO, "/node")));
+    }
+  }
+
+  BinaryLogReader reader(prefix_);
+  ASSERT_EQ(reader.getSegments().size(), 3U);
+  std::vector<rosgraph_msgs::Log> messages = reader.query(LogQuery());
+  ASSERT_FALSE(messages.empty());
+  EXPECT_GT(messages.front().header.stamp, ros::Time(0, 0));
+  EXPECT_EQ(messages.back().header.stamp, ros::Time(99, 0));
+
+  // The segments of an earlier writer count as well
+  {
+    BinaryLogWriter writer(prefix_, 1024, 3);
+    ASSERT_TRUE(writer.write(makeLog(100, rosgraph_msgs::Log::INFO, "/node")));
+  }
+  BinaryLogReader later(prefix_);
+  ASSERT_EQ(later.getSegments().size(), 3U);
+  EXPECT_EQ(later.getSegments()[0], reader.getSegments()[1]);
+  EXPECT_EQ(later.query(LogQuery()).back().header.stamp, ros::Time(100, 0));
+}
+
+TEST_F(BinaryLogTest, incompleteSegment)
+{
+  {
+    BinaryLogWriter writer(prefix_);
+    ASSERT_TRUE(writer.write(makeLog(1, rosgraph_msgs::Log::INFO, "/node")));
+  }
+
+  // A writer that stops without completing its segment, the last message cut short
+  BinaryLogWriter writer(prefix_);
+  for (uint32_t i = 2; i <= 4; ++i)
+  {
+    ASSERT_TRUE(writer.write(makeLog(i, rosgraph_msgs::Log::WARN, "/node")));
+  }
+  ASSERT_TRUE(writer.flush());
+
+  BinaryLogReader reader(prefix_);
+  ASSERT_EQ(reader.getSegments().size(), 2U);
+  const std::string& segment = reader.getSegments()[1];
+  boost::filesystem::resize_file(segment, boost::filesystem::file_size(segment) - 4);
+
+  std::vector<rosgraph_msgs::Log> messages = reader.query(LogQuery());
+  ASSERT_EQ(messages.size(), 3U);
+  EXPECT_EQ(messages[2].header.stamp, ros::Time(3, 0));
+
+  LogQuery query;
+  query.levels = rosgraph_msgs::Log::WARN;
+  EXPECT_EQ(reader.query(query).size(), 2U);
+}
+
+TEST_F(BinaryLogTest, corruptSegment)
+{
+  FILE* file = fopen((prefix_ + ".0.bin").c_str(), "wb");
+  ASSERT_TRUE(file != NULL);
+  fputs("not a log", file);
+  fclose(file);
+
+  BinaryLogReader reader(prefix_);
+  EXPECT_THROW(reader.query(LogQuery()), std::runtime_error);
+}
+
+TEST_F(BinaryLogTest, partOfAnIndex)
+{
+  {
+    BinaryLogWriter writer(prefix_);
+    for (uint32_t i = 1; i <= 20; ++i)
+    {
+      ASSERT_TRUE(writer.write(makeLog(i, rosgraph_msgs::Log::INFO, "/node")));
+    }
+  }
+
+  // As left by a writer that could not remove the part of the index it wrote, without the trailer
+  std::string segment = prefix_ + ".0.bin";
+  boost::filesystem::resize_file(segment, boost::filesystem::file_size(segment) - 100);
+  BinaryLogReader reader(prefix_);
+  std::vector<rosgraph_msgs::Log> messages = reader.query(LogQuery());
+  ASSERT_EQ(messages.size(), 20U);
+  EXPECT_EQ(messages.back().header.stamp, ros::Time(20, 0));
+}
+
+#ifndef _WIN32
+TEST_F(BinaryLogTest, failedWrite)
+{
+  std::string segment = prefix_ + ".0.bin";
+  BinaryLogWriter writer(prefix_);
+  ASSERT_TRUE(writer.write(makeLog(1, rosgraph_msgs::Log::INFO, "/node")));
+  ASSERT_TRUE(writer.flush());
+
+  // Let writes to the segment fail part way, by limiting the size of the files of the process
+  struct rlimit limit;
+  ASSERT_EQ(getrlimit(RLIMIT_FSIZE, &limit), 0);
+  struct rlimit small_limit = limit;
+  small_limit.rlim_cur = boost::filesystem::file_size(segment) + 1000;
+  signal(SIGXFSZ, SIG_IGN);
+  ASSERT_EQ(setrlimit(RLIMIT_FSIZE, &small_limit), 0);
+
+  // A message larger than the stream buffer is written only in part
+  rosgraph_msgs::Log large = makeLog(2, rosgraph_msgs::Log::INFO, "/node");
+  large.msg.assign(10000, 'x');
+  bool large_written = writer.write(large);
+
+  // Smaller messages fail once the buffer they were written to can't be flushed, losing some written before
+  uint32_t sec = 3;
+  bool small_written = true;
+  while (small_written && sec < 1000)
+  {
+    small_written = writer.write(makeLog(sec++, rosgraph_msgs::Log::INFO, "/node"));
+  }
+
+  setrlimit(RLIMIT_FSIZE, &limit);
+  signal(SIGXFSZ, SIG_DFL);
+  EXPECT_FALSE(large_written);
+  EXPECT_FALSE(small_written);
+
+  // The messages after the failures are indexed where they are
+  ASSERT_TRUE(writer.write(makeLog(1000, rosgraph_msgs::Log::WARN, "/node")));
+  writer.close();
+
+  BinaryLogReader reader(prefix_);
+  std::vector<rosgraph_msgs::Log> messages = reader.query(LogQuery());
+  ASSERT_GE(messages.size(), 2U);
+  EXPECT_EQ(messages.front().header.stamp, ros::Time(1, 0));
+  for (size_t i = 1; i + 1 < messages.size(); ++i)
+  {
+    EXPECT_EQ(messages[i].header.stamp, ros::Time(i + 2, 0));
+  }
+  EXPECT_EQ(messages.back().header.stamp, ros::Time(1000, 0));
+  EXPECT_EQ(messages.back().msg, "/node 1000");
+}
+
+TEST_F(BinaryLogTest, failedIndexWrite)
+{
+  std::string segment = prefix_ + ".0.bin";
+  BinaryLogWriter writer(prefix_);
+  for (uint32_t i = 1; i <= 20; ++i)
+  {
+    ASSERT_TRUE(writer.write(makeLog(i, rosgraph_msgs::Log::INFO, "/node")));
+  }
+  ASSERT_TRUE(writer.flush());
+  uint64_t size = boost::filesystem::file_size(segment);
+
+  // Let the index be written only in part
+  struct rlimit limit;
+  ASSERT_EQ(getrlimit(RLIMIT_FSIZE, &limit), 0);
+  struct rlimit small_limit = limit;
+  small_limit.rlim_cur = size + 100;
+  signal(SIGXFSZ, SIG_IGN);
+  ASSERT_EQ(setrlimit(RLIMIT_FSIZE, &small_limit), 0);
+  writer.close();
+  setrlimit(RLIMIT_FSIZE, &limit);
+  signal(SIGXFSZ, SIG_DFL);
+
+  // The segment is left without an index, and read record by record
+  EXPECT_EQ(boost::filesystem::file_size(segment), size);
+  BinaryLogReader reader(prefix_);
+  std::vector<rosgraph_msgs::Log> messages = reader.query(LogQuery());
+  ASSERT_EQ(messages.size(), 20U);
+  EXPECT_EQ(messages.back().header.stamp, ros::Time(20, 0));
+}
+#endif
+
+int main(int argc, char** argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -43,6 +43,7 @@
 #include <string.h>
 
 #include <ros/message_traits.h>
+#include <boost/shared_array.hpp>
 #include "macros.h"
 
 namespace topic_tools
@@ -94,14 +95,25 @@ public:
   //! Return the size of the serialized message
   uint32_t size() const;
 
+  /**
+   * \brief Reference the length bytes at data, kept valid by owner, instead of copying them
+   *
+   * Used when a message is received, so that relaying it copies the contents at most once.
+   */
+  void adopt(const boost::shared_array<uint8_t>& owner, uint8_t* data, uint32_t length);
+
+  //! Return the message serialized for publishing, sharing the adopted buffer when it already has the length prefix
+  ros::SerializedMessage serialize() const;
+
 private:
 
   std::string md5, datatype, msg_def, latching;
   bool typed;
 
+  boost::shared_array<uint8_t> msgBufOwner;  //!< owns msgBuf, either allocated by read() or adopted
   uint8_t *msgBuf;
   uint32_t msgBufUsed;
-  uint32_t msgBufAlloc;
+  uint32_t msgBufAlloc;                      //!< size of msgBufOwner if allocated by read(), 0 if adopted
   
 };
   
@@ -179,8 +191,24 @@ struct PreDeserialize<topic_tools::ShapeShifter>
   }
 };
 
+template<>
+inline SerializedMessage serializeMessage<topic_tools::ShapeShifter>(const topic_tools::ShapeShifter& message)
+{
+  return message.serialize();
+}
+
 } // namespace serialization
 
+template<>
+struct SerializedBufferAdopter<topic_tools::ShapeShifter>
+{
+  static bool adopt(topic_tools::ShapeShifter& m, const boost::shared_array<uint8_t>& owner, uint8_t* data, uint32_t length)
+  {
+    m.adopt(owner, data, length);
+    return true;
+  }
+};
+
 } //namespace ros
 
 
@@ -225,13 +253,13 @@ void ShapeShifter::read(Stream& stream)
   stream.getLength();
   stream.getData();
     
-  // stash this message in our buffer
-  if (stream.getLength() > msgBufAlloc)
+  // stash this message in our buffer, never in an adopted one
+  if (stream.getLength() > msgBufAlloc || msgBufAlloc == 0)
   {
-    delete[] msgBuf;
-    msgBuf = new uint8_t[stream.getLength()];
+    msgBufOwner.reset(new uint8_t[stream.getLength()]);
     msgBufAlloc = stream.getLength();
   }
+  msgBuf = msgBufOwner.get();
   msgBufUsed = stream.getLength();
   memcpy(msgBuf, stream.getData(), stream.getLength());
 }
@@ -108,7 +108,8 @@ void in_cb(const ros::MessageEvent<ShapeShifter>& msg_event)
     unsubscribe();
   }
   else
-    g_pub.publish(msg);
+    // Forward the received buffer as it is, rather than serializing the message again
+    g_pub.publishSerialized(msg->serialize());
 }
 
 void timer_cb(const ros::TimerEvent&)
@@ -49,11 +49,6 @@ ShapeShifter::ShapeShifter()
 
 ShapeShifter::~ShapeShifter()
 {
-  if (msgBuf)
-    delete[] msgBuf;
-  
-  msgBuf = NULL;
-  msgBufAlloc = 0;
 }
 
 
@@ -91,3 +86,38 @@ uint32_t ShapeShifter::size() const
   return msgBufUsed;
 }
 
+
+void ShapeShifter::adopt(const boost::shared_array<uint8_t>& owner, uint8_t* data, uint32_t length)
+{
+  msgBufOwner = owner;
+  msgBuf = data;
+  msgBufUsed = length;
+  msgBufAlloc = 0;
+}
+
+
+ros::SerializedMessage ShapeShifter::serialize() const
+{
+  // Buffers serialized in this process for publishing start with the length, and can be published as they are
+  if (msgBufAlloc == 0 && msgBufOwner && msgBuf == msgBufOwner.get() + 4)
+  {
+    uint32_t length;
+    memcpy(&length, msgBufOwner.get(), 4);
+    if (length == msgBufUsed)
+    {
+      ros::SerializedMessage m(msgBufOwner, msgBufUsed + 4);
+      m.message_start = msgBuf;
+      return m;
+    }
+  }
+
+  ros::SerializedMessage m;
+  m.num_bytes = msgBufUsed + 4;
+  m.buf.reset(new uint8_t[m.num_bytes]);
+  ros::serialization::OStream s(m.buf.get(), (uint32_t)m.num_bytes);
+  ros::serialization::serialize(s, msgBufUsed);
+  m.message_start = s.getData();
+  write(s);
+  return m;
+}
+
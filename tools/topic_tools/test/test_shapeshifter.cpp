@@ -81,6 +81,25 @@ class ShapeShifterSubscriber : public testing::Test
         printf("Instantiate failed!\n");
     }
   }
+
+  void messageCallbackRelay(const topic_tools::ShapeShifter::ConstPtr& msg)
+  {
+    // Delivered in this process, so the message references the buffer it was published in, and publishes it as it is
+    EXPECT_EQ(msg->serialize().buf.get(), relay_input.buf.get());
+    relay_pub.publish(*msg);
+  }
+
+  void messageCallbackRelayed(const std_msgs::String::ConstPtr& msg)
+  {
+    ros::SerializedMessage m = ros::serialization::serializeMessage(*msg);
+    relayed.assign(m.buf.get(), m.buf.get() + m.num_bytes);
+    if (msg->data == "relayed")
+      success = true;
+  }
+
+  ros::Publisher relay_pub;
+  ros::SerializedMessage relay_input;
+  std::vector<uint8_t> relayed;
   
 protected:
   ShapeShifterSubscriber() {}
@@ -162,6 +181,35 @@ TEST_F(ShapeShifterSubscriber, testLoopback)
     FAIL();
 }
 
+TEST_F(ShapeShifterSubscriber, testRelay)
+{
+  ros::NodeHandle nh;
+  ros::Subscriber sub = nh.subscribe<topic_tools::ShapeShifter>("relay_input",1,&ShapeShifterSubscriber::messageCallbackRelay, (ShapeShifterSubscriber*)this);
+  ros::Subscriber relayed_sub = nh.subscribe<std_msgs::String>("relay_output",1,&ShapeShifterSubscriber::messageCallbackRelayed, (ShapeShifterSubscriber*)this);
+
+  ros::Time t1(ros::Time::now()+ros::Duration(10.0));
+
+  topic_tools::ShapeShifter shape;
+  shape.morph(ros::message_traits::md5sum<std_msgs::String>(), ros::message_traits::datatype<std_msgs::String>(),
+              ros::message_traits::definition<std_msgs::String>(), "0");
+  relay_pub = shape.advertise(nh, "relay_output", 1);
+
+  ros::Publisher pub = shape.advertise(nh, "relay_input", 1);
+  std_msgs::String s;
+  s.data = "relayed";
+  relay_input = ros::serialization::serializeMessage(s);
+  pub.publishSerialized(relay_input);
+
+  while(ros::Time::now() < t1 && !success)
+  {
+    ros::WallDuration(0.01).sleep();
+    ros::spinOnce();
+  }
+
+  ASSERT_TRUE(success);
+  EXPECT_EQ(relayed, std::vector<uint8_t>(relay_input.buf.get(), relay_input.buf.get() + relay_input.num_bytes));
+}
+
 int main(int argc, char **argv){
     ros::init(argc, argv, "test_shapeshifter");
 
@@ -35,7 +35,8 @@
 #ifndef MESSAGE_FILTERS_CACHE_H_
 #define MESSAGE_FILTERS_CACHE_H_
 
-#include <deque>
+#include <algorithm>
+#include <vector>
 #include "boost/thread.hpp"
 #include "boost/shared_ptr.hpp"
 
@@ -52,6 +53,7 @@ namespace message_filters
  *
  * Given a stream of messages, the most recent N messages are cached in a ring buffer,
  * from which time intervals of the cache can then be retrieved by the client.
+ * The ring is kept sorted by timestamp, so lookups are binary searches.
  *
  * Cache immediately passes messages through to its output connections.
  *
@@ -71,6 +73,7 @@ public:
 
   template<class F>
   Cache(F& f, unsigned int cache_size = 1)
+  : cache_(1), stamps_(1), cache_start_(0), cache_count_(0)
   {
     setCacheSize(cache_size) ;
     connectInput(f) ;
@@ -82,6 +85,7 @@ public:
    * called later
    */
   Cache(unsigned int cache_size = 1)
+  : cache_(1), stamps_(1), cache_start_(0), cache_count_(0)
   {
     setCacheSize(cache_size);
   }
@@ -98,7 +102,7 @@ public:
   }
 
   /**
-   * Set the size of the cache.
+   * Set the size of the cache. The newest messages are kept if it shrinks.
    * \param cache_size The new size the cache should be. Must be > 0
    */
   void setCacheSize(unsigned int cache_size)
@@ -109,7 +113,22 @@ public:
       return ;
     }
 
-    cache_size_ = cache_size ;
+    boost::mutex::scoped_lock lock(cache_lock_);
+
+    // Lay the kept messages out from the start of the new ring
+    size_t count = std::min<size_t>(cache_count_, cache_size);
+    std::vector<EventType> cache(cache_size);
+    std::vector<ros::Time> stamps(cache_size);
+    for (size_t i = 0; i < count; i++)
+    {
+      cache[i] = cache_[slot(cache_count_ - count + i)];
+      stamps[i] = stamps_[slot(cache_count_ - count + i)];
+    }
+
+    cache_.swap(cache);
+    stamps_.swap(stamps);
+    cache_start_ = 0;
+    cache_count_ = count;
   }
 
   /**
@@ -129,27 +148,27 @@ public:
   {
     namespace mt = ros::message_traits;
 
-    //printf("  Cache Size: %u\n", cache_.size()) ;
+    ros::Time evt_stamp = mt::TimeStamp<M>::value(*evt.getMessage());
     {
       boost::mutex::scoped_lock lock(cache_lock_);
 
-      while (cache_.size() >= cache_size_)                       // Keep popping off old data until we have space for a new msg
-        cache_.pop_front() ;                                     // The front of the deque has the oldest elem, so we can get rid of it
-
-      // No longer naively pushing msgs to back. Want to make sure they're sorted correctly
-      //cache_.push_back(msg) ;                                    // Add the newest message to the back of the deque
-
-      typename std::deque<EventType >::reverse_iterator rev_it = cache_.rbegin();
-
-      // Keep walking backwards along deque until we hit the beginning,
-      //   or until we find a timestamp that's smaller than (or equal to) msg's timestamp
-      ros::Time evt_stamp = mt::TimeStamp<M>::value(*evt.getMessage());
-      while(rev_it != cache_.rend() && mt::TimeStamp<M>::value(*(*rev_it).getMessage()) > evt_stamp)
-        rev_it++;
-
-      // Add msg to the cache
-      cache_.insert(rev_it.base(), evt);
-
+      if (cache_count_ == cache_.size())                         // Drop the oldest message to make space for the new one
+      {
+        cache_start_ = slot(1);
+        cache_count_--;
+      }
+
+      // Insert msg after all messages with a timestamp smaller than (or equal to) its own. Messages
+      // usually arrive in order, in which case nothing needs to be moved
+      size_t index = upperBound(evt_stamp);
+      for (size_t i = cache_count_; i > index; i--)
+      {
+        cache_[slot(i)] = cache_[slot(i - 1)];
+        stamps_[slot(i)] = stamps_[slot(i - 1)];
+      }
+      cache_[slot(index)] = evt;
+      stamps_[slot(index)] = evt_stamp;
+      cache_count_++;
     }
 
     this->signalMessage(evt);
@@ -165,31 +184,19 @@ public:
    */
   std::vector<MConstPtr> getInterval(const ros::Time& start, const ros::Time& end) const
   {
-    namespace mt = ros::message_traits;
-
     boost::mutex::scoped_lock lock(cache_lock_);
 
     // Find the starting index. (Find the first index after [or at] the start of the interval)
-    unsigned int start_index = 0 ;
-    while(start_index < cache_.size() &&
-          mt::TimeStamp<M>::value(*cache_[start_index].getMessage()) < start)
-    {
-      start_index++ ;
-    }
+    size_t start_index = lowerBound(start);
 
     // Find the ending index. (Find the first index after the end of interval)
-    unsigned int end_index = start_index ;
-    while(end_index < cache_.size() &&
-          mt::TimeStamp<M>::value(*cache_[end_index].getMessage()) <= end)
-    {
-      end_index++ ;
-    }
+    size_t end_index = std::max(start_index, upperBound(end));
 
     std::vector<MConstPtr> interval_elems ;
     interval_elems.reserve(end_index - start_index) ;
-    for (unsigned int i=start_index; i<end_index; i++)
+    for (size_t i=start_index; i<end_index; i++)
     {
-      interval_elems.push_back(cache_[i].getMessage()) ;
+      interval_elems.push_back(cache_[slot(i)].getMessage()) ;
     }
 
     return interval_elems ;
@@ -204,28 +211,24 @@ public:
    */
   std::vector<MConstPtr> getSurroundingInterval(const ros::Time& start, const ros::Time& end) const
   {
-    namespace mt = ros::message_traits;
-
     boost::mutex::scoped_lock lock(cache_lock_);
-    // Find the starting index. (Find the first index after [or at] the start of the interval)
-    unsigned int start_index = cache_.size()-1;
-    while(start_index > 0 &&
-          mt::TimeStamp<M>::value(*cache_[start_index].getMessage()) > start)
-    {
-      start_index--;
-    }
-    unsigned int end_index = start_index;
-    while(end_index < cache_.size()-1 &&
-          mt::TimeStamp<M>::value(*cache_[end_index].getMessage()) < end)
-    {
-      end_index++;
-    }
 
     std::vector<MConstPtr> interval_elems;
+    if (cache_count_ == 0)
+      return interval_elems;
+
+    // Find the starting index. (Find the last index before [or at] the start of the interval, or the first one)
+    size_t start_index = upperBound(start);
+    if (start_index > 0)
+      start_index--;
+
+    // Find the ending index. (Find the first index after [or at] the end of the interval, or the last one)
+    size_t end_index = std::min(std::max(start_index, lowerBound(end)), cache_count_ - 1);
+
     interval_elems.reserve(end_index - start_index + 1) ;
-    for (unsigned int i=start_index; i<=end_index; i++)
+    for (size_t i=start_index; i<=end_index; i++)
     {
-      interval_elems.push_back(cache_[i].getMessage()) ;
+      interval_elems.push_back(cache_[slot(i)].getMessage()) ;
     }
 
     return interval_elems;
@@ -238,23 +241,13 @@ public:
    */
   MConstPtr getElemBeforeTime(const ros::Time& time) const
   {
-    namespace mt = ros::message_traits;
-
     boost::mutex::scoped_lock lock(cache_lock_);
 
     MConstPtr out ;
 
-    unsigned int i=0 ;
-    int elem_index = -1 ;
-    while (i<cache_.size() &&
-           mt::TimeStamp<M>::value(*cache_[i].getMessage()) < time)
-    {
-      elem_index = i ;
-      i++ ;
-    }
-
-    if (elem_index >= 0)
-      out = cache_[elem_index].getMessage() ;
+    size_t index = lowerBound(time) ;
+    if (index > 0)
+      out = cache_[slot(index - 1)].getMessage() ;
 
     return out ;
   }
@@ -266,25 +259,13 @@ public:
    */
   MConstPtr getElemAfterTime(const ros::Time& time) const
   {
-    namespace mt = ros::message_traits;
-
     boost::mutex::scoped_lock lock(cache_lock_);
 
     MConstPtr out ;
 
-    int i=cache_.size()-1 ;
-    int elem_index = -1 ;
-    while (i>=0 &&
-        mt::TimeStamp<M>::value(*cache_[i].getMessage()) > time)
-    {
-      elem_index = i ;
-      i-- ;
-    }
-
-    if (elem_index >= 0)
-      out = cache_[elem_index].getMessage() ;
-    else
-      out.reset() ;
+    size_t index = upperBound(time) ;
+    if (index < cache_count_)
+      out = cache_[slot(index)].getMessage() ;
 
     return out ;
   }
@@ -294,14 +275,12 @@ public:
    */
   ros::Time getLatestTime() const
   {
-    namespace mt = ros::message_traits;
-
     boost::mutex::scoped_lock lock(cache_lock_);
 
     ros::Time latest_time;
 
-    if (cache_.size() > 0)
-      latest_time = mt::TimeStamp<M>::value(*cache_.back().getMessage());
+    if (cache_count_ > 0)
+      latest_time = stamps_[slot(cache_count_ - 1)];
 
     return latest_time ;
   }
@@ -311,14 +290,12 @@ public:
    */
   ros::Time getOldestTime() const
   {
-    namespace mt = ros::message_traits;
-
     boost::mutex::scoped_lock lock(cache_lock_);
 
     ros::Time oldest_time;
 
-    if (cache_.size() > 0)
-      oldest_time = mt::TimeStamp<M>::value(*cache_.front().getMessage());
+    if (cache_count_ > 0)
+      oldest_time = stamps_[slot(0)];
 
     return oldest_time ;
   }
@@ -330,9 +307,54 @@ private:
     add(evt);
   }
 
-  mutable boost::mutex cache_lock_ ;            //!< Lock for cache_
-  std::deque<EventType> cache_ ;        //!< Cache for the messages
-  unsigned int cache_size_ ;            //!< Maximum number of elements allowed in the cache.
+  //! Position in the ring of the index-th oldest message
+  size_t slot(size_t index) const
+  {
+    index += cache_start_;
+    return index < cache_.size() ? index : index - cache_.size();
+  }
+
+  //! Index of the oldest message with a timestamp not before time, or the number of messages
+  size_t lowerBound(const ros::Time& time) const
+  {
+    size_t first = 0, count = cache_count_;
+    while (count > 0)
+    {
+      size_t step = count / 2;
+      if (stamps_[slot(first + step)] < time)
+      {
+        first += step + 1;
+        count -= step + 1;
+      }
+      else
+        count = step;
+    }
+    return first;
+  }
+
+  //! Index of the oldest message with a timestamp after time, or the number of messages
+  size_t upperBound(const ros::Time& time) const
+  {
+    size_t first = 0, count = cache_count_;
+    while (count > 0)
+    {
+      size_t step = count / 2;
+      if (!(time < stamps_[slot(first + step)]))
+      {
+        first += step + 1;
+        count -= step + 1;
+      }
+      else
+        count = step;
+    }
+    return first;
+  }
+
+  mutable boost::mutex cache_lock_ ;            //!< Lock for the members below
+  std::vector<EventType> cache_ ;       //!< Ring of messages, sorted by timestamp from cache_start_. Its size is the maximum number of elements allowed in the cache.
+  std::vector<ros::Time> stamps_ ;      //!< Timestamps of the messages in cache_, kept apart so searches stay in cache
+  size_t cache_start_ ;                 //!< Position of the oldest message in the ring
+  size_t cache_count_ ;                 //!< Number of messages in the ring
 
   Connection incoming_connection_;
 };
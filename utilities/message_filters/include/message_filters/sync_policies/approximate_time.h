@@ -56,7 +56,6 @@
 #include <ros/message_traits.h>
 #include <ros/message_event.h>
 
-#include <deque>
 #include <vector>
 #include <string>
 
@@ -86,15 +85,6 @@ struct ApproximateTime : public PolicyBase<M0, M1, M2, M3, M4, M5, M6, M7, M8>
   typedef typename Super::M6Event M6Event;
   typedef typename Super::M7Event M7Event;
   typedef typename Super::M8Event M8Event;
-  typedef std::deque<M0Event> M0Deque;
-  typedef std::deque<M1Event> M1Deque;
-  typedef std::deque<M2Event> M2Deque;
-  typedef std::deque<M3Event> M3Deque;
-  typedef std::deque<M4Event> M4Deque;
-  typedef std::deque<M5Event> M5Deque;
-  typedef std::deque<M6Event> M6Deque;
-  typedef std::deque<M7Event> M7Deque;
-  typedef std::deque<M8Event> M8Deque;
   typedef std::vector<M0Event> M0Vector;
   typedef std::vector<M1Event> M1Vector;
   typedef std::vector<M2Event> M2Vector;
@@ -105,12 +95,12 @@ struct ApproximateTime : public PolicyBase<M0, M1, M2, M3, M4, M5, M6, M7, M8>
   typedef std::vector<M7Event> M7Vector;
   typedef std::vector<M8Event> M8Vector;
   typedef boost::tuple<M0Event, M1Event, M2Event, M3Event, M4Event, M5Event, M6Event, M7Event, M8Event> Tuple;
-  typedef boost::tuple<M0Deque, M1Deque, M2Deque, M3Deque, M4Deque, M5Deque, M6Deque, M7Deque, M8Deque> DequeTuple;
   typedef boost::tuple<M0Vector, M1Vector, M2Vector, M3Vector, M4Vector, M5Vector, M6Vector, M7Vector, M8Vector> VectorTuple;
 
   ApproximateTime(uint32_t queue_size)
   : parent_(0)
   , queue_size_(queue_size)
+  , queues_(9)
   , num_non_empty_deques_(0)
   , pivot_(NO_PIVOT)
   , max_interval_duration_(ros::DURATION_MAX)
@@ -120,6 +110,17 @@ struct ApproximateTime : public PolicyBase<M0, M1, M2, M3, M4, M5, M6, M7, M8>
   , warned_about_incorrect_bound_(9, false)
   {
     ROS_ASSERT(queue_size_ > 0);  // The synchronizer will tend to drop many messages with a queue size of 1. At least 2 is recommended.
+
+    // A queue holds one message more than queue_size_ until add() drops the oldest
+    initQueue<0>();
+    initQueue<1>();
+    initQueue<2>();
+    initQueue<3>();
+    initQueue<4>();
+    initQueue<5>();
+    initQueue<6>();
+    initQueue<7>();
+    initQueue<8>();
   }
 
   ApproximateTime(const ApproximateTime& e)
@@ -138,8 +139,8 @@ struct ApproximateTime : public PolicyBase<M0, M1, M2, M3, M4, M5, M6, M7, M8>
     age_penalty_ = rhs.age_penalty_;
     candidate_start_ = rhs.candidate_start_;
     candidate_end_ = rhs.candidate_end_;
-    deques_ = rhs.deques_;
-    past_ = rhs.past_;
+    queues_ = rhs.queues_;
+    rings_ = rhs.rings_;
     has_dropped_messages_ = rhs.has_dropped_messages_;
     inter_message_lower_bounds_ = rhs.inter_message_lower_bounds_;
     warned_about_incorrect_bound_ = rhs.warned_about_incorrect_bound_;
@@ -155,33 +156,20 @@ struct ApproximateTime : public PolicyBase<M0, M1, M2, M3, M4, M5, M6, M7, M8>
   template<int i>
   void checkInterMessageBound()
   {
-    namespace mt = ros::message_traits;
     if (warned_about_incorrect_bound_[i])
     {
       return;
     }
-    std::deque<typename mpl::at_c<Events, i>::type>& deque = boost::get<i>(deques_);
-    std::vector<typename mpl::at_c<Events, i>::type>& v = boost::get<i>(past_);
-    ROS_ASSERT(!deque.empty());
-    const typename mpl::at_c<Messages, i>::type &msg = *(deque.back()).getMessage();
-    ros::Time msg_time = mt::TimeStamp<typename mpl::at_c<Messages, i>::type>::value(msg);
-    ros::Time previous_msg_time;
-    if (deque.size() == (size_t) 1)
-    {
-      if (v.empty())
-      {
-	// We have already published (or have never received) the previous message, we cannot check the bound
-	return;
-      }
-      const typename mpl::at_c<Messages, i>::type &previous_msg = *(v.back()).getMessage();
-      previous_msg_time = mt::TimeStamp<typename mpl::at_c<Messages, i>::type>::value(previous_msg);
-    }
-    else
+    const Queue& q = queues_[i];
+    ROS_ASSERT(!q.empty());
+    if (q.size < 2)
     {
-      // There are at least 2 elements in the deque. Check that the gap respects the bound if it was provided.
-      const typename mpl::at_c<Messages, i>::type &previous_msg = *(deque[deque.size()-2]).getMessage();
-      previous_msg_time =  mt::TimeStamp<typename mpl::at_c<Messages, i>::type>::value(previous_msg);
+      // We have already published (or have never received) the previous message, we cannot check the bound
+      return;
     }
+    // The previous message is either still queued or in the past
+    ros::Time msg_time = q.stamps[q.slot(q.size - 1)];
+    ros::Time previous_msg_time = q.stamps[q.slot(q.size - 2)];
     if (msg_time < previous_msg_time)
     {
       ROS_WARN_STREAM("Messages of type " << i << " arrived out of order (will print only once)");
@@ -200,11 +188,16 @@ struct ApproximateTime : public PolicyBase<M0, M1, M2, M3, M4, M5, M6, M7, M8>
   template<int i>
   void add(const typename mpl::at_c<Events, i>::type& evt)
   {
+    namespace mt = ros::message_traits;
+
     boost::mutex::scoped_lock lock(data_mutex_);
 
-    std::deque<typename mpl::at_c<Events, i>::type>& deque = boost::get<i>(deques_);
-    deque.push_back(evt);
-    if (deque.size() == (size_t)1) {
+    Queue& q = queues_[i];
+    size_t back = q.slot(q.size);
+    boost::get<i>(rings_)[back] = evt;
+    q.stamps[back] = mt::TimeStamp<typename mpl::at_c<Messages, i>::type>::value(*evt.getMessage());
+    ++q.size;
+    if (q.size - q.past == (size_t)1) {
       // We have just added the first message, so it was empty before
       ++num_non_empty_deques_;
       if (num_non_empty_deques_ == (uint32_t)RealTypeCount::value)
@@ -219,8 +212,7 @@ struct ApproximateTime : public PolicyBase<M0, M1, M2, M3, M4, M5, M6, M7, M8>
     }
     // Check whether we have more messages than allowed in the queue.
     // Note that during the above call to process(), queue i may contain queue_size_+1 messages.
-    std::vector<typename mpl::at_c<Events, i>::type>& past = boost::get<i>(past_);
-    if (deque.size() + past.size() > queue_size_)
+    if (q.size > queue_size_)
     {
       // Cancel ongoing candidate search, if any:
       num_non_empty_deques_ = 0; // We will recompute it from scratch
@@ -234,8 +226,8 @@ struct ApproximateTime : public PolicyBase<M0, M1, M2, M3, M4, M5, M6, M7, M8>
       recover<7>();
       recover<8>();
       // Drop the oldest message in the offending topic
-      ROS_ASSERT(!deque.empty());
-      deque.pop_front();
+      ROS_ASSERT(!q.empty());
+      popFront<i>();
       has_dropped_messages_[i] = true;
       if (pivot_ != NO_PIVOT)
       {
@@ -268,14 +260,58 @@ struct ApproximateTime : public PolicyBase<M0, M1, M2, M3, M4, M5, M6, M7, M8>
   }
 
 private:
-  // Assumes that deque number <index> is non empty
+  // Messages of one topic in arrival order, stored in a ring alongside rings_. The first past of them
+  // have been moved out of the way by the candidate search and may still be recovered; the others
+  // form the deque the search works on.
+  struct Queue
+  {
+    Queue() : start(0), size(0), past(0) {}
+
+    size_t slot(size_t index) const
+    {
+      index += start;
+      return index < stamps.size() ? index : index - stamps.size();
+    }
+
+    bool empty() const { return past == size; }
+    const ros::Time& front() const { return stamps[slot(past)]; }
+
+    std::vector<ros::Time> stamps;  // Time stamps of the messages, so the search never dereferences them
+    size_t start;                   // Position of the oldest message in the ring
+    size_t size;                    // Number of messages, including the past ones
+    size_t past;                    // Number of messages moved to the past
+  };
+
+  template<int i>
+  void initQueue()
+  {
+    if (i >= RealTypeCount::value)
+    {
+      return;
+    }
+    queues_[i].stamps.resize(queue_size_ + 1);
+    boost::get<i>(rings_).resize(queue_size_ + 1);
+  }
+
+  // Assumes that queue number <index> has a message
+  template<int i>
+  void popFront()
+  {
+    Queue& q = queues_[i];
+    ROS_ASSERT(q.size > 0);
+    boost::get<i>(rings_)[q.start] = typename mpl::at_c<Events, i>::type();
+    q.start = q.slot(1);
+    --q.size;
+  }
+
+  // Assumes that deque number <index> is non empty, and that nothing was moved to the past
   template<int i>
   void dequeDeleteFront()
   {
-    std::deque<typename mpl::at_c<Events, i>::type>& deque = boost::get<i>(deques_);
-    ROS_ASSERT(!deque.empty());
-    deque.pop_front();
-    if (deque.empty())
+    Queue& q = queues_[i];
+    ROS_ASSERT(!q.empty() && q.past == 0);
+    popFront<i>();
+    if (q.empty())
     {
       --num_non_empty_deques_;
     }
@@ -319,53 +355,35 @@ private:
   }
 
   // Assumes that deque number <index> is non empty
-  template<int i>
-  void dequeMoveFrontToPast()
+  void dequeMoveFrontToPast(uint32_t index)
   {
-    std::deque<typename mpl::at_c<Events, i>::type>& deque = boost::get<i>(deques_);
-    std::vector<typename mpl::at_c<Events, i>::type>& vector = boost::get<i>(past_);
-    ROS_ASSERT(!deque.empty());
-    vector.push_back(deque.front());
-    deque.pop_front();
-    if (deque.empty())
+    Queue& q = queues_[index];
+    ROS_ASSERT(!q.empty());
+    ++q.past;
+    if (q.empty())
     {
       --num_non_empty_deques_;
     }
   }
-  // Assumes that deque number <index> is non empty
-  void dequeMoveFrontToPast(uint32_t index)
+
+  template<int i>
+  void setCandidateFromFront()
   {
-    switch (index)
+    if (i >= RealTypeCount::value)
     {
-    case 0:
-      dequeMoveFrontToPast<0>();
-      break;
-    case 1:
-      dequeMoveFrontToPast<1>();
-      break;
-    case 2:
-      dequeMoveFrontToPast<2>();
-      break;
-    case 3:
-      dequeMoveFrontToPast<3>();
-      break;
-    case 4:
-      dequeMoveFrontToPast<4>();
-      break;
-    case 5:
-      dequeMoveFrontToPast<5>();
-      break;
-    case 6:
-      dequeMoveFrontToPast<6>();
-      break;
-    case 7:
-      dequeMoveFrontToPast<7>();
-      break;
-    case 8:
-      dequeMoveFrontToPast<8>();
-      break;
-    default:
-      ROS_BREAK();
+      return;
+    }
+    const Queue& q = queues_[i];
+    boost::get<i>(candidate_) = boost::get<i>(rings_)[q.slot(q.past)];
+  }
+
+  template<int i>
+  void deletePast()
+  {
+    Queue& q = queues_[i];
+    for (; q.past > 0; --q.past)
+    {
+      popFront<i>();
     }
   }
 
@@ -374,51 +392,30 @@ private:
     //printf("Creating candidate\n");
     // Create candidate tuple
     candidate_ = Tuple(); // Discards old one if any
-    boost::get<0>(candidate_) = boost::get<0>(deques_).front();
-    boost::get<1>(candidate_) = boost::get<1>(deques_).front();
-    if (RealTypeCount::value > 2)
-    {
-      boost::get<2>(candidate_) = boost::get<2>(deques_).front();
-      if (RealTypeCount::value > 3)
-      {
-	boost::get<3>(candidate_) = boost::get<3>(deques_).front();
-	if (RealTypeCount::value > 4)
-	{
-	  boost::get<4>(candidate_) = boost::get<4>(deques_).front();
-	  if (RealTypeCount::value > 5)
-	  {
-	    boost::get<5>(candidate_) = boost::get<5>(deques_).front();
-	    if (RealTypeCount::value > 6)
-	    {
-	      boost::get<6>(candidate_) = boost::get<6>(deques_).front();
-	      if (RealTypeCount::value > 7)
-	      {
-		boost::get<7>(candidate_) = boost::get<7>(deques_).front();
-		if (RealTypeCount::value > 8)
-		{
-		  boost::get<8>(candidate_) = boost::get<8>(deques_).front();
-		}
-	      }
-	    }
-	  }
-	}
-      }
-    }
+    setCandidateFromFront<0>();
+    setCandidateFromFront<1>();
+    setCandidateFromFront<2>();
+    setCandidateFromFront<3>();
+    setCandidateFromFront<4>();
+    setCandidateFromFront<5>();
+    setCandidateFromFront<6>();
+    setCandidateFromFront<7>();
+    setCandidateFromFront<8>();
     // Delete all past messages, since we have found a better candidate
-    boost::get<0>(past_).clear();
-    boost::get<1>(past_).clear();
-    boost::get<2>(past_).clear();
-    boost::get<3>(past_).clear();
-    boost::get<4>(past_).clear();
-    boost::get<5>(past_).clear();
-    boost::get<6>(past_).clear();
-    boost::get<7>(past_).clear();
-    boost::get<8>(past_).clear();
+    deletePast<0>();
+    deletePast<1>();
+    deletePast<2>();
+    deletePast<3>();
+    deletePast<4>();
+    deletePast<5>();
+    deletePast<6>();
+    deletePast<7>();
+    deletePast<8>();
     //printf("Candidate created\n");
   }
 
 
-  // ASSUMES: num_messages <= past_[i].size()
+  // ASSUMES: num_messages <= queues_[i].past
   template<int i>
   void recover(size_t num_messages)
   {
@@ -427,15 +424,9 @@ private:
       return;
     }
 
-    std::vector<typename mpl::at_c<Events, i>::type>& v = boost::get<i>(past_);
-    std::deque<typename mpl::at_c<Events, i>::type>& q = boost::get<i>(deques_);
-    ROS_ASSERT(num_messages <= v.size());
-    while (num_messages > 0)
-    {
-      q.push_front(v.back());
-      v.pop_back();
-      num_messages--;
-    }
+    Queue& q = queues_[i];
+    ROS_ASSERT(num_messages <= q.past);
+    q.past -= num_messages;
 
     if (!q.empty())
     {
@@ -452,13 +443,8 @@ private:
       return;
     }
 
-    std::vector<typename mpl::at_c<Events, i>::type>& v = boost::get<i>(past_);
-    std::deque<typename mpl::at_c<Events, i>::type>& q = boost::get<i>(deques_);
-    while (!v.empty())
-    {
-      q.push_front(v.back());
-      v.pop_back();
-    }
+    Queue& q = queues_[i];
+    q.past = 0;
 
     if (!q.empty())
     {
@@ -475,17 +461,12 @@ private:
       return;
     }
 
-    std::vector<typename mpl::at_c<Events, i>::type>& v = boost::get<i>(past_);
-    std::deque<typename mpl::at_c<Events, i>::type>& q = boost::get<i>(deques_);
-    while (!v.empty())
-    {
-      q.push_front(v.back());
-      v.pop_back();
-    }
+    Queue& q = queues_[i];
+    q.past = 0;
 
     ROS_ASSERT(!q.empty());
 
-    q.pop_front();
+    popFront<i>();
     if (!q.empty())
     {
       ++num_non_empty_deques_;
@@ -537,104 +518,30 @@ private:
   //       false: look for the earliest head of deque
   void getCandidateBoundary(uint32_t &index, ros::Time &time, bool end)
   {
-    namespace mt = ros::message_traits;
-
-    M0Event& m0 = boost::get<0>(deques_).front();
-    time = mt::TimeStamp<M0>::value(*m0.getMessage());
+    time = queues_[0].front();
     index = 0;
-    if (RealTypeCount::value > 1)
+    for (uint32_t i = 1; i < (uint32_t)RealTypeCount::value; i++)
     {
-      M1Event& m1 = boost::get<1>(deques_).front();
-      if ((mt::TimeStamp<M1>::value(*m1.getMessage()) < time) ^ end)
+      const ros::Time& head_time = queues_[i].front();
+      if ((head_time < time) ^ end)
       {
-        time = mt::TimeStamp<M1>::value(*m1.getMessage());
-        index = 1;
-      }
-    }
-    if (RealTypeCount::value > 2)
-    {
-      M2Event& m2 = boost::get<2>(deques_).front();
-      if ((mt::TimeStamp<M2>::value(*m2.getMessage()) < time) ^ end)
-      {
-        time = mt::TimeStamp<M2>::value(*m2.getMessage());
-        index = 2;
-      }
-    }
-    if (RealTypeCount::value > 3)
-    {
-      M3Event& m3 = boost::get<3>(deques_).front();
-      if ((mt::TimeStamp<M3>::value(*m3.getMessage()) < time) ^ end)
-      {
-        time = mt::TimeStamp<M3>::value(*m3.getMessage());
-        index = 3;
-      }
-    }
-    if (RealTypeCount::value > 4)
-    {
-      M4Event& m4 = boost::get<4>(deques_).front();
-      if ((mt::TimeStamp<M4>::value(*m4.getMessage()) < time) ^ end)
-      {
-        time = mt::TimeStamp<M4>::value(*m4.getMessage());
-        index = 4;
-      }
-    }
-    if (RealTypeCount::value > 5)
-    {
-      M5Event& m5 = boost::get<5>(deques_).front();
-      if ((mt::TimeStamp<M5>::value(*m5.getMessage()) < time) ^ end)
-      {
-        time = mt::TimeStamp<M5>::value(*m5.getMessage());
-        index = 5;
-      }
-    }
-    if (RealTypeCount::value > 6)
-    {
-      M6Event& m6 = boost::get<6>(deques_).front();
-      if ((mt::TimeStamp<M6>::value(*m6.getMessage()) < time) ^ end)
-      {
-        time = mt::TimeStamp<M6>::value(*m6.getMessage());
-        index = 6;
-      }
-    }
-    if (RealTypeCount::value > 7)
-    {
-      M7Event& m7 = boost::get<7>(deques_).front();
-      if ((mt::TimeStamp<M7>::value(*m7.getMessage()) < time) ^ end)
-      {
-        time = mt::TimeStamp<M7>::value(*m7.getMessage());
-        index = 7;
-      }
-    }
-    if (RealTypeCount::value > 8)
-    {
-      M8Event& m8 = boost::get<8>(deques_).front();
-      if ((mt::TimeStamp<M8>::value(*m8.getMessage()) < time) ^ end)
-      {
-        time = mt::TimeStamp<M8>::value(*m8.getMessage());
-        index = 8;
+        time = head_time;
+        index = i;
       }
     }
   }
 
 
   // ASSUMES: we have a pivot and candidate
-  template<int i>
-  ros::Time getVirtualTime()
+  ros::Time getVirtualTime(uint32_t i)
   {
-    namespace mt = ros::message_traits;
-
-    if (i >= RealTypeCount::value)
-    {
-      return ros::Time(0,0);  // Dummy return value
-    }
     ROS_ASSERT(pivot_ != NO_PIVOT);
 
-    std::vector<typename mpl::at_c<Events, i>::type>& v = boost::get<i>(past_);
-    std::deque<typename mpl::at_c<Events, i>::type>& q = boost::get<i>(deques_);
+    const Queue& q = queues_[i];
     if (q.empty())
     {
-      ROS_ASSERT(!v.empty());  // Because we have a candidate
-      ros::Time last_msg_time = mt::TimeStamp<typename mpl::at_c<Messages, i>::type>::value(*(v.back()).getMessage());
+      ROS_ASSERT(q.past > 0);  // Because we have a candidate
+      ros::Time last_msg_time = q.stamps[q.slot(q.past - 1)];
       ros::Time msg_time_lower_bound = last_msg_time + inter_message_lower_bounds_[i];
       if (msg_time_lower_bound > pivot_time_)  // Take the max
       {
@@ -642,8 +549,7 @@ private:
       }
       return pivot_time_;
     }
-    ros::Time current_msg_time = mt::TimeStamp<typename mpl::at_c<Messages, i>::type>::value(*(q.front()).getMessage());
-    return current_msg_time;
+    return q.front();
   }
 
 
@@ -664,26 +570,14 @@ private:
   //       false: look for the earliest head of deque
   void getVirtualCandidateBoundary(uint32_t &index, ros::Time &time, bool end)
   {
-    namespace mt = ros::message_traits;
-
-    std::vector<ros::Time> virtual_times(9);
-    virtual_times[0] = getVirtualTime<0>();
-    virtual_times[1] = getVirtualTime<1>();
-    virtual_times[2] = getVirtualTime<2>();
-    virtual_times[3] = getVirtualTime<3>();
-    virtual_times[4] = getVirtualTime<4>();
-    virtual_times[5] = getVirtualTime<5>();
-    virtual_times[6] = getVirtualTime<6>();
-    virtual_times[7] = getVirtualTime<7>();
-    virtual_times[8] = getVirtualTime<8>();
- 
-    time = virtual_times[0];
+    time = getVirtualTime(0);
     index = 0;
-    for (int i = 0; i < RealTypeCount::value; i++)
+    for (uint32_t i = 1; i < (uint32_t)RealTypeCount::value; i++)
     {
-      if ((virtual_times[i] < time) ^ end)
+      ros::Time virtual_time = getVirtualTime(i);
+      if ((virtual_time < time) ^ end)
       {
-	time = virtual_times[i];
+	time = virtual_time;
 	index = i;
       }
     }
@@ -716,7 +610,7 @@ private:
       if (pivot_ == NO_PIVOT)
       {
         // We do not have a candidate
-        // INVARIANT: the past_ vectors are empty
+        // INVARIANT: no queue has messages in the past
         // INVARIANT: (candidate_ has no filled members)
         if (end_time - start_time > max_interval_duration_)
         {
@@ -780,7 +674,7 @@ private:
         uint32_t num_non_empty_deques_before_virtual_search = num_non_empty_deques_;
 
         // Before giving up, use the rate bounds, if provided, to further try to prove optimality
-        std::vector<int> num_virtual_moves(9,0);
+        size_t num_virtual_moves[9] = { 0 };
         while (1)
         {
           ros::Time end_time, start_time;
@@ -832,9 +726,9 @@ private:
 
   static const uint32_t NO_PIVOT = 9;  // Special value for the pivot indicating that no pivot has been selected
 
-  DequeTuple deques_;
+  VectorTuple rings_;  // Ring of messages for each topic, laid out as described by queues_
+  std::vector<Queue> queues_;
   uint32_t num_non_empty_deques_;
-  VectorTuple past_;
   Tuple candidate_;  // NULL if there is no candidate, in which case there is no pivot.
   ros::Time candidate_start_;
   ros::Time candidate_end_;
@@ -56,7 +56,7 @@
 #include <ros/message_traits.h>
 #include <ros/message_event.h>
 
-#include <deque>
+#include <algorithm>
 #include <vector>
 #include <string>
 
@@ -92,6 +92,9 @@ struct ExactTime : public PolicyBase<M0, M1, M2, M3, M4, M5, M6, M7, M8>
   ExactTime(uint32_t queue_size)
   : parent_(0)
   , queue_size_(queue_size)
+  , tuples_(queue_size > 0 ? queue_size + 1 : 16)
+  , tuples_start_(0)
+  , tuples_count_(0)
   {
   }
 
@@ -106,6 +109,8 @@ struct ExactTime : public PolicyBase<M0, M1, M2, M3, M4, M5, M6, M7, M8>
     queue_size_ = rhs.queue_size_;
     last_signal_time_ = rhs.last_signal_time_;
     tuples_ = rhs.tuples_;
+    tuples_start_ = rhs.tuples_start_;
+    tuples_count_ = rhs.tuples_count_;
 
     return *this;
   }
@@ -124,10 +129,16 @@ struct ExactTime : public PolicyBase<M0, M1, M2, M3, M4, M5, M6, M7, M8>
 
     boost::mutex::scoped_lock lock(mutex_);
 
-    Tuple& t = tuples_[mt::TimeStamp<typename mpl::at_c<Messages, i>::type>::value(*evt.getMessage())];
-    boost::get<i>(t) = evt;
+    ros::Time stamp = mt::TimeStamp<typename mpl::at_c<Messages, i>::type>::value(*evt.getMessage());
+    size_t index = findTuple(stamp);
+    if (index == tuples_count_ || tuples_[slot(index)].stamp != stamp)
+    {
+      insertTuple(index, stamp);
+    }
+
+    boost::get<i>(tuples_[slot(index)].tuple) = evt;
 
-    checkTuple(t);
+    checkTuple(index);
   }
 
   template<class C>
@@ -173,9 +184,9 @@ struct ExactTime : public PolicyBase<M0, M1, M2, M3, M4, M5, M6, M7, M8>
 private:
 
   // assumes mutex_ is already locked
-  void checkTuple(Tuple& t)
+  void checkTuple(size_t index)
   {
-    namespace mt = ros::message_traits;
+    Tuple& t = tuples_[slot(index)].tuple;
 
     bool full = true;
     full = full && (bool)boost::get<0>(t).getMessage();
@@ -194,58 +205,110 @@ private:
                        boost::get<3>(t), boost::get<4>(t), boost::get<5>(t),
                        boost::get<6>(t), boost::get<7>(t), boost::get<8>(t));
 
-      last_signal_time_ = mt::TimeStamp<M0>::value(*boost::get<0>(t).getMessage());
-
-      tuples_.erase(last_signal_time_);
+      last_signal_time_ = tuples_[slot(index)].stamp;
 
-      clearOldTuples();
+      // the tuples are sorted by time, so all the ones older than this are dropped
+      for (size_t j = 0; j < index; ++j)
+      {
+        popTuple(true);
+      }
+      popTuple(false);
     }
 
     if (queue_size_ > 0)
     {
-      while (tuples_.size() > queue_size_)
+      while (tuples_count_ > queue_size_)
       {
-        Tuple& t2 = tuples_.begin()->second;
-        drop_signal_.call(boost::get<0>(t2), boost::get<1>(t2), boost::get<2>(t2),
-                          boost::get<3>(t2), boost::get<4>(t2), boost::get<5>(t2),
-                          boost::get<6>(t2), boost::get<7>(t2), boost::get<8>(t2));
-        tuples_.erase(tuples_.begin());
+        popTuple(true);
       }
     }
   }
 
-  // assumes mutex_ is already locked
-  void clearOldTuples()
+  //! Position in the ring of the index-th oldest tuple
+  size_t slot(size_t index) const
   {
-    typename M_TimeToTuple::iterator it = tuples_.begin();
-    typename M_TimeToTuple::iterator end = tuples_.end();
-    for (; it != end;)
+    index += tuples_start_;
+    return index < tuples_.size() ? index : index - tuples_.size();
+  }
+
+  //! Index of the oldest tuple with a stamp not before stamp, or the number of tuples
+  size_t findTuple(const ros::Time& stamp) const
+  {
+    // Messages usually arrive in order, so look at the newest tuple first
+    if (tuples_count_ == 0 || tuples_[slot(tuples_count_ - 1)].stamp < stamp)
+    {
+      return tuples_count_;
+    }
+
+    size_t first = 0, count = tuples_count_;
+    while (count > 0)
     {
-      if (it->first <= last_signal_time_)
+      size_t step = count / 2;
+      if (tuples_[slot(first + step)].stamp < stamp)
       {
-        typename M_TimeToTuple::iterator old = it;
-        ++it;
-
-        Tuple& t = old->second;
-        drop_signal_.call(boost::get<0>(t), boost::get<1>(t), boost::get<2>(t),
-                          boost::get<3>(t), boost::get<4>(t), boost::get<5>(t),
-                          boost::get<6>(t), boost::get<7>(t), boost::get<8>(t));
-        tuples_.erase(old);
+        first += step + 1;
+        count -= step + 1;
       }
       else
       {
-        // the map is sorted by time, so we can ignore anything after this if this one's time is ok
-        break;
+        count = step;
       }
     }
+    return first;
+  }
+
+  // assumes mutex_ is already locked
+  void insertTuple(size_t index, const ros::Time& stamp)
+  {
+    if (tuples_count_ == tuples_.size())
+    {
+      // Only happens without a queue size limit, as the ring holds one tuple more than the limit
+      std::vector<StampedTuple> tuples(tuples_.size() * 2);
+      for (size_t j = 0; j < tuples_count_; ++j)
+      {
+        std::swap(tuples[j], tuples_[slot(j)]);
+      }
+      tuples_.swap(tuples);
+      tuples_start_ = 0;
+    }
+
+    // Move the empty tuple past the end down to index
+    for (size_t j = tuples_count_; j > index; --j)
+    {
+      std::swap(tuples_[slot(j)], tuples_[slot(j - 1)]);
+    }
+    tuples_[slot(index)].stamp = stamp;
+    ++tuples_count_;
+  }
+
+  // assumes mutex_ is already locked
+  void popTuple(bool drop)
+  {
+    Tuple& t = tuples_[tuples_start_].tuple;
+    if (drop)
+    {
+      drop_signal_.call(boost::get<0>(t), boost::get<1>(t), boost::get<2>(t),
+                        boost::get<3>(t), boost::get<4>(t), boost::get<5>(t),
+                        boost::get<6>(t), boost::get<7>(t), boost::get<8>(t));
+    }
+    t = Tuple();
+
+    tuples_start_ = slot(1);
+    --tuples_count_;
   }
 
 private:
   Sync* parent_;
 
   uint32_t queue_size_;
-  typedef std::map<ros::Time, Tuple> M_TimeToTuple;
-  M_TimeToTuple tuples_;
+  struct StampedTuple
+  {
+    ros::Time stamp;
+    Tuple tuple;
+  };
+  std::vector<StampedTuple> tuples_;  //!< Ring of tuples sorted by stamp, allocated up front to hold queue_size_ + 1
+  size_t tuples_start_;               //!< Position of the oldest tuple in the ring
+  size_t tuples_count_;               //!< Number of tuples in the ring
   ros::Time last_signal_time_;
 
   Signal drop_signal_;
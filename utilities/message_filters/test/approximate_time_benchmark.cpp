@@ -0,0 +1,195 @@
+
+/*********************************************************************
+* Software License Agreement (BSD License)
+*
+*  Copyright (c) 2010, Willow Garage, Inc.
+*  All rights reserved.
+*
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions
+*  are met:
+*
+*   * Redistributions of source code must retain the above copyright
+*     notice, this list of conditions and the following disclaimer.
+*   * Redistributions in binary form must reproduce the above
+*     copyright notice, this list of conditions and the following
+*     disclaimer in the documentation and/or other materials provided
+*     with the distribution.
+*   * Neither the name of the Willow Garage nor the names of its
+*     contributors may be used to endorse or promote products derived
+*     from this software without specific prior written permission.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+*  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+*  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+*  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+*  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+*  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+*  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+*  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+*  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+*  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+*  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+*  POSSIBILITY OF SUCH DAMAGE.
+*********************************************************************/
+
+#include "message_filters/synchronizer.h"
+#include "message_filters/sync_policies/approximate_time.h"
+#include <boost/make_shared.hpp>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+using namespace message_filters;
+using namespace message_filters::sync_policies;
+
+struct Header
+{
+  ros::Time stamp;
+};
+
+struct Msg
+{
+  Header header;
+  int data;
+};
+typedef boost::shared_ptr<Msg> MsgPtr;
+typedef boost::shared_ptr<Msg const> MsgConstPtr;
+
+namespace ros
+{
+namespace message_traits
+{
+template<>
+struct TimeStamp<Msg>
+{
+  static ros::Time value(const Msg& m)
+  {
+    return m.header.stamp;
+  }
+};
+}
+}
+
+ros::WallTime t;
+
+inline void tic()
+{
+  t = ros::WallTime::now();
+}
+
+inline double toc()
+{
+  return (ros::WallTime::now() - t).toSec();
+}
+
+struct Counter
+{
+  Counter() : count_(0) {}
+  void cb() { ++count_; }
+  uint32_t count_;
+};
+
+// Calls sync.add<topic>() for a topic only known at run time
+template<class Sync, int i>
+struct Feeder
+{
+  static void add(Sync& sync, uint32_t topic, const MsgConstPtr& msg)
+  {
+    if (topic == i)
+      sync.template add<i>(msg);
+    else
+      Feeder<Sync, i - 1>::add(sync, topic, msg);
+  }
+};
+
+template<class Sync>
+struct Feeder<Sync, 0>
+{
+  static void add(Sync& sync, uint32_t, const MsgConstPtr& msg)
+  {
+    sync.template add<0>(msg);
+  }
+};
+
+struct Arrival
+{
+  uint32_t topic;
+  MsgConstPtr msg;
+};
+
+// Messages of num_topics topics publishing around 10 to 40 Hz, with a few ms of jitter on every stamp
+// and an occasional lost message, in arrival order
+std::vector<Arrival> makeArrivals(uint32_t num_topics, uint32_t num_messages)
+{
+  std::vector<double> period(num_topics), next(num_topics);
+  for (uint32_t i = 0; i < num_topics; i++)
+  {
+    period[i] = 1.0 / (10 + rand() % 31);
+    next[i] = (rand() % 1000) * 1e-5;
+  }
+
+  std::vector<Arrival> arrivals;
+  arrivals.reserve(num_messages);
+  for (uint32_t k = 0; k < num_messages; k++)
+  {
+    uint32_t topic = 0;
+    for (uint32_t i = 1; i < num_topics; i++)
+      if (next[i] < next[topic])
+        topic = i;
+
+    if (rand() % 50 != 0)
+    {
+      MsgPtr msg(boost::make_shared<Msg>());
+      msg->header.stamp = ros::Time(next[topic] + (rand() % 7 - 3) * 0.001 + 1.0);
+      msg->data = k;
+      Arrival arrival = { topic, msg };
+      arrivals.push_back(arrival);
+    }
+    next[topic] += period[topic];
+  }
+  return arrivals;
+}
+
+template<class Policy>
+void benchmark(uint32_t queue_size, uint32_t num_messages)
+{
+  typedef Synchronizer<Policy> Sync;
+  const uint32_t num_topics = Policy::RealTypeCount::value;
+
+  std::vector<Arrival> arrivals = makeArrivals(num_topics, num_messages);
+
+  Sync sync((Policy(queue_size)));
+  Counter counter;
+  sync.registerCallback(boost::bind(&Counter::cb, &counter));
+
+  tic();
+  for (size_t k = 0; k < arrivals.size(); k++)
+    Feeder<Sync, Policy::RealTypeCount::value - 1>::add(sync, arrivals[k].topic, arrivals[k].msg);
+  double elapsed = toc();
+
+  printf("%u topics, queue size %2u: avg add %.9f sec, %u sets from %lu messages\n", num_topics, queue_size,
+         elapsed / arrivals.size(), counter.count_, (unsigned long) arrivals.size());
+}
+
+int main(int, char **)
+{
+  ros::Time::init();
+
+  const uint32_t NUM_MESSAGES = 200000;
+  const uint32_t QUEUE_SIZES[] = { 5, 50 };
+
+  for (size_t q = 0; q < sizeof(QUEUE_SIZES) / sizeof(QUEUE_SIZES[0]); q++)
+  {
+    benchmark<ApproximateTime<Msg, Msg> >(QUEUE_SIZES[q], NUM_MESSAGES);
+    benchmark<ApproximateTime<Msg, Msg, Msg> >(QUEUE_SIZES[q], NUM_MESSAGES);
+    benchmark<ApproximateTime<Msg, Msg, Msg, Msg> >(QUEUE_SIZES[q], NUM_MESSAGES);
+    benchmark<ApproximateTime<Msg, Msg, Msg, Msg, Msg> >(QUEUE_SIZES[q], NUM_MESSAGES);
+    benchmark<ApproximateTime<Msg, Msg, Msg, Msg, Msg, Msg> >(QUEUE_SIZES[q], NUM_MESSAGES);
+    benchmark<ApproximateTime<Msg, Msg, Msg, Msg, Msg, Msg, Msg> >(QUEUE_SIZES[q], NUM_MESSAGES);
+    benchmark<ApproximateTime<Msg, Msg, Msg, Msg, Msg, Msg, Msg, Msg> >(QUEUE_SIZES[q], NUM_MESSAGES);
+    benchmark<ApproximateTime<Msg, Msg, Msg, Msg, Msg, Msg, Msg, Msg, Msg> >(QUEUE_SIZES[q], NUM_MESSAGES);
+  }
+
+  return 0;
+}
@@ -0,0 +1,142 @@
+/*********************************************************************
+* Software License Agreement (BSD License)
+*
+*  Copyright (c) 2008, Willow Garage, Inc.
+*  All rights reserved.
+*
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions
+*  are met:
+*
+*   * Redistributions of source code must retain the above copyright
+*     notice, this list of conditions and the following disclaimer.
+*   * Redistributions in binary form must reproduce the above
+*     copyright notice, this list of conditions and the following
+*     disclaimer in the documentation and/or other materials provided
+*     with the distribution.
+*   * Neither the name of the Willow Garage nor the names of its
+*     contributors may be used to endorse or promote products derived
+*     from this software without specific prior written permission.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+*  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+*  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+*  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+*  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+*  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+*  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+*  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+*  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+*  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+*  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+*  POSSIBILITY OF SUCH DAMAGE.
+*********************************************************************/
+
+
+#include <cstdio>
+#include <cstdlib>
+#include "ros/time.h"
+#include "message_filters/cache.h"
+
+using namespace message_filters;
+
+struct Header
+{
+  ros::Time stamp;
+};
+
+struct Msg
+{
+  Header header;
+  int data;
+};
+typedef boost::shared_ptr<Msg const> MsgConstPtr;
+
+namespace ros
+{
+namespace message_traits
+{
+template<>
+struct TimeStamp<Msg>
+{
+  static ros::Time value(const Msg& m)
+  {
+    return m.header.stamp;
+  }
+};
+}
+}
+
+ros::WallTime t;
+
+inline void tic()
+{
+  t = ros::WallTime::now();
+}
+
+inline double toc()
+{
+  return (ros::WallTime::now() - t).toSec();
+}
+
+MsgConstPtr buildMsg(double time, int data)
+{
+  boost::shared_ptr<Msg> msg(new Msg);
+  msg->data = data;
+  msg->header.stamp.fromSec(time);
+  return msg;
+}
+
+// Fills caches of growing size at 1 kHz and times random lookups over them
+int main(int, char **)
+{
+  ros::Time::init();
+
+  const int NUM_QUERIES = 100000;
+  const unsigned int SIZES[] = { 100, 1000, 10000, 100000 };
+
+  for (size_t s = 0; s < sizeof(SIZES) / sizeof(SIZES[0]); s++)
+  {
+    const unsigned int size = SIZES[s];
+    Cache<Msg> cache(size);
+
+    // Wrap the ring once so the oldest message is in the middle of it
+    tic();
+    for (unsigned int i = 0; i < 2 * size; i++)
+      cache.add(buildMsg(i * 0.001, i));
+    printf("size %6u: avg add              %.9f sec\n", size, toc() / (2.0 * size));
+
+    std::vector<ros::Time> times(NUM_QUERIES);
+    for (int i = 0; i < NUM_QUERIES; i++)
+      times[i].fromSec((size + rand() % size) * 0.001 + 0.0005);
+
+    size_t found = 0;
+    tic();
+    for (int i = 0; i < NUM_QUERIES; i++)
+      found += cache.getElemBeforeTime(times[i]) ? 1 : 0;
+    printf("size %6u: avg getElemBeforeTime %.9f sec\n", size, toc() / NUM_QUERIES);
+
+    tic();
+    for (int i = 0; i < NUM_QUERIES; i++)
+      found += cache.getElemAfterTime(times[i]) ? 1 : 0;
+    printf("size %6u: avg getElemAfterTime  %.9f sec\n", size, toc() / NUM_QUERIES);
+
+    tic();
+    for (int i = 0; i < NUM_QUERIES; i++)
+      found += cache.getInterval(times[i], times[i] + ros::Duration(0.01)).size();
+    printf("size %6u: avg getInterval       %.9f sec\n", size, toc() / NUM_QUERIES);
+
+    tic();
+    for (int i = 0; i < NUM_QUERIES; i++)
+      found += cache.getSurroundingInterval(times[i], times[i] + ros::Duration(0.01)).size();
+    printf("size %6u: avg getSurroundingInterval %.9f sec\n", size, toc() / NUM_QUERIES);
+
+    // Messages a little late push the insertion point back from the end of the ring
+    tic();
+    for (unsigned int i = 0; i < size; i++)
+      cache.add(buildMsg((2 * size + i) * 0.001 - 0.0025, i));
+    printf("size %6u: avg out-of-order add %.9f sec (%lu messages found)\n", size, toc() / size, (unsigned long) found);
+  }
+
+  return 0;
+}
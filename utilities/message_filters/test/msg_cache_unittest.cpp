@@ -191,6 +191,49 @@ TEST(Cache, easyElemBeforeAfter)
   EXPECT_TRUE(!elem_ptr) ;
 }
 
+TEST(Cache, wrapAroundUnsorted)
+{
+  Cache<Msg> cache(4) ;
+
+  // Overfill the ring so that it wraps, with some messages out of order
+  cache.add(buildMsg(10.0, 1)) ;
+  cache.add(buildMsg(30.0, 3)) ;
+  cache.add(buildMsg(20.0, 2)) ;
+  cache.add(buildMsg(50.0, 5)) ;
+  cache.add(buildMsg(40.0, 4)) ;
+  cache.add(buildMsg(60.0, 6)) ;
+
+  vector<boost::shared_ptr<Msg const> > interval_data = cache.getInterval(ros::Time().fromSec(0), ros::Time().fromSec(100)) ;
+  ASSERT_EQ(interval_data.size(), (unsigned int) 4) ;
+  EXPECT_EQ(interval_data[0]->data, 3) ;
+  EXPECT_EQ(interval_data[1]->data, 4) ;
+  EXPECT_EQ(interval_data[2]->data, 5) ;
+  EXPECT_EQ(interval_data[3]->data, 6) ;
+
+  EXPECT_EQ(cache.getOldestTime(), ros::Time().fromSec(30)) ;
+  EXPECT_EQ(cache.getLatestTime(), ros::Time().fromSec(60)) ;
+  EXPECT_EQ(cache.getElemBeforeTime(ros::Time().fromSec(45))->data, 4) ;
+  EXPECT_EQ(cache.getElemAfterTime(ros::Time().fromSec(45))->data, 5) ;
+
+  interval_data = cache.getSurroundingInterval(ros::Time().fromSec(45), ros::Time().fromSec(55)) ;
+  ASSERT_EQ(interval_data.size(), (unsigned int) 3) ;
+  EXPECT_EQ(interval_data[0]->data, 4) ;
+  EXPECT_EQ(interval_data[2]->data, 6) ;
+
+  // Shrinking keeps the newest messages
+  cache.setCacheSize(2) ;
+  interval_data = cache.getInterval(ros::Time().fromSec(0), ros::Time().fromSec(100)) ;
+  ASSERT_EQ(interval_data.size(), (unsigned int) 2) ;
+  EXPECT_EQ(interval_data[0]->data, 5) ;
+  EXPECT_EQ(interval_data[1]->data, 6) ;
+
+  cache.add(buildMsg(55.0, 7)) ;
+  interval_data = cache.getInterval(ros::Time().fromSec(0), ros::Time().fromSec(100)) ;
+  ASSERT_EQ(interval_data.size(), (unsigned int) 2) ;
+  EXPECT_EQ(interval_data[0]->data, 7) ;
+  EXPECT_EQ(interval_data[1]->data, 6) ;
+}
+
 struct EventHelper
 {
 public:
@@ -165,6 +165,37 @@ TEST(ExactTime, dropCallback)
   ASSERT_EQ(h.drop_count_, 1);
 }
 
+TEST(ExactTime, outOfOrderUnlimitedQueue)
+{
+  Sync2 sync(0);
+  Helper h;
+  sync.registerCallback(boost::bind(&Helper::cb, &h));
+  sync.getPolicy()->registerDropCallback(boost::bind(&Helper::dropcb, &h));
+
+  // Fill more tuples than the initial capacity, newest first
+  for (int i = 40; i > 0; --i)
+  {
+    MsgPtr m(boost::make_shared<Msg>());
+    m->header.stamp = ros::Time(i);
+    sync.add<0>(m);
+  }
+  ASSERT_EQ(h.count_, 0);
+  ASSERT_EQ(h.drop_count_, 0);
+
+  // Completing a tuple drops all the older ones
+  MsgPtr m(boost::make_shared<Msg>());
+  m->header.stamp = ros::Time(10);
+  sync.add<1>(m);
+  ASSERT_EQ(h.count_, 1);
+  ASSERT_EQ(h.drop_count_, 9);
+
+  m = boost::make_shared<Msg>();
+  m->header.stamp = ros::Time(40);
+  sync.add<1>(m);
+  ASSERT_EQ(h.count_, 2);
+  ASSERT_EQ(h.drop_count_, 38);
+}
+
 struct EventHelper
 {
   void callback(const ros::MessageEvent<Msg const>& e1, const ros::MessageEvent<Msg const>& e2)